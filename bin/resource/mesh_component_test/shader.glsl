@@ -1,5 +1,6 @@
 // vertex
 #version 330
+#extension GL_ARB_shader_draw_parameters : enable
 layout (location = 0) in vec3 vpos;
 layout (location = 1) in vec3 vnorm;
 layout (location = 2) in mat4 transform;
@@ -9,11 +10,17 @@ out vec3 o_color;
 
 layout (std140) uniform u_material { vec3 color; } material;
 layout (std140) uniform u_scene { mat4 transform; mat4 projection; mat4 view_proj; } scene;
-layout (std140) uniform u_model { mat4 transform; } model;
+#ifdef GL_ARB_shader_draw_parameters
+// lets the driver draw every node using this shader with multi-draw calls
+layout (std140) uniform u_models { ModelUniforms models[MAX_BATCH_SIZE]; } batch;
+#define model batch.models[gl_DrawIDARB]
+#else
+layout (std140) uniform u_model { mat4 transform; mat4 normal_transform; } model;
+#endif
 
 void main() {
-    gl_Position = scene.view_proj * transform * vec4(vpos, 1.0);
-    o_norm = vnorm;
+    gl_Position = scene.view_proj * model.transform * transform * vec4(vpos, 1.0);
+    o_norm = (model.transform * vec4(vnorm, 0.0)).xyz;
     o_color = material.color;
 };
 
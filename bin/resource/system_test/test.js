@@ -107,8 +107,11 @@ class TestSystem extends engine.System {
 			by this system, or all components maintained by this system if no filters
 			are passed.
 			
-			TODO: document filters
-			TODO: add filters...
+			Without filters the same array is returned every time, and the engine
+			keeps it up to date as components are added and removed. Don't modify it.
+			
+			Filters select components by which engine components their entities have:
+			this.query_components({ with: ['mesh'], without: ['physics'] })
 		 */
 		const components = this.query_components();
 		components.forEach(comp => {
@@ -82,6 +82,147 @@ namespace r2 {
 		args.GetReturnValue().Set(to_v8(args.GetIsolate(), lines));
 	}
 
+	void enable_script_profiler(v8Args args) {
+		bool enabled = args.Length() == 0 || args[0]->BooleanValue(args.GetIsolate());
+		r2engine::scripts()->profiler()->set_enabled(enabled);
+	}
+
+	void sample_script_frames(v8Args args) {
+		if (args.Length() != 1 || !args[0]->IsNumber()) {
+			r2Error("engine.profiler.sample_frames must receive the number of frames to sample");
+			return;
+		}
+		r2engine::scripts()->profiler()->profile_frames(args[0]->Uint32Value(args.GetIsolate()->GetCurrentContext()).FromMaybe(0));
+	}
+
+	void script_profile(v8Args args) {
+		args.GetReturnValue().Set(json_parse(args.GetIsolate(), r2engine::scripts()->profiler()->to_json()));
+	}
+
+	void export_script_profile(v8Args args) {
+		if (args.Length() != 1 || !args[0]->IsString()) {
+			r2Error("engine.profiler.export must receive a file path");
+			return;
+		}
+		bool success = r2engine::scripts()->profiler()->export_json(convert<mstring>::from_v8(args.GetIsolate(), args[0]));
+		args.GetReturnValue().Set(success);
+	}
+
+	void reset_script_profile(v8Args args) {
+		r2engine::scripts()->profiler()->reset();
+	}
+
+	// engine.jobs.submit(file, input, [transfer], callback)
+	void submit_script_job(v8Args args) {
+		auto isolate = args.GetIsolate();
+		if (args.Length() < 3 || !args[0]->IsString() || !args[args.Length() - 1]->IsFunction()) {
+			r2Error("engine.jobs.submit must receive a job file, an input value, an optional array of buffers to transfer and a callback");
+			return;
+		}
+
+		Local<Value> transfer = args.Length() > 3 ? args[2] : Local<Value>();
+		mstring file = convert<mstring>::from_v8(isolate, args[0]);
+		script_job_id id = r2engine::scripts()->jobs()->submit(file, args[1], transfer, args[args.Length() - 1].As<Function>());
+		if (id != 0) args.GetReturnValue().Set(id);
+	}
+
+	void pending_script_jobs(v8Args args) {
+		args.GetReturnValue().Set(r2engine::scripts()->jobs()->pending());
+	}
+
+	void script_job_workers(v8Args args) {
+		args.GetReturnValue().Set(r2engine::scripts()->jobs()->max_workers());
+	}
+
+	// Reads 'stride' floats per query out of a Float32Array, and the optional Uint32Array of entities to ignore per query
+	static bool physics_query_args(v8Args args, const char* name, size_t stride, const void** queries, size_t* count, const entityId** ignore) {
+		if (args.Length() < 1 || !args[0]->IsFloat32Array() || Local<Float32Array>::Cast(args[0])->Length() % stride != 0) {
+			r2Error("engine.physics.%s must receive a Float32Array with %llu values per query, and optionally a Uint32Array of entity ids to ignore per query", name, stride);
+			return false;
+		}
+
+		Local<Float32Array> input = Local<Float32Array>::Cast(args[0]);
+		*queries = (u8*)input->Buffer()->GetContents().Data() + input->ByteOffset();
+		*count = input->Length() / stride;
+		*ignore = nullptr;
+
+		if (args.Length() > 1 && !args[1]->IsUndefined()) {
+			if (!args[1]->IsUint32Array() || Local<Uint32Array>::Cast(args[1])->Length() != *count) {
+				r2Error("engine.physics.%s: The entities to ignore must be a Uint32Array with one id per query", name);
+				return false;
+			}
+
+			Local<Uint32Array> ids = Local<Uint32Array>::Cast(args[1]);
+			*ignore = (const entityId*)((u8*)ids->Buffer()->GetContents().Data() + ids->ByteOffset());
+		}
+
+		return true;
+	}
+
+	// Hits are written straight into the returned buffer, 8 values per query: entity, fraction, point xyz, normal xyz.
+	// 'hits' and 'entities' are float and uint views of it
+	static Local<Object> physics_hits(Isolate* isolate, size_t count, physics_hit** hits) {
+		Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, count * sizeof(physics_hit));
+		*hits = (physics_hit*)buffer->GetContents().Data();
+
+		size_t values = count * (sizeof(physics_hit) / sizeof(f32));
+		Local<Object> result = Object::New(isolate);
+		result->Set(v8str("hits"), Float32Array::New(buffer, 0, values));
+		result->Set(v8str("entities"), Uint32Array::New(buffer, 0, values));
+		result->Set(v8str("stride"), Number::New(isolate, f64(sizeof(physics_hit) / sizeof(f32))));
+		return result;
+	}
+
+	// engine.physics.raycast(Float32Array [fromX, fromY, fromZ, toX, toY, toZ, ...], [Uint32Array ignore])
+	void physics_raycast_batch(v8Args args) {
+		const void* rays = nullptr;
+		size_t count = 0;
+		const entityId* ignore = nullptr;
+		if (!physics_query_args(args, "raycast", 6, &rays, &count, &ignore)) return;
+
+		physics_hit* hits = nullptr;
+		Local<Object> result = physics_hits(args.GetIsolate(), count, &hits);
+		physics_sys::get()->raycast((const physics_ray*)rays, count, hits, ignore);
+		args.GetReturnValue().Set(result);
+	}
+
+	// engine.physics.sweep(Float32Array [fromX, fromY, fromZ, toX, toY, toZ, radius, ...], [Uint32Array ignore])
+	void physics_sweep_batch(v8Args args) {
+		const void* sweeps = nullptr;
+		size_t count = 0;
+		const entityId* ignore = nullptr;
+		if (!physics_query_args(args, "sweep", 7, &sweeps, &count, &ignore)) return;
+
+		physics_hit* hits = nullptr;
+		Local<Object> result = physics_hits(args.GetIsolate(), count, &hits);
+		physics_sys::get()->sweep((const physics_sphere_sweep*)sweeps, count, hits, ignore);
+		args.GetReturnValue().Set(result);
+	}
+
+	// engine.physics.overlap(Float32Array [x, y, z, radius, ...], [Uint32Array ignore])
+	// The entities overlapping sphere i are entities[offsets[i]] to entities[offsets[i + 1]]
+	void physics_overlap_batch(v8Args args) {
+		auto isolate = args.GetIsolate();
+		const void* spheres = nullptr;
+		size_t count = 0;
+		const entityId* ignore = nullptr;
+		if (!physics_query_args(args, "overlap", 4, &spheres, &count, &ignore)) return;
+
+		mvector<u32> offsets;
+		mvector<entityId> entities;
+		physics_sys::get()->overlap((const physics_sphere*)spheres, count, offsets, entities, ignore);
+
+		Local<ArrayBuffer> offsetBuffer = ArrayBuffer::New(isolate, offsets.size() * sizeof(u32));
+		memcpy(offsetBuffer->GetContents().Data(), offsets.data(), offsets.size() * sizeof(u32));
+		Local<ArrayBuffer> entityBuffer = ArrayBuffer::New(isolate, entities.size() * sizeof(entityId));
+		if (entities.size() > 0) memcpy(entityBuffer->GetContents().Data(), entities.data(), entities.size() * sizeof(entityId));
+
+		Local<Object> result = Object::New(isolate);
+		result->Set(v8str("offsets"), Uint32Array::New(offsetBuffer, 0, offsets.size()));
+		result->Set(v8str("entities"), Uint32Array::New(entityBuffer, 0, entities.size()));
+		args.GetReturnValue().Set(result);
+	}
+
 	void open_window(v8Args args) {
 		r2engine* engine = r2engine::get();
 		auto isolate = args.GetIsolate();
@@ -289,6 +430,26 @@ namespace r2 {
 		m.set("register_system", &register_system);
 		m.set("frame_rate", &fps);
 
+		module prof(isolate);
+		prof.set("enable", &enable_script_profiler);
+		prof.set("sample_frames", &sample_script_frames);
+		prof.set("report", &script_profile);
+		prof.set("export", &export_script_profile);
+		prof.set("reset", &reset_script_profile);
+		m.set("profiler", prof);
+
+		module jobs(isolate);
+		jobs.set("submit", &submit_script_job);
+		jobs.set("pending", &pending_script_jobs);
+		jobs.set("workers", &script_job_workers);
+		m.set("jobs", jobs);
+
+		module physics(isolate);
+		physics.set("raycast", &physics_raycast_batch);
+		physics.set("sweep", &physics_sweep_batch);
+		physics.set("overlap", &physics_overlap_batch);
+		m.set("physics", physics);
+
 		module mem(isolate);
 		mem.set("Kilobytes", kb2b);
 		mem.set("Megabytes", mb2b);
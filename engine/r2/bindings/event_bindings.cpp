@@ -19,6 +19,7 @@ namespace r2 {
 		s.set("name", property(&event::name));
 		s.set("stop_propagation", &event::stop_propagating);
 		s.set("data", property(&event::get_json, &event::set_json));
+		s.set("buffer", property(&event::get_buffer));
 		ctx->set("Event", s);
 	}
 
@@ -2,24 +2,115 @@
 #include <r2/bindings/math_converters.h>
 
 namespace v8pp {
+	// slot in the isolate's embedder data that holds its math_converter_cache
+	#define MATH_CONVERTER_ISOLATE_DATA_SLOT 0
+
+	// bytes per shared ArrayBuffer that backs the typed arrays of math types returned to scripts
+	#define MATH_CONVERTER_SLAB_SIZE 16384
+
+	#define MATH_CONVERTER_CLASS_COUNT 18
+
+	// Slabs are backed by memory the converters own rather than the isolate, which makes them external buffers
+	// that can't be transferred (see script_job_pool). The memory is freed once V8 collects the slab
+	struct math_converter_slab {
+		Global<ArrayBuffer> handle;
+		u8* data;
+	};
+
+	static void free_slab(const WeakCallbackInfo<math_converter_slab>& info) {
+		math_converter_slab* slab = info.GetParameter();
+		slab->handle.Reset();
+		info.GetIsolate()->AdjustAmountOfExternalAllocatedMemory(-i64(MATH_CONVERTER_SLAB_SIZE));
+		r2free(slab->data);
+		delete slab;
+	}
+
+	// Per-isolate handles used to create and read math types without calling into script.
+	// Like the script context itself this is never freed, it lives as long as the isolate
+	struct math_converter_cache {
+		Global<String> arrKey;
+		Global<Object> prototypes[MATH_CONVERTER_CLASS_COUNT];
+		Global<ArrayBuffer> slab;
+		u8* slabData;
+		size_t slabUsed;
+	};
+
+	static math_converter_cache* get_cache(Isolate* isolate) {
+		math_converter_cache* cache = (math_converter_cache*)isolate->GetData(MATH_CONVERTER_ISOLATE_DATA_SLOT);
+		if (cache) return cache;
+
+		cache = new math_converter_cache();
+		cache->arrKey.Reset(isolate, String::NewFromUtf8(isolate, "__arr", NewStringType::kInternalized).ToLocalChecked());
+		cache->slabData = nullptr;
+		cache->slabUsed = MATH_CONVERTER_SLAB_SIZE;
+		isolate->SetData(MATH_CONVERTER_ISOLATE_DATA_SLOT, cache);
+		return cache;
+	}
+
+	template <typename T> struct typed_array_of { };
+	template <> struct typed_array_of<f32> { static Local<TypedArray> New(Local<ArrayBuffer> b, size_t o, size_t l) { return Float32Array::New(b, o, l); } };
+	template <> struct typed_array_of<i32> { static Local<TypedArray> New(Local<ArrayBuffer> b, size_t o, size_t l) { return Int32Array::New(b, o, l); } };
+	template <> struct typed_array_of<u32> { static Local<TypedArray> New(Local<ArrayBuffer> b, size_t o, size_t l) { return Uint32Array::New(b, o, l); } };
+
+	// Creates a typed array over a piece of the current slab, rather than giving every value its own ArrayBuffer.
+	// A slab stays alive for as long as any value created from it does. Script jobs copy only the part a value
+	// views when it's sent to or from a job
 	template <typename T>
-	Local<Value> instantiate_vector_class(Isolate* isolate, const char* className, u8 pcount, const T* params) {
-		auto context = isolate->GetCurrentContext();
-		auto global = context->Global();
+	static Local<TypedArray> allocate_numbers(Isolate* isolate, math_converter_cache* cache, u8 count, const T* values) {
+		size_t size = sizeof(T) * count;
+		Local<ArrayBuffer> slab;
+		if (cache->slabUsed + size > MATH_CONVERTER_SLAB_SIZE) {
+			// values can outlive the state that created them
+			memory_man::push_current(memory_man::global());
+			math_converter_slab* s = new math_converter_slab();
+			s->data = (u8*)r2alloc(MATH_CONVERTER_SLAB_SIZE);
+			memory_man::pop_current();
+			memset(s->data, 0, MATH_CONVERTER_SLAB_SIZE);
+
+			slab = ArrayBuffer::New(isolate, s->data, MATH_CONVERTER_SLAB_SIZE, ArrayBufferCreationMode::kExternalized);
+			s->handle.Reset(isolate, slab);
+			s->handle.SetWeak(s, free_slab, WeakCallbackType::kParameter);
+			isolate->AdjustAmountOfExternalAllocatedMemory(MATH_CONVERTER_SLAB_SIZE);
+
+			cache->slab.Reset(isolate, slab);
+			cache->slabData = s->data;
+			cache->slabUsed = 0;
+		} else slab = cache->slab.Get(isolate);
+
+		memcpy(cache->slabData + cache->slabUsed, values, size);
+		Local<TypedArray> arr = typed_array_of<T>::New(slab, cache->slabUsed, count);
+		cache->slabUsed += size;
+		return arr;
+	}
 
+	template <typename T>
+	Local<Value> instantiate_vector_class(Isolate* isolate, u8 classIdx, const char* className, u8 pcount, const T* params) {
 		EscapableHandleScope scope(isolate);
+		auto context = isolate->GetCurrentContext();
+		math_converter_cache* cache = get_cache(isolate);
+
+		if (cache->prototypes[classIdx].IsEmpty()) {
+			// construct one instance through JS, every value after that is a clone of it
+			Local<Value> constructor = context->Global()->Get(v8str(className));
+			Local<Value> instance;
+			if (!constructor->IsFunction() || !Local<Function>::Cast(constructor)->CallAsConstructor(context, 0, nullptr).ToLocal(&instance) || !instance->IsObject()) {
+				r2Error("Failed to construct JS math type '%s', returning a typed array instead", className);
+				return scope.Escape(allocate_numbers(isolate, cache, pcount, params));
+			}
+			cache->prototypes[classIdx].Reset(isolate, Local<Object>::Cast(instance));
+		}
 
-		using value = Local<Value>;
-		using object = Local<Object>;
-		using func = Local<Function>;
-
-		value args[16];
-		for(u8 i = 0;i < pcount;i++) args[i] = value::New(isolate, Number::New(isolate, params[i]));
+		// clones share the hidden class of the prototype, and no JS runs to create them
+		Local<Object> result = cache->prototypes[classIdx].Get(isolate)->Clone();
+		result->Set(context, cache->arrKey.Get(isolate), allocate_numbers(isolate, cache, pcount, params)).FromJust();
+		return scope.Escape(result);
+	}
 
-		func constructor = func::Cast(global->Get(v8str(className)));
-		value ret;
-		assert(constructor->CallAsConstructor(context, pcount, args).ToLocal(&ret));
-		return scope.Escape(ret);
+	template <typename S, typename T>
+	static void read_typed_array(Local<TypedArray> arr, u8 count, T* out) {
+		S values[16];
+		arr->CopyContents(values, sizeof(S) * count);
+		for (u8 i = 0;i < count;i++) out[i] = T(values[i]);
 	}
 
 	template<typename T>
@@ -28,78 +119,43 @@ namespace v8pp {
 		lo obj = lo::Cast(value);
 		auto ctx = isolate->GetCurrentContext();
 
-		auto arr = obj->Get(v8str("__arr"));
-		if(!arr->IsUndefined()) {
-			// read values from that instead, this is a js vector or matrix class
-			if (arr->IsFloat32Array()) {
-				Local<Float32Array> values = Local<Float32Array>::Cast(arr);
-				if (values->Length() != count) {
-					r2Error("Expected object or array with exactly %d properties or elements", count);
-					for(u32 i = 0;i < values->Length();i++){
-						auto propName = values->Get(i);
-						mstring s = convert<mstring>::from_v8(isolate, propName);
-						r2Log("%d: %s", i, s.c_str());
-					}
-					return false;
-				}
-
-				auto buffer = values->Buffer();
-				if (!buffer.IsEmpty()) {
-					size_t offset = values->ByteOffset();
-					void* data = values->Buffer()->GetContents().Data();
-					memcpy(out, ((u8*)data) + offset, sizeof(T) * count);
-					return true;
-				}
+		Local<Value> arr = value;
+		if (!value->IsTypedArray() && !obj->Get(ctx, get_cache(isolate)->arrKey.Get(isolate)).ToLocal(&arr)) return false;
 
-				for(u8 i = 0;i < count;i++) out[i] = values->Get(i)->ToNumber(isolate)->NumberValue(ctx).FromMaybe(T(0));
-				return true;
+		if (arr->IsTypedArray()) {
+			// a js vector or matrix class, or a bare typed array
+			Local<TypedArray> values = Local<TypedArray>::Cast(arr);
+			if (values->Length() != count) {
+				r2Error("Expected object or array with exactly %d properties or elements, got typed array with %llu elements", count, values->Length());
+				return false;
 			}
-			if (arr->IsInt32Array()) {
-				Local<Int32Array> values = Local<Int32Array>::Cast(arr);
-				if (values->Length() != count) {
-					r2Error("Expected object or array with exactly %d properties or elements", count);
-					for(u32 i = 0;i < values->Length();i++){
-						auto propName = values->Get(i);
-						mstring s = convert<mstring>::from_v8(isolate, propName);
-						r2Log("%d: %s", i, s.c_str());
-					}
-					return false;
-				}
 
-				auto buffer = values->Buffer();
-				if (!buffer.IsEmpty()) {
-					size_t offset = values->ByteOffset();
-					void* data = values->Buffer()->GetContents().Data();
-					memcpy(out, ((u8*)data) + offset, sizeof(T) * count);
-					return true;
-				}
+			if (values->IsFloat32Array()) read_typed_array<f32>(values, count, out);
+			else if (values->IsInt32Array()) read_typed_array<i32>(values, count, out);
+			else if (values->IsUint32Array()) read_typed_array<u32>(values, count, out);
+			else if (values->IsFloat64Array()) read_typed_array<f64>(values, count, out);
+			else {
+				for(u8 i = 0;i < count;i++) out[i] = T(values->Get(ctx, i).ToLocalChecked()->NumberValue(ctx).FromMaybe(0.0));
+			}
+			return true;
+		}
 
-				for(u8 i = 0;i < count;i++) out[i] = values->Get(i)->ToInteger(isolate)->Int32Value(ctx).FromMaybe(T(0));
-				return true;
+		if (value->IsArray()) {
+			Local<Array> elements = Local<Array>::Cast(value);
+			if (elements->Length() != count) {
+				r2Error("Expected object or array with exactly %d properties or elements", count);
+				return false;
 			}
-			if (arr->IsUint32Array()) {
-				Local<Uint32Array> values = Local<Uint32Array>::Cast(arr);
-				if (values->Length() != count) {
-					r2Error("Expected object or array with exactly %d properties or elements", count);
-					for(u32 i = 0;i < values->Length();i++){
-						auto propName = values->Get(i);
-						mstring s = convert<mstring>::from_v8(isolate, propName);
-						r2Log("%d: %s", i, s.c_str());
-					}
-					return false;
-				}
 
-				auto buffer = values->Buffer();
-				if (!buffer.IsEmpty()) {
-					size_t offset = values->ByteOffset();
-					void* data = values->Buffer()->GetContents().Data();
-					memcpy(out, ((u8*)data) + offset, sizeof(T) * count);
-					return true;
+			for(u8 i = 0;i < count;i++) {
+				Local<Value> v;
+				if (!elements->Get(ctx, i).ToLocal(&v) || !v->IsNumber()) {
+					r2Error("Expected element or property at index %d to be a number", i);
+					return false;
 				}
-
-				for(u8 i = 0;i < count;i++) out[i] = values->Get(i)->ToInteger(isolate)->Uint32Value(ctx).FromMaybe(T(0));
-				return true;
+				out[i] = T(v->NumberValue(ctx).FromMaybe(0.0));
 			}
+			return true;
 		}
 
 		auto properties = obj->GetPropertyNames(ctx);
@@ -125,7 +181,7 @@ namespace v8pp {
 				r2Error("Expected element or property at index %d to be a number", i);
 				return false;
 			}
-			out[i] = out[i] = v->ToNumber(isolate)->NumberValue(ctx).FromMaybe(T(0));
+			out[i] = T(v->NumberValue(ctx).FromMaybe(0.0));
 		}
 
 		return true;
@@ -175,7 +231,7 @@ namespace v8pp {
 	}
 
 
-	#define v4(t, tt, postfix) \
+	#define v4(t, tt, postfix, idx) \
 	t _from_v8_v4##postfix(v8::Isolate* isolate, v8::Local<v8::Value> value) { \
 		tt values[4]; \
 		if (read_numbers<tt>(isolate, value, 4, values)) return t(values[0], values[1], values[2], values[3]); \
@@ -183,11 +239,11 @@ namespace v8pp {
 	} \
 	v8::Handle<v8::Object> _to_v8_v4##postfix(v8::Isolate* isolate, t const& value) { \
 		v8::EscapableHandleScope scope(isolate); \
-		Local<Object> result = Local<Object>::Cast(instantiate_vector_class<tt>(isolate, #t, 4, &value.x)); \
+		Local<Object> result = Local<Object>::Cast(instantiate_vector_class<tt>(isolate, idx, #t, 4, &value.x)); \
 		return scope.Escape(result); \
 	}
 
-	#define v3(t, tt, postfix) \
+	#define v3(t, tt, postfix, idx) \
 	t _from_v8_v3##postfix(v8::Isolate* isolate, v8::Local<v8::Value> value) { \
 		tt values[3]; \
 		if (read_numbers<tt>(isolate, value, 3, values)) return t(values[0], values[1], values[2]); \
@@ -195,11 +251,11 @@ namespace v8pp {
 	} \
 	v8::Handle<v8::Object> _to_v8_v3##postfix(v8::Isolate* isolate, t const& value) { \
 		v8::EscapableHandleScope scope(isolate); \
-		Local<Object> result = Local<Object>::Cast(instantiate_vector_class<tt>(isolate, #t, 3, &value.x)); \
+		Local<Object> result = Local<Object>::Cast(instantiate_vector_class<tt>(isolate, idx, #t, 3, &value.x)); \
 		return scope.Escape(result); \
 	}
 
-	#define v2(t, tt, postfix) \
+	#define v2(t, tt, postfix, idx) \
 	t _from_v8_v2##postfix(v8::Isolate* isolate, v8::Local<v8::Value> value) { \
 		tt values[2]; \
 		if (read_numbers<tt>(isolate, value, 2, values)) return t(values[0], values[1]); \
@@ -207,11 +263,11 @@ namespace v8pp {
 	} \
 	v8::Handle<v8::Object> _to_v8_v2##postfix(v8::Isolate* isolate, t const& value) { \
 		v8::EscapableHandleScope scope(isolate); \
-		Local<Object> result = Local<Object>::Cast(instantiate_vector_class<tt>(isolate, #t, 2, &value.x)); \
+		Local<Object> result = Local<Object>::Cast(instantiate_vector_class<tt>(isolate, idx, #t, 2, &value.x)); \
 		return scope.Escape(result); \
 	}
 
-	#define m4(t, tt, postfix) \
+	#define m4(t, tt, postfix, idx) \
 	t _from_v8_m4##postfix(v8::Isolate* isolate, v8::Local<v8::Value> value) { \
 		tt v[16]; \
 		if (read_numbers<tt>(isolate, value, 16, v)) return t(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], v[9], v[10], v[11], v[12], v[13], v[14], v[15]); \
@@ -219,12 +275,12 @@ namespace v8pp {
 	} \
 	v8::Handle<v8::Object> _to_v8_m4##postfix(v8::Isolate* isolate, t const& value) { \
 		v8::EscapableHandleScope scope(isolate); \
-		Local<Object> result = Local<Object>::Cast(instantiate_vector_class<tt>(isolate, #t, 16, &value[0][0])); \
+		Local<Object> result = Local<Object>::Cast(instantiate_vector_class<tt>(isolate, idx, #t, 16, &value[0][0])); \
 		return scope.Escape(result); \
 	}
 
 
-	#define m3(t, tt, postfix) \
+	#define m3(t, tt, postfix, idx) \
 	t _from_v8_m3##postfix(v8::Isolate* isolate, v8::Local<v8::Value> value) { \
 		tt v[9]; \
 		if (read_numbers<tt>(isolate, value, 9, v)) return t(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8]); \
@@ -232,11 +288,11 @@ namespace v8pp {
 	} \
 	v8::Handle<v8::Object> _to_v8_m3##postfix(v8::Isolate* isolate, t const& value) { \
 		v8::EscapableHandleScope scope(isolate); \
-		Local<Object> result = Local<Object>::Cast(instantiate_vector_class<tt>(isolate, #t, 9, &value[0][0])); \
+		Local<Object> result = Local<Object>::Cast(instantiate_vector_class<tt>(isolate, idx, #t, 9, &value[0][0])); \
 		return scope.Escape(result); \
 	}
 
-	#define m2(t, tt, postfix) \
+	#define m2(t, tt, postfix, idx) \
 	t _from_v8_m2##postfix(v8::Isolate* isolate, v8::Local<v8::Value> value) { \
 		tt v[4]; \
 		if (read_numbers<tt>(isolate, value, 4, v)) return t(v[0], v[1], v[2], v[3]); \
@@ -244,26 +300,26 @@ namespace v8pp {
 	} \
 	v8::Handle<v8::Object> _to_v8_m2##postfix(v8::Isolate* isolate, t const& value) { \
 		v8::EscapableHandleScope scope(isolate); \
-		Local<Object> result = Local<Object>::Cast(instantiate_vector_class<tt>(isolate, #t, 4, &value[0][0])); \
+		Local<Object> result = Local<Object>::Cast(instantiate_vector_class<tt>(isolate, idx, #t, 4, &value[0][0])); \
 		return scope.Escape(result); \
 	}
 
-	v4(vec4i, i32, i);
-	v4(vec4ui, u32, ui);
-	v4(vec4f, f32, f);
-	v3(vec3i, i32, i);
-	v3(vec3ui, u32, ui);
-	v3(vec3f, f32, f);
-	v2(vec2i, i32, i);
-	v2(vec2ui, u32, ui);
-	v2(vec2f, f32, f);
-	m4(mat4i, i32, i);
-	m4(mat4ui, u32, ui);
-	m4(mat4f, f32, f);
-	m3(mat3i, i32, i);
-	m3(mat3ui, u32, ui);
-	m3(mat3f, f32, f);
-	m2(mat2i, i32, i);
-	m2(mat2ui, u32, ui);
-	m2(mat2f, f32, f);
+	v4(vec4i, i32, i, 0);
+	v4(vec4ui, u32, ui, 1);
+	v4(vec4f, f32, f, 2);
+	v3(vec3i, i32, i, 3);
+	v3(vec3ui, u32, ui, 4);
+	v3(vec3f, f32, f, 5);
+	v2(vec2i, i32, i, 6);
+	v2(vec2ui, u32, ui, 7);
+	v2(vec2f, f32, f, 8);
+	m4(mat4i, i32, i, 9);
+	m4(mat4ui, u32, ui, 10);
+	m4(mat4f, f32, f, 11);
+	m3(mat3i, i32, i, 12);
+	m3(mat3ui, u32, ui, 13);
+	m3(mat3f, f32, f, 14);
+	m2(mat2i, i32, i, 15);
+	m2(mat2ui, u32, ui, 16);
+	m2(mat2f, f32, f, 17);
 };
\ No newline at end of file
@@ -15,6 +15,7 @@ typedef v8::Handle<v8::Function> LocalFunctionHandle;
 typedef v8::Persistent<v8::Value, v8::CopyablePersistentTraits<v8::Value>> PersistentValueHandle;
 typedef v8::Persistent<v8::Object, v8::CopyablePersistentTraits<v8::Object>> PersistentObjectHandle;
 typedef v8::Persistent<v8::Function, v8::CopyablePersistentTraits<v8::Function>> PersistentFunctionHandle;
+typedef v8::Persistent<v8::Array, v8::CopyablePersistentTraits<v8::Array>> PersistentArrayHandle;
 
 namespace r2 {
 	struct var {
@@ -132,7 +132,8 @@ namespace r2 {
 			instance->m_globalStateData.push_back(data);
 		}
 
-		instance->scripts()->executeFile("./builtin.js");
+		// a snapshot context has already run the prelude
+		if (!instance->scripts()->booted_from_snapshot()) instance->scripts()->executeFile(SCRIPT_PRELUDE_FILE);
 	}
 
 	r2engine* r2engine::get() { return instance; }
@@ -269,6 +270,7 @@ namespace r2 {
 
 		destroy_event_receiver();
 
+		m_sceneMgr->detach_script_views();		// views of node data belong to the script manager's isolate
 		delete m_scriptMgr; m_scriptMgr = nullptr;	// variable dependencies (based on script usage)
         delete m_stateMgr;  m_stateMgr  = nullptr;	// depends on scene manager
         delete m_sceneMgr;  m_sceneMgr  = nullptr;	// depends on render manager, asset manager
@@ -439,6 +441,9 @@ namespace r2 {
 			// dispatch deferred events
 			frame_started();
 
+			// call back scripts whose jobs finished on worker isolates
+			m_scriptMgr->jobs()->deliver_results();
+
 			f32 time_now = frameTimer;
 			f32 dt = time_now - last_time;
 			last_time = time_now;
@@ -470,6 +475,8 @@ namespace r2 {
 			ImGui::Render();
 			ImGui::EndFrame();
 			m_window.swap_buffers();
+
+			m_scriptMgr->profiler()->frame_finished();
 		}
         return 0;
     }
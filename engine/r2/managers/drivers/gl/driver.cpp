@@ -3,6 +3,8 @@
 #include <r2/utilities/gl3w.h>
 #include <r2/utilities/texture.h>
 
+#include <algorithm>
+
 namespace r2 {
 	const char* glError() noexcept {
 		GLenum err = glGetError();
@@ -130,6 +132,21 @@ namespace r2 {
 
 		return 0;
 	}
+
+	GLenum sizedTextureFormat(u8 channels, texture_type type) {
+		// immutable storage requires sized formats, the unsigned byte formats are the only unsized ones
+		if (type == tt_unsigned_byte) {
+			switch(channels) {
+				case 1:		return GL_R8;
+				case 2:		return GL_RG8;
+				case 3:		return GL_RGB8;
+				case 4:		return GL_RGBA8;
+				default:	return 0;
+			}
+		}
+
+		return internalTextureFormat(channels, type);
+	}
 	
 
 
@@ -174,9 +191,26 @@ namespace r2 {
 		};
 		glCall(glCreateBuffers(1, &m_fsqVbo));
 		glCall(glNamedBufferData(m_fsqVbo, sizeof(f32) * 16, verts, GL_STATIC_DRAW));
+
+		m_batchCommandBuffer = 0;
+		m_batchUniformBuffer = 0;
+		m_batchCommandCapacity = 0;
+		m_batchUniformCapacity = 0;
+		m_maxBatchSize = 0;
+		glCall(glCreateBuffers(1, &m_batchCommandBuffer));
+		glCall(glCreateBuffers(1, &m_batchUniformBuffer));
 	}
 	
 	gl_render_driver::~gl_render_driver() {
+		for (auto& target : m_readbacks) {
+			for (auto& transfer : target.second) {
+				glDeleteSync(transfer.fence);
+				glDeleteBuffers(1, &transfer.pbo);
+			}
+		}
+		for (auto& pbo : m_readbackBuffers) glDeleteBuffers(1, &pbo.first);
+		glDeleteBuffers(1, &m_batchCommandBuffer);
+		glDeleteBuffers(1, &m_batchUniformBuffer);
 		glDeleteBuffers(1, &m_fsqVbo);
 		glDeleteVertexArrays(1, &m_fsqVao);
 	}
@@ -191,15 +225,20 @@ namespace r2 {
 	}
 	
 	void gl_render_driver::generate_vao(r2::render_node* node) {
+		if (node->vertex_array() != 0) return;
+
+		u32 key = node->format_key();
+		auto existing = m_vaos.find(key);
+		if (existing != m_vaos.end()) {
+			existing->second.refs++;
+			node->set_vertex_array(existing->second.vao);
+			return;
+		}
+
 		const vertex_format* vfmt = node->vertices().buffer->format();
 		const instance_format* ifmt = nullptr;
 		if (node->instances().is_valid()) ifmt = node->instances().buffer->format();
 
-		mstring hashStr = vfmt->hash_name();
-		if (ifmt) hashStr += "," + ifmt->hash_name();
-
-		if (m_vaos.count(hashStr) > 0) return;
-
 		GLuint vao;
 		glCall(glGenVertexArrays(1, &vao));
 		glCall(glBindVertexArray(vao));
@@ -271,34 +310,27 @@ namespace r2 {
 
 		glCall(glBindVertexArray(0));
 
-		m_vaos[hashStr] = vao;
+		m_vaos[key] = { vao, 1 };
+		node->set_vertex_array(vao);
 	}
 
 	void gl_render_driver::free_vao(r2::render_node* node) {
-		const vertex_format* vfmt = node->vertices().buffer->format();
-		const instance_format* ifmt = nullptr;
-		if (node->instances().is_valid()) ifmt = node->instances().buffer->format();
+		if (node->vertex_array() == 0) return;
+		node->set_vertex_array(0);
 
-		mstring hashStr = vfmt->hash_name();
-		if (ifmt) hashStr += "," + ifmt->hash_name();
+		auto existing = m_vaos.find(node->format_key());
+		if (existing == m_vaos.end()) return;
 
-		if (m_vaos.count(hashStr) == 0) return;
-		GLuint vao = m_vaos[hashStr];
-		glCall(glDeleteVertexArrays(1, &vao));
-		m_vaos.erase(hashStr);
+		// other nodes with the same formats may still be using it
+		if (--existing->second.refs > 0) return;
+
+		glCall(glDeleteVertexArrays(1, &existing->second.vao));
+		m_vaos.erase(existing);
 	}
 
 	void gl_render_driver::bind_vao(r2::render_node* node) {
-		const vertex_format* vfmt = node->vertices().buffer->format();
-		const instance_format* ifmt = nullptr;
-		if (node->instances().is_valid()) ifmt = node->instances().buffer->format();
-
-		mstring hashStr = vfmt->hash_name();
-		if (ifmt) hashStr += "," + ifmt->hash_name();
-
-		if (m_vaos.count(hashStr) == 0) generate_vao(node);
-
-		glCall(glBindVertexArray(m_vaos[hashStr]));
+		if (node->vertex_array() == 0) generate_vao(node);
+		glCall(glBindVertexArray(node->vertex_array()));
 	}
 
 	void gl_render_driver::unbind_vao() {
@@ -311,6 +343,13 @@ namespace r2 {
 		// Don't (maybe) generate the buffer until there's something in it
 		if (updates.size() == 0) return;
 
+		if (buf->is_dynamic()) {
+			if (m_buffers.count(buf->id()) == 0) create_dynamic_buffer(buf);
+			else sync_dynamic_buffer(buf);
+			buf->clear_updates();
+			return;
+		}
+
 		if (m_buffers.count(buf->id()) == 0) {
 			GLuint newBuf = 0;
 			glCall(glCreateBuffers(1, &newBuf));
@@ -326,74 +365,176 @@ namespace r2 {
 		buf->clear_updates();
 	}
 
+	void gl_render_driver::create_dynamic_buffer(gpu_buffer* buf) {
+		// Each region must start at an offset that can be bound as a uniform
+		// buffer range, or as a vertex/index buffer offset
+		size_t alignment = get_uniform_buffer_block_offset_alignment();
+		if (alignment < 256) alignment = 256;
+		size_t stride = buf->max_size();
+		if (stride % alignment != 0) stride += alignment - (stride % alignment);
+
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT;
+		GLuint newBuf = 0;
+		glCall(glCreateBuffers(1, &newBuf));
+		glCall(glNamedBufferStorage(newBuf, stride * GL_DYNAMIC_BUFFER_REGIONS, nullptr, flags));
+
+		void* mapped = nullptr;
+		glCall(mapped = glMapNamedBufferRange(newBuf, 0, stride * GL_DYNAMIC_BUFFER_REGIONS, flags | GL_MAP_FLUSH_EXPLICIT_BIT));
+		if (!mapped) {
+			r2Error("Failed to map dynamic buffer %d, it will be treated as a static buffer", buf->id());
+			glCall(glDeleteBuffers(1, &newBuf));
+			glCall(glCreateBuffers(1, &newBuf));
+			glCall(glNamedBufferData(newBuf, buf->max_size(), buf->data(), GL_DYNAMIC_DRAW));
+			m_buffers[buf->id()] = newBuf;
+			return;
+		}
+
+		dynamic_buffer& dyn = m_dynamicBuffers[buf->id()];
+		dyn.mapped = (u8*)mapped;
+		dyn.stride = stride;
+		dyn.region = 0;
+		for (u8 r = 0;r < GL_DYNAMIC_BUFFER_REGIONS;r++) {
+			dyn.fences[r] = 0;
+			memcpy(dyn.mapped + (stride * r), buf->data(), buf->max_size());
+		}
+		glCall(glFlushMappedNamedBufferRange(newBuf, 0, stride * GL_DYNAMIC_BUFFER_REGIONS));
+
+		m_buffers[buf->id()] = newBuf;
+	}
+
+	void gl_render_driver::sync_dynamic_buffer(gpu_buffer* buf) {
+		auto d = m_dynamicBuffers.find(buf->id());
+		if (d == m_dynamicBuffers.end()) {
+			// mapping failed when the buffer was created
+			for (auto seg : buf->updates()) {
+				glCall(glNamedBufferSubData(m_buffers[buf->id()], seg.begin, seg.end - seg.begin, (u8*)buf->data() + seg.begin));
+			}
+			return;
+		}
+
+		dynamic_buffer& dyn = d->second;
+
+		// Every region needs to receive these changes before the GPU reads from it
+		for (u8 r = 0;r < GL_DYNAMIC_BUFFER_REGIONS;r++) {
+			for (auto seg : buf->updates()) gpu_buffer::merge_update(dyn.pending[r], seg.begin, seg.end);
+		}
+
+		// Any commands that read from the current region have already been submitted
+		if (dyn.fences[dyn.region]) glCall(glDeleteSync(dyn.fences[dyn.region]));
+		glCall(dyn.fences[dyn.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+
+		dyn.region = (dyn.region + 1) % GL_DYNAMIC_BUFFER_REGIONS;
+
+		// Make sure the GPU is done with the next region before overwriting it
+		GLsync fence = dyn.fences[dyn.region];
+		if (fence) {
+			GLenum result = GL_TIMEOUT_EXPIRED;
+			while (result == GL_TIMEOUT_EXPIRED) {
+				glCall(result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000));
+			}
+			glCall(glDeleteSync(fence));
+			dyn.fences[dyn.region] = 0;
+		}
+
+		auto& pending = dyn.pending[dyn.region];
+		if (pending.size() == 0) return;
+
+		u8* region = dyn.mapped + (dyn.stride * dyn.region);
+		for (auto seg : pending) {
+			memcpy(region + seg.begin, (u8*)buf->data() + seg.begin, seg.end - seg.begin);
+		}
+
+		size_t flushBegin = pending.front().begin;
+		size_t flushEnd = pending.back().end;
+		glCall(glFlushMappedNamedBufferRange(m_buffers[buf->id()], (dyn.stride * dyn.region) + flushBegin, flushEnd - flushBegin));
+		pending.clear();
+	}
+
+	size_t gl_render_driver::get_buffer_offset(gpu_buffer* buf) {
+		auto d = m_dynamicBuffers.find(buf->id());
+		if (d == m_dynamicBuffers.end()) return 0;
+		return d->second.stride * d->second.region;
+	}
+
 	void gl_render_driver::free_buffer(gpu_buffer* buf) {
 		if (m_buffers.count(buf->id()) == 0) {
 			r2Warn("Buffer %d was never synced, yet render_driver::free_buffer was called on it. Ignoring.", buf->id());
 			return;
 		}
 
+		auto d = m_dynamicBuffers.find(buf->id());
+		if (d != m_dynamicBuffers.end()) {
+			for (u8 r = 0;r < GL_DYNAMIC_BUFFER_REGIONS;r++) {
+				if (d->second.fences[r]) glCall(glDeleteSync(d->second.fences[r]));
+			}
+			glCall(glUnmapNamedBuffer(m_buffers[buf->id()]));
+			m_dynamicBuffers.erase(d);
+		}
+
 		glCall(glDeleteBuffers(1, &m_buffers[buf->id()]));
 		m_buffers.erase(buf->id());
 	}
 
 	void gl_render_driver::sync_texture(texture_buffer* buf) {
 		// Don't (maybe) generate the buffer until there's something in it
-		if (!buf->has_updates() && !buf->has_mode_updates()) return;
-		auto updates = buf->updates();
+		if (!buf->has_dirty_rects() && !buf->has_mode_updates() && !buf->storage_changed()) return;
+		if (buf->width() == 0 || buf->height() == 0) return;
+
+		auto existing = m_textures.find(buf->id());
+		if (existing != m_textures.end() && buf->storage_changed()) {
+			// storage is immutable, a new size or format needs a new texture
+			glCall(glDeleteTextures(1, &existing->second));
+			m_textures.erase(existing);
+			existing = m_textures.end();
+		}
 
-		if (m_textures.count(buf->id()) == 0) {
-			GLuint newTex = 0;
-			glCall(glGenTextures(1, &newTex));
-			glCall(glBindTexture(GL_TEXTURE_2D, newTex));
-			if (buf->has_mode_updates()) {
-				if (buf->min_filter_updated()) {
-					glCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, texture_min_filters[buf->min_filter()]));
-				}
-				if (buf->mag_filter_updated()) {
-					glCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, texture_mag_filters[buf->mag_filter()]));
-				}
-				if (buf->wrap_x_updated()) {
-					glCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, texture_wrap_modes[buf->wrap_x()]));
-				}
-				if (buf->wrap_y_updated()) {
-					glCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, texture_wrap_modes[buf->wrap_y()]));
-				}
-			}
-			auto clientFmt = clientTextureFormat(buf->channels(), buf->type());
-			auto type = texture_types[buf->type()];
-			auto driverFmt = internalTextureFormat(buf->channels(), buf->type());
-			glCall(glTexImage2D(GL_TEXTURE_2D, 0, driverFmt, buf->width(), buf->height(), 0, clientFmt, type, buf->data()));
-			// (GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *pixels);
-			glCall(glBindTexture(GL_TEXTURE_2D, 0));
-			m_textures[buf->id()] = newTex;
-			buf->clear_updates();
-			return;
+		GLuint tex = 0;
+		bool isNew = existing == m_textures.end();
+		if (isNew) {
+			glCall(glCreateTextures(GL_TEXTURE_2D, 1, &tex));
+			glCall(glTextureStorage2D(tex, buf->mip_levels(), sizedTextureFormat(buf->channels(), buf->type()), buf->width(), buf->height()));
+			m_textures[buf->id()] = tex;
+			buf->clear_storage_changed();
+
+			// new storage starts out undefined, whatever caused it to be recreated
+			buf->mark_dirty(0, 0, buf->width(), buf->height());
+		} else tex = existing->second;
+
+		if (isNew || buf->min_filter_updated()) {
+			glCall(glTextureParameteri(tex, GL_TEXTURE_MIN_FILTER, texture_min_filters[buf->min_filter()]));
+		}
+		if (isNew || buf->mag_filter_updated()) {
+			glCall(glTextureParameteri(tex, GL_TEXTURE_MAG_FILTER, texture_mag_filters[buf->mag_filter()]));
+		}
+		if (isNew || buf->wrap_x_updated()) {
+			glCall(glTextureParameteri(tex, GL_TEXTURE_WRAP_S, texture_wrap_modes[buf->wrap_x()]));
+		}
+		if (isNew || buf->wrap_y_updated()) {
+			glCall(glTextureParameteri(tex, GL_TEXTURE_WRAP_T, texture_wrap_modes[buf->wrap_y()]));
 		}
+		buf->clear_mode_updates();
 
-		// The internet said this was better than updating specific parts of the buffer... we'll see
-		glCall(glBindTexture(GL_TEXTURE_2D, m_textures[buf->id()]));
-		if (buf->has_mode_updates()) {
-			if (buf->min_filter_updated()) {
-				glCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, texture_min_filters[buf->min_filter()]));
-			}
-			if (buf->mag_filter_updated()) {
-				glCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, texture_mag_filters[buf->mag_filter()]));
-			}
-			if (buf->wrap_x_updated()) {
-				glCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, texture_wrap_modes[buf->wrap_x()]));
+		if (buf->has_dirty_rects()) {
+			auto clientFmt = clientTextureFormat(buf->channels(), buf->type());
+			auto type = texture_types[buf->type()];
+			size_t pixelSize = size_t(buf->channels()) * buf->bytes_per_channel();
+
+			// only the changed rectangles are uploaded, rows are read straight out of the full image
+			glCall(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+			glCall(glPixelStorei(GL_UNPACK_ROW_LENGTH, buf->width()));
+			for (const auto& rect : buf->dirty_rects()) {
+				const u8* pixels = (const u8*)buf->data() + ((size_t(rect.y) * buf->width()) + rect.x) * pixelSize;
+				glCall(glTextureSubImage2D(tex, 0, rect.x, rect.y, rect.width, rect.height, clientFmt, type, pixels));
 			}
-			if (buf->wrap_y_updated()) {
-				glCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, texture_wrap_modes[buf->wrap_y()]));
+			glCall(glPixelStorei(GL_UNPACK_ROW_LENGTH, 0));
+			glCall(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+
+			if (buf->generates_mipmaps()) {
+				glCall(glGenerateTextureMipmap(tex));
 			}
-			buf->clear_mode_updates();
-			if (!buf->has_updates()) return;
 		}
 
-		auto clientFmt = clientTextureFormat(buf->channels(), buf->type());
-		auto type = texture_types[buf->type()];
-		auto driverFmt = internalTextureFormat(buf->channels(), buf->type());
-		glCall(glTexImage2D(GL_TEXTURE_2D, 0, driverFmt, buf->width(), buf->height(), 0, clientFmt, type, buf->data()));
-		glCall(glBindTexture(GL_TEXTURE_2D, 0));
+		buf->clear_dirty_rects();
 		buf->clear_updates();
 	}
 
@@ -431,8 +572,8 @@ namespace r2 {
 
 	void gl_render_driver::sync_render_target(render_buffer* buf) {
 		size_t attachment_count = buf->attachment_count();
-		if (attachment_count == 0) {
-			r2Error("Render buffer %d has no attachments, yet render_driver::sync_render_target was called on it. Ignoring.", buf->id());
+		if (attachment_count == 0 && buf->depth_mode() == rbdm_no_depth) {
+			r2Error("Render buffer %d has no attachments or depth buffer, yet render_driver::sync_render_target was called on it. Ignoring.", buf->id());
 			return;
 		}
 
@@ -444,23 +585,32 @@ namespace r2 {
 
 			if (buf->depth_mode() != rbdm_no_depth) {
 				GLenum mode = render_buffer_depth_modes[buf->depth_mode()];
-				texture_buffer* first_attachment = buf->attachment(0);
+				vec2i size = buf->dimensions();
 				glCall(glGenRenderbuffers(1, &depthbuffer));
 				glCall(glBindRenderbuffer(GL_RENDERBUFFER, depthbuffer));
-				glCall(glRenderbufferStorage(GL_RENDERBUFFER, mode, first_attachment->width(), first_attachment->height()));
+				glCall(glRenderbufferStorage(GL_RENDERBUFFER, mode, size.x, size.y));
 				glCall(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthbuffer));
 			}
 
 			mvector<GLenum> drawBuffers;
+			mvector<GLuint>& attached = m_targetTextures[buf->id()];
+			attached.clear();
 			for (size_t i = 0;i < attachment_count;i++) {
 				texture_buffer* tex = buf->attachment(i);
 				sync_texture(tex);
 				GLuint textureId = m_textures[tex->id()];
 				glCall(glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, textureId, 0));
 				drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + i);
+				attached.push_back(textureId);
 			}
 
-			glCall(glNamedFramebufferDrawBuffers(framebuffer, drawBuffers.size(), &drawBuffers[0]));
+			if (drawBuffers.size() > 0) {
+				glCall(glNamedFramebufferDrawBuffers(framebuffer, drawBuffers.size(), &drawBuffers[0]));
+			} else {
+				// depth only
+				glCall(glNamedFramebufferDrawBuffer(framebuffer, GL_NONE));
+				glCall(glNamedFramebufferReadBuffer(framebuffer, GL_NONE));
+			}
 
 			GLenum status = 0;
 			glCall(status = glCheckFramebufferStatus(GL_FRAMEBUFFER));
@@ -481,21 +631,38 @@ namespace r2 {
 			return;
 		}
 
-		if (buf->depth_mode_changed() || buf->has_size_updates()) {
+		// Attachments get new texture storage when they're resized or their mip count changes, and the
+		// scene may have synced them before the target. Either way the new textures must be attached again
+		mvector<GLuint>& attached = m_targetTextures[buf->id()];
+		bool reattach = false;
+		for (size_t i = 0;i < attachment_count;i++) {
+			texture_buffer* tex = buf->attachment(i);
+			sync_texture(tex);
+			if (m_textures[tex->id()] != attached[i]) reattach = true;
+		}
+
+		if (buf->depth_mode_changed() || buf->has_size_updates() || reattach) {
 			pair<GLuint, GLuint>& fb = m_targets[buf->id()];
 			glCall(glBindFramebuffer(GL_FRAMEBUFFER, fb.first));
 
-			if (fb.second != 0) {
+			if (fb.second != 0 && (buf->depth_mode_changed() || buf->has_size_updates())) {
 				GLenum mode = render_buffer_depth_modes[buf->depth_mode()];
-				texture_buffer* first_attachment = buf->attachment(0);
+				vec2i size = buf->dimensions();
 				glCall(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0));
 				glCall(glDeleteRenderbuffers(1, &fb.second));
 				glCall(glGenRenderbuffers(1, &fb.second));
 				glCall(glBindRenderbuffer(GL_RENDERBUFFER, fb.second));
-				glCall(glRenderbufferStorage(GL_RENDERBUFFER, mode, first_attachment->width(), first_attachment->height()));
+				glCall(glRenderbufferStorage(GL_RENDERBUFFER, mode, size.x, size.y));
 				glCall(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, fb.second));
 			}
 
+			for (size_t i = 0;i < attachment_count;i++) {
+				GLuint textureId = m_textures[buf->attachment(i)->id()];
+				if (textureId == attached[i]) continue;
+				glCall(glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, textureId, 0));
+				attached[i] = textureId;
+			}
+
 			glCall(glBindRenderbuffer(GL_RENDERBUFFER, 0));
 			glCall(glBindFramebuffer(GL_FRAMEBUFFER, 0));
 
@@ -515,6 +682,16 @@ namespace r2 {
 		glCall(glDeleteRenderbuffers(1, &fb.second));
 		glCall(glDeleteFramebuffers(1, &fb.first));
 		m_targets.erase(buf->id());
+		m_targetTextures.erase(buf->id());
+
+		auto in_flight = m_readbacks.find(buf->id());
+		if (in_flight != m_readbacks.end()) {
+			for (auto& transfer : in_flight->second) {
+				glCall(glDeleteSync(transfer.fence));
+				m_readbackBuffers.push_back(std::pair<GLuint, size_t>(transfer.pbo, transfer.size));
+			}
+			m_readbacks.erase(in_flight);
+		}
 	}
 
 	void gl_render_driver::bind_render_target(render_buffer* buf) {
@@ -554,20 +731,111 @@ namespace r2 {
 		bind_render_target(currentTarget);
 	}
 	f32 gl_render_driver::fetch_render_target_depth(render_buffer* buf, u32 x, u32 y) {
-		if (buf->attachment_count() == 0) return 0.0f;
+		if (buf->depth_mode() == rbdm_no_depth) return 0.0f;
 
-		texture_buffer* tex = buf->attachment(0);
+		u32 height = buf->dimensions().y;
 		render_buffer* currentTarget = m_target;
 		bind_render_target(buf);
 
 		f32 depth = 0.0f;
-		glCall(glReadPixels(x, tex->height() - y, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &depth));
+		glCall(glReadPixels(x, height - y, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &depth));
 
 		bind_render_target(currentTarget);
 
 		return depth;
 	}
 
+	void gl_render_driver::process_readbacks(render_buffer* buf) {
+		auto in_flight = m_readbacks.find(buf->id());
+		if (in_flight != m_readbacks.end()) {
+			auto& transfers = in_flight->second;
+			while (transfers.size() > 0) {
+				// transfers complete in order, stop at the first one the GPU hasn't finished
+				readback_transfer& transfer = transfers.front();
+				GLenum result = GL_TIMEOUT_EXPIRED;
+				glCall(result = glClientWaitSync(transfer.fence, 0, 0));
+				if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) break;
+
+				finish_readback(buf, transfer);
+				transfers.pop_front();
+			}
+		}
+
+		auto& pending = buf->pending_readbacks();
+		if (pending.size() == 0 || m_targets.count(buf->id()) == 0) return;
+
+		// every request made this frame is read into one buffer
+		readback_transfer transfer;
+		transfer.size = 0;
+		for (auto& r : pending) {
+			readback_slice slice;
+			slice.id = r.id;
+			slice.offset = transfer.size;
+			slice.rowSize = r.width * r.pixel_size;
+			slice.rows = r.height;
+			transfer.slices.push_back(slice);
+			transfer.size += slice.rowSize * slice.rows;
+		}
+
+		transfer.pbo = 0;
+		for (auto it = m_readbackBuffers.begin();it != m_readbackBuffers.end();it++) {
+			if (it->second >= transfer.size) {
+				transfer.pbo = it->first;
+				transfer.size = it->second;
+				m_readbackBuffers.erase(it);
+				break;
+			}
+		}
+		if (!transfer.pbo) {
+			glCall(glCreateBuffers(1, &transfer.pbo));
+			glCall(glNamedBufferData(transfer.pbo, transfer.size, nullptr, GL_STREAM_READ));
+		}
+
+		u32 height = buf->dimensions().y;
+		glCall(glBindFramebuffer(GL_READ_FRAMEBUFFER, m_targets[buf->id()].first));
+		glCall(glBindBuffer(GL_PIXEL_PACK_BUFFER, transfer.pbo));
+		glCall(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+		for (size_t i = 0;i < pending.size();i++) {
+			auto& r = pending[i];
+			GLint y = height - (r.y + r.height);
+			if (r.attachment == RENDER_BUFFER_DEPTH_READBACK) {
+				glCall(glReadPixels(r.x, y, r.width, r.height, GL_DEPTH_COMPONENT, GL_FLOAT, (void*)transfer.slices[i].offset));
+			} else {
+				texture_buffer* tex = buf->attachment(r.attachment);
+				glCall(glReadBuffer(GL_COLOR_ATTACHMENT0 + r.attachment));
+				glCall(glReadPixels(r.x, y, r.width, r.height, clientTextureFormat(tex->channels(), tex->type()), texture_types[tex->type()], (void*)transfer.slices[i].offset));
+			}
+		}
+		glCall(glPixelStorei(GL_PACK_ALIGNMENT, 4));
+		glCall(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+		glCall(glBindFramebuffer(GL_READ_FRAMEBUFFER, m_target ? m_targets[m_target->id()].first : 0));
+
+		glCall(transfer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+		m_readbacks[buf->id()].push_back(transfer);
+		pending.clear();
+	}
+
+	void gl_render_driver::finish_readback(render_buffer* buf, readback_transfer& transfer) {
+		glCall(glDeleteSync(transfer.fence));
+
+		const u8* data = nullptr;
+		glCall(data = (const u8*)glMapNamedBufferRange(transfer.pbo, 0, transfer.size, GL_MAP_READ_BIT));
+		if (data) {
+			for (auto& slice : transfer.slices) {
+				// GL returns the bottom row first
+				u8* dest = buf->complete_readback(slice.id, slice.rowSize * slice.rows);
+				for (u32 row = 0;row < slice.rows;row++) {
+					memcpy(dest + (row * slice.rowSize), data + slice.offset + ((slice.rows - row - 1) * slice.rowSize), slice.rowSize);
+				}
+			}
+			glCall(glUnmapNamedBuffer(transfer.pbo));
+		} else {
+			r2Error("Failed to map readback buffer for render buffer %d", buf->id());
+		}
+
+		m_readbackBuffers.push_back(std::pair<GLuint, size_t>(transfer.pbo, transfer.size));
+	}
+
 	GLuint gl_render_driver::get_texture_id(texture_buffer* buf) {
 		if (m_textures.count(buf->id()) == 0) {
 			r2Error("Texture %d was never synced, so it has no GL id.", buf->id());
@@ -583,7 +851,8 @@ namespace r2 {
 		if (blockInfo.loc == GL_INVALID_INDEX) return;
 		auto bufferInfo = uniforms->buffer_info();
 		GLuint buffer = m_buffers[bufferInfo.buffer->id()];
-		glCall(glBindBufferRange(GL_UNIFORM_BUFFER, blockInfo.bindIndex, buffer, bufferInfo.memBegin, bufferInfo.memsize()));
+		size_t offset = get_buffer_offset(bufferInfo.buffer);
+		glCall(glBindBufferRange(GL_UNIFORM_BUFFER, blockInfo.bindIndex, buffer, offset + bufferInfo.memBegin, bufferInfo.memsize()));
 	}
 
 	void gl_render_driver::clear_framebuffer(const vec4f& color, bool clearDepth) {
@@ -672,27 +941,37 @@ namespace r2 {
 		}
 	}
 
+	size_t gl_render_driver::batch_uniform_stride() const {
+		// std140 array elements are padded to 16 bytes
+		size_t uniformSize = static_uniform_formats::node()->size();
+		return uniformSize + ((16 - (uniformSize % 16)) % 16);
+	}
+
+	size_t gl_render_driver::max_batch_size() {
+		if (m_maxBatchSize > 0) return m_maxBatchSize;
+
+		GLint maxBlockSize = 0;
+		glCall(glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxBlockSize));
+		m_maxBatchSize = max(size_t(maxBlockSize) / batch_uniform_stride(), size_t(1));
+		return m_maxBatchSize;
+	}
+
 	size_t gl_render_driver::get_uniform_buffer_block_offset_alignment() const {
 		GLint alignment = 0;
 		glCall(glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment));
 		return alignment;
 	}
 
-	void gl_render_driver::render_node(r2::render_node* node, uniform_block* scene) {
-		if (!node->material_instance()) return;
-		bind_vao(node);
-
+	void gl_render_driver::bind_node_state(r2::render_node* node, uniform_block* scene, bool bindNodeUniforms) {
 		auto material = node->material_instance();
 		auto shader = material->material()->shader();
-		if (!shader) return;
-		shader->activate();
 
 		if (material->material()->format() && material->material()->format()->size() > 0) {
 			auto uniforms = material->uniforms();
 			bind_uniform_block(shader, uniforms);
 		}
 
-		bind_uniform_block(shader, node->uniforms());
+		if (bindNodeUniforms) bind_uniform_block(shader, node->uniforms());
 		bind_uniform_block(shader, scene);
 
 		const mlist<uniform_block*>& userUniforms = node->user_uniforms();
@@ -705,12 +984,32 @@ namespace r2 {
 			auto texture = material->texture(i);
 			shader->texture2D(texture->location, i, texture->textures[texture->currentFrame]);
 		}
+	}
+
+	void gl_render_driver::render_node(r2::render_node* node, uniform_block* scene) {
+		if (!node->material_instance()) return;
+
+		auto material = node->material_instance();
+		auto shader = material->material()->shader();
+		if (!shader) return;
+
+		// shaders that read u_models have no u_model block, the node has to be drawn as a batch of one
+		if (((gl_shader_program*)shader)->supports_batching()) {
+			mvector<r2::render_node*> single(1, node);
+			render_nodes(single, scene, true);
+			return;
+		}
+
+		bind_vao(node);
+		shader->activate();
+
+		bind_node_state(node, scene, true);
 
 		auto vseg = node->vertices();
 		auto vbo = vseg.buffer;
 		auto eseg = node->indices();
 		auto ebo = eseg.buffer;
-		auto iseg = node->instances();
+		auto iseg = node->visible_instances();
 		auto ibo = iseg.buffer;
 
 		GLuint vbo_id = m_buffers[vbo->id()];
@@ -718,27 +1017,28 @@ namespace r2 {
 		GLuint ibo_id = ibo == nullptr ? 0 : m_buffers[ibo->id()];
 		GLenum prim_type = primitive_types[node->primitives];
 
-		glCall(glBindVertexBuffer(0, vbo_id, vseg.memBegin, vbo->format()->size()));
+		glCall(glBindVertexBuffer(0, vbo_id, get_buffer_offset(vbo) + vseg.memBegin, vbo->format()->size()));
 
 		if (ibo) {
-			glCall(glBindVertexBuffer(1, ibo_id, iseg.memBegin, ibo->format()->size()));
+			glCall(glBindVertexBuffer(1, ibo_id, get_buffer_offset(ibo) + iseg.memBegin, ibo->format()->size()));
 		}
 
 		if (ebo) {
 			glCall(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_id));
 
 			size_t index_count = node->index_count(); // eseg.size() = capacity of the buffer
+			size_t index_offset = get_buffer_offset(ebo) + eseg.memBegin;
 			if (ibo) {
-				size_t instance_count = node->instance_count(); //iseg.size() = capacity of the buffer
-				glCall(glDrawElementsInstanced(prim_type, index_count, index_component_types[ebo->type()], (void*)eseg.memBegin, instance_count));
+				size_t instance_count = node->visible_instance_count(); // only the instances that survived culling
+				glCall(glDrawElementsInstanced(prim_type, index_count, index_component_types[ebo->type()], (void*)index_offset, instance_count));
 			} else {
-				glCall(glDrawElements(prim_type, index_count, index_component_types[ebo->type()], (void*)eseg.memBegin));
+				glCall(glDrawElements(prim_type, index_count, index_component_types[ebo->type()], (void*)index_offset));
 			}
 			glCall(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
 		} else {
 			size_t vertex_count = node->vertex_count(); // vseg.size() = capacity of the buffer
 			if (ibo) {
-				size_t instance_count = node->instance_count(); //iseg.size() = capacity of the buffer
+				size_t instance_count = node->visible_instance_count(); // only the instances that survived culling
 				glCall(glDrawArraysInstanced(prim_type, 0, vertex_count, instance_count));
 			} else {
 				glCall(glDrawArrays(prim_type, 0, vertex_count));
@@ -747,4 +1047,188 @@ namespace r2 {
 
 		unbind_vao();
 	}
+
+	struct draw_elements_indirect_command {
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+	struct draw_arrays_indirect_command {
+		GLuint count;
+		GLuint instanceCount;
+		GLuint first;
+		GLuint baseInstance;
+	};
+
+	static bool can_batch_together(r2::render_node* a, r2::render_node* b) {
+		return a->material_instance() == b->material_instance()
+			&& a->vertices().buffer == b->vertices().buffer
+			&& a->indices().buffer == b->indices().buffer
+			&& a->visible_instances().buffer == b->visible_instances().buffer
+			&& a->primitives == b->primitives
+			&& a->user_uniforms().size() == 0
+			&& b->user_uniforms().size() == 0;
+	}
+
+	void gl_render_driver::render_nodes(const mvector<r2::render_node*>& nodes, uniform_block* scene, bool ordered) {
+		mvector<r2::render_node*> sorted;
+		sorted.reserve(nodes.size());
+		for (r2::render_node* node : nodes) {
+			if (node->material_instance() && node->material_instance()->material()->shader()) sorted.push_back(node);
+		}
+
+		// group the nodes so that nodes which can be drawn together are adjacent. Multi-draw commands
+		// are drawn in order, so ordered lists can still batch whatever is adjacent already
+		if (!ordered) std::sort(sorted.begin(), sorted.end(), [](r2::render_node* a, r2::render_node* b) {
+			shader_program* sa = a->material_instance()->material()->shader();
+			shader_program* sb = b->material_instance()->material()->shader();
+			if (sa != sb) return sa < sb;
+			if (a->material_instance() != b->material_instance()) return a->material_instance() < b->material_instance();
+			if (a->vertices().buffer != b->vertices().buffer) return a->vertices().buffer < b->vertices().buffer;
+			if (a->indices().buffer != b->indices().buffer) return a->indices().buffer < b->indices().buffer;
+			if (a->visible_instances().buffer != b->visible_instances().buffer) return a->visible_instances().buffer < b->visible_instances().buffer;
+			return a->primitives < b->primitives;
+		});
+
+		// build every batch's commands and node uniforms up front, so they can be uploaded at once
+		m_batchCommands.clear();
+		m_batchUniforms.clear();
+		mvector<draw_batch> batches;
+
+		for (auto it = sorted.begin();it != sorted.end();) {
+			gl_shader_program* shader = (gl_shader_program*)(*it)->material_instance()->material()->shader();
+
+			if (!shader->supports_batching()) {
+				draw_batch single;
+				single.first = *it;
+				single.count = 0;
+				batches.push_back(single);
+				it++;
+				continue;
+			}
+
+			// shaders that read u_models don't have u_model, so even nodes that can't share a batch are drawn as one
+			size_t maxCount = shader->max_batch_size();
+			size_t count = 1;
+			while (it + count != sorted.end() && count < maxCount && can_batch_together(*it, *(it + count))) count++;
+
+			draw_batch batch;
+			build_batch(it, count, batch);
+			batches.push_back(batch);
+
+			it += count;
+		}
+
+		if (m_batchCommands.size() > 0) {
+			if (m_batchCommands.size() > m_batchCommandCapacity) {
+				m_batchCommandCapacity = m_batchCommands.size() * 2;
+				glCall(glNamedBufferData(m_batchCommandBuffer, m_batchCommandCapacity, nullptr, GL_STREAM_DRAW));
+			}
+			if (m_batchUniforms.size() > m_batchUniformCapacity) {
+				m_batchUniformCapacity = m_batchUniforms.size() * 2;
+				glCall(glNamedBufferData(m_batchUniformBuffer, m_batchUniformCapacity, nullptr, GL_STREAM_DRAW));
+			}
+
+			// orphan last frame's storage so the upload doesn't wait on the GPU
+			glCall(glInvalidateBufferData(m_batchCommandBuffer));
+			glCall(glInvalidateBufferData(m_batchUniformBuffer));
+			glCall(glNamedBufferSubData(m_batchCommandBuffer, 0, m_batchCommands.size(), &m_batchCommands[0]));
+			glCall(glNamedBufferSubData(m_batchUniformBuffer, 0, m_batchUniforms.size(), &m_batchUniforms[0]));
+		}
+
+		for (auto& batch : batches) {
+			if (batch.count == 0) render_node(batch.first, scene);
+			else render_batch(batch, scene);
+		}
+	}
+
+	void gl_render_driver::build_batch(mvector<r2::render_node*>::const_iterator begin, size_t count, draw_batch& batch) {
+		// each batch's node uniforms must start at an offset that can be bound as a uniform block
+		size_t alignment = get_uniform_buffer_block_offset_alignment();
+		size_t uniformOffset = m_batchUniforms.size();
+		if (alignment > 0 && uniformOffset % alignment != 0) uniformOffset += alignment - (uniformOffset % alignment);
+
+		batch.first = *begin;
+		batch.count = count;
+		batch.commandOffset = m_batchCommands.size();
+		batch.uniformOffset = uniformOffset;
+
+		size_t uniformStride = batch_uniform_stride();
+		m_batchUniforms.resize(uniformOffset + (uniformStride * count), 0);
+
+		bool indexed = batch.first->indices().buffer != nullptr;
+		size_t commandSize = indexed ? sizeof(draw_elements_indirect_command) : sizeof(draw_arrays_indirect_command);
+		m_batchCommands.resize(batch.commandOffset + (commandSize * count));
+
+		for (size_t i = 0;i < count;i++) {
+			r2::render_node* node = *(begin + i);
+
+			const ufm_bo_segment& useg = node->uniforms()->buffer_info();
+			memcpy(&m_batchUniforms[uniformOffset + (uniformStride * i)], (u8*)useg.buffer->data() + useg.memBegin, useg.memsize());
+
+			// vertex, index and instance buffers are bound at the start of their storage,
+			// so each node's segment is selected with the command's base offsets
+			auto vseg = node->vertices();
+			auto iseg = node->visible_instances();
+			GLuint instanceCount = iseg.buffer ? (GLuint)node->visible_instance_count() : 1;
+			GLuint baseInstance = iseg.buffer ? (GLuint)iseg.begin : 0;
+
+			if (indexed) {
+				auto eseg = node->indices();
+				draw_elements_indirect_command cmd;
+				cmd.count = (GLuint)node->index_count();
+				cmd.instanceCount = instanceCount;
+				cmd.firstIndex = (GLuint)((get_buffer_offset(eseg.buffer) + eseg.memBegin) / eseg.buffer->type());
+				cmd.baseVertex = (GLint)vseg.begin;
+				cmd.baseInstance = baseInstance;
+				memcpy(&m_batchCommands[batch.commandOffset + (commandSize * i)], &cmd, commandSize);
+			} else {
+				draw_arrays_indirect_command cmd;
+				cmd.count = (GLuint)node->vertex_count();
+				cmd.instanceCount = instanceCount;
+				cmd.first = (GLuint)vseg.begin;
+				cmd.baseInstance = baseInstance;
+				memcpy(&m_batchCommands[batch.commandOffset + (commandSize * i)], &cmd, commandSize);
+			}
+		}
+	}
+
+	void gl_render_driver::render_batch(const draw_batch& batch, uniform_block* scene) {
+		r2::render_node* node = batch.first;
+		gl_shader_program* shader = (gl_shader_program*)node->material_instance()->material()->shader();
+
+		bind_vao(node);
+		shader->activate();
+
+		// node uniforms come from the batch's uniform array instead of each node's block
+		bind_node_state(node, scene, false);
+		auto blockInfo = shader->block_info(GL_BATCH_UNIFORM_BLOCK_NAME);
+		size_t uniformStride = batch_uniform_stride();
+		glCall(glBindBufferRange(GL_UNIFORM_BUFFER, blockInfo.bindIndex, m_batchUniformBuffer, batch.uniformOffset, uniformStride * batch.count));
+
+		auto vbo = node->vertices().buffer;
+		auto ebo = node->indices().buffer;
+		auto ibo = node->visible_instances().buffer;
+		GLenum prim_type = primitive_types[node->primitives];
+
+		glCall(glBindVertexBuffer(0, m_buffers[vbo->id()], get_buffer_offset(vbo), vbo->format()->size()));
+		if (ibo) {
+			glCall(glBindVertexBuffer(1, m_buffers[ibo->id()], get_buffer_offset(ibo), ibo->format()->size()));
+		}
+
+		glCall(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_batchCommandBuffer));
+		if (ebo) {
+			glCall(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_buffers[ebo->id()]));
+			glCall(glMultiDrawElementsIndirect(prim_type, index_component_types[ebo->type()], (void*)batch.commandOffset, batch.count, 0));
+			glCall(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+		} else {
+			glCall(glMultiDrawArraysIndirect(prim_type, (void*)batch.commandOffset, batch.count, 0));
+		}
+		glCall(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
+
+		unbind_vao();
+	}
 };
\ No newline at end of file
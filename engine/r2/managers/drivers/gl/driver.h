@@ -1,10 +1,21 @@
 #pragma once
 #include <r2/managers/renderman.h>
 #include <r2/managers/memman.h>
+#include <r2/utilities/buffer.h>
+#include <r2/utilities/texture.h>
 #include <GL/glcorearb.h>
 
 #define glCall(...) { glGetError(); __VA_ARGS__; printGlError(#__VA_ARGS__); }
 
+// Number of copies of each dynamic buffer's storage that the driver cycles through
+#define GL_DYNAMIC_BUFFER_REGIONS 3
+
+// Shaders that declare a uniform block with this name have all of their nodes drawn
+// in batches, instead of with u_model. The block must contain an array of
+// ModelUniforms models[MAX_BATCH_SIZE], indexed by the draw ID of the multi-draw
+// command (gl_DrawIDARB, from GL_ARB_shader_draw_parameters)
+#define GL_BATCH_UNIFORM_BLOCK_NAME "u_models"
+
 namespace r2 {
 	class gl_shader_program : public shader_program {
 		public:
@@ -75,9 +86,15 @@ namespace r2 {
 			friend class gl_render_driver;
 			GLuint m_program;
 
-			struct uniform_block_info { u32 loc, bindIndex; };
+			// 'size' is the block's data size in this program
+			struct uniform_block_info { u32 loc, bindIndex, size; };
 			munordered_map<mstring, uniform_block_info> m_uniformBlocks;
 			const uniform_block_info& block_info(uniform_block* uniforms);
+			const uniform_block_info& block_info(const mstring& name);
+			uniform_block_info bind_block(GLuint program, const mstring& name);
+			bool supports_batching();
+			// Nodes that fit in the program's u_models block
+			size_t max_batch_size();
 	};
 
     class gl_render_driver : public render_driver {
@@ -100,7 +117,9 @@ namespace r2 {
 			virtual void bind_render_target(render_buffer* buf);
 			virtual void fetch_render_target_pixel(render_buffer* buf, u32 x, u32 y, size_t attachmentIdx, void* dest, size_t pixelSize);
 			virtual f32 fetch_render_target_depth(render_buffer* buf, u32 x, u32 y);
+			virtual void process_readbacks(render_buffer* buf);
 			GLuint get_texture_id(texture_buffer* buf);
+			size_t get_buffer_offset(gpu_buffer* buf);
 			virtual void bind_uniform_block(shader_program* shader, uniform_block* uniforms);
 			virtual void clear_framebuffer(const vec4f& color, bool clearDepth);
 			virtual void set_viewport(const vec2i& position, const vec2i& dimensions);
@@ -109,15 +128,85 @@ namespace r2 {
 			virtual void serialize_uniform_value(const void* input, void* output, uniform_format* fmt, u16 idx, uniform_attribute_type type) const;
 			virtual size_t get_uniform_buffer_block_offset_alignment() const;
 			virtual void render_node(r2::render_node* node, uniform_block* scene);
+			virtual void render_nodes(const mvector<r2::render_node*>& nodes, uniform_block* scene, bool ordered = false);
+
+			// std140 size of one element of the u_models array, and how many fit in the largest uniform block
+			// the driver supports. The latter is MAX_BATCH_SIZE in shaders
+			size_t batch_uniform_stride() const;
+			size_t max_batch_size();
 
 
         protected:
+			// Dynamic buffers are allocated with GL_DYNAMIC_BUFFER_REGIONS copies of their
+			// storage, persistently mapped. Each sync moves to the next region (waiting on
+			// the fence placed when that region was last used) and copies only the ranges
+			// that changed since that region was last written
+			struct dynamic_buffer {
+				u8* mapped;
+				size_t stride;
+				u8 region;
+				GLsync fences[GL_DYNAMIC_BUFFER_REGIONS];
+				mlist<gpu_buffer::changed_buffer_segment> pending[GL_DYNAMIC_BUFFER_REGIONS];
+			};
+
+			void create_dynamic_buffer(gpu_buffer* buf);
+			void sync_dynamic_buffer(gpu_buffer* buf);
+
+			// A group of nodes that share buffers, shader and material, which can be
+			// submitted with a single glMultiDraw*Indirect call. A count of 0 means
+			// 'first' uses a shader that can't be batched, and is drawn with render_node
+			struct draw_batch {
+				r2::render_node* first;
+				size_t count;
+				size_t commandOffset;
+				size_t uniformOffset;
+			};
+
+			void bind_node_state(r2::render_node* node, uniform_block* scene, bool bindNodeUniforms);
+			void build_batch(mvector<r2::render_node*>::const_iterator begin, size_t count, draw_batch& batch);
+			void render_batch(const draw_batch& batch, uniform_block* scene);
+
+			// one pixel pack buffer per frame's batch of readback requests
+			struct readback_slice {
+				readback_id id;
+				size_t offset;
+				size_t rowSize;
+				u32 rows;
+			};
+			struct readback_transfer {
+				GLuint pbo;
+				size_t size;
+				GLsync fence;
+				mvector<readback_slice> slices;
+			};
+			void finish_readback(render_buffer* buf, readback_transfer& transfer);
+
+			// one vertex array per vertex/instance format pair, shared by every node using it
+			struct vertex_array {
+				GLuint vao;
+				u32 refs;
+			};
+
             render_man* m_mgr;
 			munordered_map<size_t, GLuint> m_buffers;
+			munordered_map<size_t, dynamic_buffer> m_dynamicBuffers;
 			munordered_map<size_t, GLuint> m_textures;
 			munordered_map<size_t, std::pair<GLuint, GLuint>> m_targets;
-			munordered_map<mstring, GLuint> m_vaos;
+			// textures attached to each target's color attachments, compared against m_textures to catch recreated storage
+			munordered_map<size_t, mvector<GLuint>> m_targetTextures;
+			munordered_map<u32, vertex_array> m_vaos;
 			render_buffer* m_target;
+			munordered_map<size_t, mlist<readback_transfer>> m_readbacks;
+			// idle pixel pack buffers and their sizes
+			mvector<std::pair<GLuint, size_t>> m_readbackBuffers;
+
+			mvector<u8> m_batchCommands;
+			mvector<u8> m_batchUniforms;
+			GLuint m_batchCommandBuffer;
+			GLuint m_batchUniformBuffer;
+			size_t m_batchCommandCapacity;
+			size_t m_batchUniformCapacity;
+			size_t m_maxBatchSize;
 
 			GLuint m_fsqVao;
 			GLuint m_fsqVbo;
@@ -50,6 +50,24 @@ namespace r2 {
 		return shaderProgram;
 	}
 
+	void insert_default_code(mstring& src, const mstring& default_code) {
+		size_t vd = src.find("#version");
+		if (vd == mstring::npos) {
+			src = default_code + src;
+			return;
+		}
+
+		// #extension directives have to come before any declarations
+		size_t insert_at = src.find_first_of('\n', vd) + 1;
+		size_t ext = src.find("#extension", insert_at);
+		while (ext != mstring::npos && src.find_first_not_of(" \t\r\n", insert_at) == ext) {
+			insert_at = src.find_first_of('\n', ext) + 1;
+			ext = src.find("#extension", insert_at);
+		}
+
+		src.insert(insert_at, default_code);
+	}
+
 	gl_shader_program::gl_shader_program() {
 		m_program = 0;
 	}
@@ -70,25 +88,16 @@ namespace r2 {
 		default_code += format_string("#define LIGHT_TYPE_SPOT %d\n", lt_spot);
 		default_code += format_string("#define LIGHT_TYPE_DIRECTIONAL %d\n", lt_directional);
 		default_code += "struct LightSource { int type; vec3 position; vec3 direction; vec3 color; float cosConeInnerAngle; float cosConeOuterAngle; float constantAtt; float linearAtt; float quadraticAtt; };\n";
+		default_code += format_string("#define MAX_BATCH_SIZE %llu\n", ((gl_render_driver*)r2engine::renderer()->driver())->max_batch_size());
+		default_code += "struct ModelUniforms { mat4 transform; mat4 normal_transform; };\n";
 
 		u32 vIdx = 0;
 		u32 fIdx = contents.find("// fragment");
 		mstring vert = contents.substr(0, fIdx);
 		mstring frag = contents.substr(fIdx);
 
-		size_t v_vd = vert.find("#version");
-		if (v_vd == mstring::npos) vert = default_code + vert;
-		else {
-			size_t insert_at = vert.find_first_of('\n', v_vd) + 1;
-			vert.insert(insert_at, default_code);
-		}
-		
-		size_t f_vd = frag.find("#version");
-		if (f_vd == mstring::npos) frag = default_code + frag;
-		else {
-			size_t insert_at = frag.find_first_of('\n', f_vd) + 1;
-			frag.insert(insert_at, default_code);
-		}
+		insert_default_code(vert, default_code);
+		insert_default_code(frag, default_code);
 
 
 		GLuint prog = create_program(vert.c_str(), frag.c_str());
@@ -97,16 +106,9 @@ namespace r2 {
 			glDeleteProgram(m_program);
 
 			for (auto it = m_uniformBlocks.begin();it != m_uniformBlocks.end();it++) {
-				u32 idx = 0;
-				glCall(idx = glGetUniformBlockIndex(prog, it->first.c_str()));
-				if (idx == GL_INVALID_INDEX) {
-					// r2Error("Failed to find uniform block \"%s\" in shader.", name.c_str());
-					m_uniformBlocks[it->first] = { GL_INVALID_INDEX, GL_INVALID_INDEX };
-				} else {
-					u32 bindingIdx = m_uniformBlocks.size();
-					glCall(glUniformBlockBinding(prog, idx, bindingIdx));
-					m_uniformBlocks[it->first] = { idx, bindingIdx };
-					r2Log("%s: Block binding for '%s' updated to (%d, %d)", m_name.c_str(), it->first.c_str(), idx, bindingIdx);
+				it->second = bind_block(prog, it->first);
+				if (it->second.loc != GL_INVALID_INDEX) {
+					r2Log("%s: Block binding for '%s' updated to (%d, %d)", m_name.c_str(), it->first.c_str(), it->second.loc, it->second.bindIndex);
 				}
 			}
 		}
@@ -131,21 +133,44 @@ namespace r2 {
 	}
 
 	const gl_shader_program::uniform_block_info& gl_shader_program::block_info(uniform_block* uniforms) {
-		const mstring& name = uniforms->name();
-		if (m_uniformBlocks.count(name) == 0) {
-			u32 idx = 0;
-			glCall(idx = glGetUniformBlockIndex(m_program, name.c_str()));
-			if (idx == GL_INVALID_INDEX) {
-				// r2Error("Failed to find uniform block \"%s\" in shader.", name.c_str());
-				m_uniformBlocks[name] = { GL_INVALID_INDEX, GL_INVALID_INDEX };
-			} else {
-				u32 bindingIdx = m_uniformBlocks.size();
-				glCall(glUniformBlockBinding(m_program, idx, bindingIdx));
-				m_uniformBlocks[name] = { idx, bindingIdx };
-			}
+		return block_info(uniforms->name());
+	}
+
+	const gl_shader_program::uniform_block_info& gl_shader_program::block_info(const mstring& name) {
+		auto existing = m_uniformBlocks.find(name);
+		if (existing != m_uniformBlocks.end()) return existing->second;
+
+		uniform_block_info info = bind_block(m_program, name);
+		return m_uniformBlocks[name] = info;
+	}
+
+	gl_shader_program::uniform_block_info gl_shader_program::bind_block(GLuint program, const mstring& name) {
+		u32 idx = 0;
+		glCall(idx = glGetUniformBlockIndex(program, name.c_str()));
+		if (idx == GL_INVALID_INDEX) {
+			// r2Error("Failed to find uniform block \"%s\" in shader.", name.c_str());
+			return { GL_INVALID_INDEX, GL_INVALID_INDEX, 0 };
 		}
 
-		return m_uniformBlocks[name];
+		// existing blocks keep their binding index when the program is reloaded
+		auto existing = m_uniformBlocks.find(name);
+		u32 bindingIdx = existing != m_uniformBlocks.end() && existing->second.bindIndex != GL_INVALID_INDEX ? existing->second.bindIndex : (u32)m_uniformBlocks.size();
+		GLint size = 0;
+		glCall(glUniformBlockBinding(program, idx, bindingIdx));
+		glCall(glGetActiveUniformBlockiv(program, idx, GL_UNIFORM_BLOCK_DATA_SIZE, &size));
+		return { idx, bindingIdx, (u32)size };
+	}
+
+	bool gl_shader_program::supports_batching() {
+		return block_info(GL_BATCH_UNIFORM_BLOCK_NAME).loc != GL_INVALID_INDEX;
+	}
+
+	size_t gl_shader_program::max_batch_size() {
+		const uniform_block_info& info = block_info(GL_BATCH_UNIFORM_BLOCK_NAME);
+		if (info.loc == GL_INVALID_INDEX) return 1;
+
+		size_t stride = ((gl_render_driver*)r2engine::renderer()->driver())->batch_uniform_stride();
+		return max(size_t(info.size) / stride, size_t(1));
 	}
 
 	i32 gl_shader_program::get_uniform_location(const mstring& name) {
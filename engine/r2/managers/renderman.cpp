@@ -24,6 +24,10 @@ namespace r2 {
 		memcpy(output, input, get_uniform_attribute_size(fmt, idx, type));
 	}
 
+	void render_driver::render_nodes(const mvector<r2::render_node*>& nodes, uniform_block* scene, bool ordered) {
+		for (r2::render_node* node : nodes) render_node(node, scene);
+	}
+
 	render_man* render_driver::manager() const {
 		return m_mgr;
 	}
@@ -106,6 +106,8 @@ namespace r2 {
 			virtual void bind_render_target(render_buffer* buf) = 0;
 			virtual void fetch_render_target_pixel(render_buffer* buf, u32 x, u32 y, size_t attachmentIdx, void* dest, size_t pixelSize) = 0;
 			virtual f32 fetch_render_target_depth(render_buffer* buf, u32 x, u32 y) = 0;
+			// Starts transfers for the target's pending readback requests and completes finished ones
+			virtual void process_readbacks(render_buffer* buf) = 0;
 			virtual void bind_uniform_block(shader_program* shader, uniform_block* uniforms) = 0;
 			virtual void clear_framebuffer(const vec4f& color, bool clearDepth) = 0;
 			virtual void set_viewport(const vec2i& position, const vec2i& dimensions) = 0;
@@ -121,6 +123,10 @@ namespace r2 {
 
 			virtual void render_node(r2::render_node* node, uniform_block* scene) = 0;
 
+			// Renders a list of nodes. Drivers may group compatible nodes into
+			// fewer draw calls. Unless 'ordered' is set, the order they're drawn in is not guaranteed
+			virtual void render_nodes(const mvector<r2::render_node*>& nodes, uniform_block* scene, bool ordered = false);
+
 
         protected:
             render_man* m_mgr;
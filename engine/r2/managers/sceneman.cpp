@@ -7,6 +7,10 @@
 #include <r2/systems/transform_sys.h>
 #include <r2/systems/cascade_functions.h>
 
+#include <marl/waitgroup.h>
+
+#include <algorithm>
+
 namespace r2 {
 	// render node instance
 	instanceId render_node_instance::nextInstanceId = 1;
@@ -65,26 +69,53 @@ namespace r2 {
 
 
     // render node
+	static u8 position_components(vertex_format* fmt) {
+		// the first vertex attribute is treated as the position
+		const mvector<vertex_attribute_type>& attrs = fmt->attributes();
+		if (attrs.size() == 0) return 0;
+		switch (attrs[0]) {
+			case vat_vec2f: return 2;
+			case vat_vec3f: return 3;
+			case vat_vec4f: return 4;
+			default: return 0;
+		}
+	}
+
     render_node::render_node(scene* s, const vtx_bo_segment& vertData, idx_bo_segment* indexData, ins_bo_segment* instanceData) {
 		m_scene = s;
         m_vertexData = vertData;
 		m_material = nullptr;
 		m_nextInstanceIdx = 0;
 		m_uniforms = nullptr;
+		m_vertexArray = 0;
 
 		m_vertexCount = vertData.size();
 		m_indexCount = indexData ? indexData->size() : 0;
 
         if(indexData) m_indexData = idx_bo_segment(*indexData);
-        if(instanceData) m_instanceData = ins_bo_segment(*instanceData);
+        if(instanceData) {
+			m_instanceData = ins_bo_segment(*instanceData);
+			m_instanceBounds.resize(m_instanceData.size());
+			m_instanceVisibility.resize(m_instanceData.size());
+		}
+
+		m_boundsDirty = true;
+		m_instanceBoundsDirty = true;
+		m_visibleInstanceCount = 0;
+		m_instancesCulled = false;
+		m_visible = true;
 
 		destroy_when_unused = false;
 		has_transparency = false;
+		enable_culling = true;
 		primitives = pt_triangles;
     }
 
     render_node::~render_node() {
-		// TODO: release gpu buffer segments
+		if (m_vertexData.buffer) m_vertexData.buffer->release(m_vertexData);
+		if (m_indexData.buffer) m_indexData.buffer->release(m_indexData);
+		if (m_instanceData.buffer) m_instanceData.buffer->release(m_instanceData);
+		detach_script_views();
     }
 
 	const vtx_bo_segment& render_node::vertices() const {
@@ -120,6 +151,7 @@ namespace r2 {
 
 		render_node_instance out(this);
 		m_instanceIndices[out.id()] = m_nextInstanceIdx++;
+		m_instanceBoundsDirty = true;
 		return out;
 	}
 
@@ -139,6 +171,10 @@ namespace r2 {
 
 		m_nextInstanceIdx--;
 		m_instanceIndices.erase(i);
+		m_instanceBoundsDirty = true;
+
+		// views of instance data now point at different instances
+		detach_script_views();
 
 		if (m_nextInstanceIdx == 0 && destroy_when_unused) {
 			m_scene->remove_node(this);
@@ -164,6 +200,8 @@ namespace r2 {
 		size_t memEnd = memBegin + sizeof(mat4f);
 		ins_bo_segment seg = m_instanceData.sub(idx, idx + 1, memBegin, memEnd);
 		m_instanceData.buffer->update(seg, &transform[0].x);
+
+		if (!m_instanceBoundsDirty) m_instanceBounds[idx] = m_bounds.transformed_sphere(transform);
 	}
 
 	void render_node::update_instance_raw(instanceId id, const void* data) {
@@ -179,6 +217,11 @@ namespace r2 {
 		size_t memEnd = memBegin + instanceSize;
 		ins_bo_segment seg = m_instanceData.sub(idx, idx + 1, memBegin, memEnd);
 		m_instanceData.buffer->update(seg, data);
+
+		instance_format* fmt = m_instanceData.buffer->format();
+		if (fmt->hasModelMatrix() && !m_instanceBoundsDirty) {
+			m_instanceBounds[idx] = m_bounds.transformed_sphere(*(const mat4f*)((const u8*)data + fmt->modelMatrixOffset()));
+		}
 	}
 
 	void* render_node::instance_data(instanceId id) {
@@ -202,6 +245,7 @@ namespace r2 {
 		size_t size = m_vertexData.buffer->format()->size();
 		m_vertexData.buffer->update(m_vertexData.sub(0, count, 0, count * size), data);
 		m_vertexCount = count;
+		update_bounds();
 	}
 
 	void* render_node::vertex_data() {
@@ -227,6 +271,11 @@ namespace r2 {
 		return m_instanceIndices.find(id) != m_instanceIndices.end();
 	}
 
+	size_t render_node::instance_index(instanceId id) const {
+		auto i = m_instanceIndices.find(id);
+		return i == m_instanceIndices.end() ? SIZE_MAX : i->second;
+	}
+
 	void render_node::set_vertex_count(size_t count) {
 		if (count > max_vertex_count()) {
 			r2Error("Can't set node vertex count to a value higher than the node's vertex capacity.");
@@ -234,6 +283,7 @@ namespace r2 {
 		}
 
 		m_vertexCount = count;
+		m_boundsDirty = true;
 	}
 
 	void render_node::set_index_count(size_t count) {
@@ -245,6 +295,136 @@ namespace r2 {
 		m_indexCount = count;
 	}
 
+	void render_node::vertices_updated(size_t first, size_t count) {
+		if (first + count > m_vertexData.size()) {
+			r2Error("render_node::vertices_updated: Range (%llu, %llu) is outside of the node's vertex capacity (%llu)", first, count, m_vertexData.size());
+			return;
+		}
+
+		size_t size = m_vertexData.buffer->format()->size();
+		m_vertexData.buffer->updated(m_vertexData.memBegin + (first * size), m_vertexData.memBegin + ((first + count) * size));
+		m_boundsDirty = true;
+	}
+
+	void render_node::indices_updated(size_t first, size_t count) {
+		if (first + count > m_indexData.size()) {
+			r2Error("render_node::indices_updated: Range (%llu, %llu) is outside of the node's index capacity (%llu)", first, count, m_indexData.size());
+			return;
+		}
+
+		size_t size = m_indexData.buffer->type();
+		m_indexData.buffer->updated(m_indexData.memBegin + (first * size), m_indexData.memBegin + ((first + count) * size));
+	}
+
+	void render_node::instances_updated(size_t first, size_t count) {
+		if (first + count > m_instanceData.size()) {
+			r2Error("render_node::instances_updated: Range (%llu, %llu) is outside of the node's instance capacity (%llu)", first, count, m_instanceData.size());
+			return;
+		}
+
+		size_t size = m_instanceData.buffer->format()->size();
+		m_instanceData.buffer->updated(m_instanceData.memBegin + (first * size), m_instanceData.memBegin + ((first + count) * size));
+		m_instanceBoundsDirty = true;
+	}
+
+	v8::Local<v8::ArrayBuffer> render_node::script_view(v8::Isolate* isolate, void* data, size_t size) {
+		for (auto& view : m_scriptViews) {
+			if (view.data == data && view.size == size) return view.buffer.Get(isolate);
+		}
+
+		// the memory is owned by the node's buffers, not by v8
+		v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(isolate, data, size, v8::ArrayBufferCreationMode::kExternalized);
+		m_scriptViews.emplace_back();
+		script_view_info& view = m_scriptViews.back();
+		view.buffer.Reset(isolate, buffer);
+		view.data = data;
+		view.size = size;
+		return buffer;
+	}
+
+	void render_node::detach_script_views() {
+		if (m_scriptViews.size() == 0) return;
+
+		v8::Isolate* isolate = r2engine::isolate();
+		v8::HandleScope scope(isolate);
+		for (auto& view : m_scriptViews) {
+			// scripts holding on to a detached view see it as empty, rather than writing to memory that moved
+			view.buffer.Get(isolate)->Detach();
+			view.buffer.Reset();
+		}
+		m_scriptViews.clear();
+	}
+
+	u32 render_node::format_key() const {
+		u32 key = u32(m_vertexData.buffer->format()->id()) << 16;
+		if (m_instanceData.is_valid()) key |= m_instanceData.buffer->format()->id();
+		return key;
+	}
+
+	void render_node::update_bounds() {
+		vertex_format* fmt = m_vertexData.buffer->format();
+		m_bounds.from_points(vertex_data(), m_vertexCount, fmt->size(), position_components(fmt));
+		m_boundsDirty = false;
+		m_instanceBoundsDirty = true;
+	}
+
+	void render_node::cull(const frustum& f) {
+		m_visible = true;
+		m_instancesCulled = false;
+		if (!enable_culling) return;
+
+		if (m_boundsDirty) update_bounds();
+		if (!m_bounds.valid) return;
+
+		if (!m_instanceData.is_valid()) {
+			const ufm_bo_segment& useg = m_uniforms->buffer_info();
+			mat4f transform = *(const mat4f*)((const u8*)useg.buffer->data() + useg.memBegin);
+
+			// a node whose transform was never set is drawn with its vertices as they are
+			if (transform[3][3] == 0.0f) transform = mat4f(1.0f);
+
+			m_visible = f.test_sphere(m_bounds.transformed_sphere(transform));
+			return;
+		}
+
+		instance_format* fmt = m_instanceData.buffer->format();
+		if (!fmt->hasModelMatrix() || m_nextInstanceIdx == 0) return;
+
+		size_t instanceSize = fmt->size();
+		const u8* src = (const u8*)m_instanceData.buffer->data() + m_instanceData.memBegin;
+
+		if (m_instanceBoundsDirty) {
+			for (size_t i = 0;i < m_nextInstanceIdx;i++) {
+				const mat4f* transform = (const mat4f*)(src + (i * instanceSize) + fmt->modelMatrixOffset());
+				m_instanceBounds[i] = m_bounds.transformed_sphere(*transform);
+			}
+			m_instanceBoundsDirty = false;
+		}
+
+		size_t visible = f.test_spheres(&m_instanceBounds[0], m_nextInstanceIdx, &m_instanceVisibility[0]);
+		m_visible = visible > 0;
+
+		// nothing to pack if every instance is visible, the scene packs the rest once it knows where they go
+		if (visible == m_nextInstanceIdx || visible == 0) return;
+
+		m_visibleInstanceCount = visible;
+		m_instancesCulled = true;
+	}
+
+	void render_node::pack_visible_instances() {
+		if (!m_instancesCulled) return;
+
+		size_t instanceSize = m_instanceData.buffer->format()->size();
+		const u8* src = (const u8*)m_instanceData.buffer->data() + m_instanceData.memBegin;
+		u8* dst = (u8*)m_visibleInstanceData.buffer->data() + m_visibleInstanceData.memBegin;
+		size_t out = 0;
+		for (size_t i = 0;i < m_nextInstanceIdx;i++) {
+			if (!m_instanceVisibility[i]) continue;
+			memcpy(dst + (out * instanceSize), src + (i * instanceSize), instanceSize);
+			out++;
+		}
+	}
+
 	void render_node::add_uniform_block(uniform_block* uniforms) {
 		for (uniform_block* block : m_userUniforms) {
 			if (block == uniforms) {
@@ -396,6 +576,17 @@ namespace r2 {
         m_mgr = m;
         m_name = name;
 		m_sceneUniforms = allocate_uniform_block("u_scene", static_uniform_formats::scene());
+		m_sceneFields.view = m_sceneUniforms->handle("view");
+		m_sceneFields.invView = m_sceneUniforms->handle("invView");
+		m_sceneFields.projection = m_sceneUniforms->handle("projection");
+		m_sceneFields.view_proj = m_sceneUniforms->handle("view_proj");
+		m_sceneFields.camera_pos = m_sceneUniforms->handle("camera_pos");
+		m_sceneFields.camera_left = m_sceneUniforms->handle("camera_left");
+		m_sceneFields.camera_up = m_sceneUniforms->handle("camera_up");
+		m_sceneFields.camera_forward = m_sceneUniforms->handle("camera_forward");
+		m_sceneFields.camera_near = m_sceneUniforms->handle("camera_near");
+		m_sceneFields.camera_far = m_sceneUniforms->handle("camera_far");
+		m_sceneFields.camera_fov = m_sceneUniforms->handle("camera_fov");
 		clearColor = vec4f(0.25f, 0.25f, 0.25f, 0.25f);
         r2Log("Scene created (%s)", m_name.c_str());
     }
@@ -454,6 +645,8 @@ namespace r2 {
 
 		render_node* node = new render_node(this, vboData, iboDataPtr, instanceDataPtr);
 		m_nodes.push_back(node);
+		node->update_bounds();
+		r2engine::renderer()->driver()->generate_vao(node);
 
 		mesh->m_wasSentToGpu = true;
 		delete[] mesh->m_vertices;
@@ -462,6 +655,8 @@ namespace r2 {
 		if (mesh->m_instances) { delete[] mesh->m_instances; mesh->m_instances = nullptr; }
 
 		node->m_uniforms = allocate_uniform_block("u_model", static_uniform_formats::node());
+		node->m_uniforms->uniform_mat4f("transform", mat4f(1.0f));
+		node->m_uniforms->uniform_mat4f("normal_transform", mat4f(1.0f));
 
 		return node;
 	}
@@ -587,6 +782,189 @@ namespace r2 {
 		for(render_node* node : m_nodes) driver->generate_vao(node);
 	}
 
+	// Calls 'task' for every node, on the marl workers when there's more than one range of them
+	template <typename F>
+	static void run_node_tasks(const mvector<render_node*>& nodes, const mvector<std::pair<size_t, size_t>>& ranges, F&& task) {
+		if (ranges.size() <= 1) {
+			for (render_node* node : nodes) task(node);
+			return;
+		}
+
+		marl::WaitGroup wg(ranges.size());
+		for (auto& range : ranges) {
+			size_t b = range.first;
+			size_t e = range.second;
+			marl::schedule([&nodes, &task, &wg, b, e]() {
+				for (size_t i = b;i < e;i++) task(nodes[i]);
+				wg.done();
+			});
+		}
+		wg.wait();
+	}
+
+	void scene::cull_nodes(const frustum& f) {
+		// split the nodes into tasks of roughly equal work, instanced nodes count once per instance
+		mvector<std::pair<size_t, size_t>> ranges;
+		size_t begin = 0;
+		size_t tests = 0;
+		for (size_t i = 0;i < m_nodes.size();i++) {
+			tests += max((size_t)1, m_nodes[i]->instance_count());
+			if (tests >= SCENE_CULL_TESTS_PER_TASK || i == m_nodes.size() - 1) {
+				ranges.push_back(std::pair<size_t, size_t>(begin, i + 1));
+				begin = i + 1;
+				tests = 0;
+			}
+		}
+
+		run_node_tasks(m_nodes, ranges, [&f](render_node* node) { node->cull(f); });
+
+		// Every culled node's visible instances get a slice of the scratch segment for their format, which only
+		// has to hold what's visible this frame
+		munordered_map<u16, std::pair<instance_format*, size_t>> used;
+		for (render_node* node : m_nodes) {
+			if (!node->m_instancesCulled) continue;
+			instance_format* fmt = node->m_instanceData.buffer->format();
+			auto& u = used[fmt->id()];
+			u.first = fmt;
+			u.second += node->m_visibleInstanceCount;
+		}
+		if (used.size() == 0) return;
+
+		for (auto& u : used) {
+			ins_bo_segment& scratch = m_cullScratch[u.first];
+			if (scratch.size() >= u.second.second) continue;
+
+			instance_format* fmt = u.second.first;
+			size_t count = max(u.second.second, scratch.size() * 2);
+			if (scratch.buffer) scratch.buffer->release(scratch);
+
+			mvector<u8> zeros(fmt->size() * count, 0);
+			buffer_pool* pool = &m_ins_buffers[fmt->hash_name()];
+			instance_buffer* ibo = pool->find_buffer<instance_buffer>(fmt->size() * count, fmt, max((size_t)DEFAULT_MAX_INSTANCES, count));
+			scratch = ibo->append(&zeros[0], count);
+		}
+
+		for (auto& u : used) u.second.second = 0;
+		for (render_node* node : m_nodes) {
+			if (!node->m_instancesCulled) continue;
+			size_t size = node->m_instanceData.buffer->format()->size();
+			u16 fmtId = node->m_instanceData.buffer->format()->id();
+			auto& u = used[fmtId];
+			const ins_bo_segment& scratch = m_cullScratch[fmtId];
+			if (!scratch.is_valid()) {
+				// the scratch segment couldn't be allocated, all of the node's instances are drawn
+				node->m_instancesCulled = false;
+				continue;
+			}
+
+			size_t at = u.second;
+			node->m_visibleInstanceData = scratch.sub(at, at + node->m_visibleInstanceCount, at * size, (at + node->m_visibleInstanceCount) * size);
+			u.second += node->m_visibleInstanceCount;
+		}
+
+		run_node_tasks(m_nodes, ranges, [](render_node* node) { node->pack_visible_instances(); });
+
+		// buffer update lists aren't thread safe, so packed instances are flagged for upload here
+		for (auto& u : used) {
+			const ins_bo_segment& scratch = m_cullScratch[u.first];
+			if (!scratch.is_valid()) continue;
+			scratch.buffer->updated(scratch.memBegin, scratch.memBegin + (u.second.second * u.second.first->size()));
+		}
+	}
+
+	template <typename segment_type>
+	static void compact_buffer(gpu_buffer* buf, mvector<segment_type*>& segments, size_t elementSize) {
+		std::sort(segments.begin(), segments.end(), [](segment_type* a, segment_type* b) {
+			return a->memBegin < b->memBegin;
+		});
+
+		// slide every live segment down to close the gaps between them
+		size_t cursor = 0;
+		for (segment_type* seg : segments) {
+			size_t count = seg->size();
+			size_t size = seg->memsize();
+			buf->relocate(seg->memBegin, cursor, size);
+			seg->memBegin = cursor;
+			seg->memEnd = cursor + size;
+			seg->begin = cursor / elementSize;
+			seg->end = seg->begin + count;
+			cursor += size;
+		}
+
+		buf->compacted(cursor);
+	}
+
+	static inline bool needs_compaction(gpu_buffer* buf) {
+		return buf->free_size() > 0 && f32(buf->free_size()) > f32(buf->used_size()) * GPU_BUFFER_COMPACTION_THRESHOLD;
+	}
+
+	void scene::compact_buffers() {
+		// Uniform buffers aren't compacted, every block in a uniform buffer has the same
+		// size so released blocks are always reused exactly by the next allocation
+
+		for (auto& pool : m_vtx_buffers) {
+			for (gpu_buffer* buf : pool.second.m_buffers) {
+				if (!needs_compaction(buf)) continue;
+
+				mvector<vtx_bo_segment*> segments;
+				for (render_node* node : m_nodes) {
+					if (node->m_vertexData.buffer != buf) continue;
+					segments.push_back(&node->m_vertexData);
+					node->detach_script_views();
+				}
+				compact_buffer(buf, segments, ((vertex_buffer*)buf)->format()->size());
+			}
+		}
+
+		for (auto& pool : m_idx_buffers) {
+			for (gpu_buffer* buf : pool.second.m_buffers) {
+				if (!needs_compaction(buf)) continue;
+
+				mvector<idx_bo_segment*> segments;
+				for (render_node* node : m_nodes) {
+					if (node->m_indexData.buffer != buf) continue;
+					segments.push_back(&node->m_indexData);
+					node->detach_script_views();
+				}
+				compact_buffer(buf, segments, ((index_buffer*)buf)->type());
+			}
+		}
+
+		for (auto& pool : m_ins_buffers) {
+			for (gpu_buffer* buf : pool.second.m_buffers) {
+				if (!needs_compaction(buf)) continue;
+
+				mvector<ins_bo_segment*> segments;
+				for (render_node* node : m_nodes) {
+					if (node->m_instanceData.buffer != buf) continue;
+					segments.push_back(&node->m_instanceData);
+					node->detach_script_views();
+				}
+
+				// culled nodes draw slices of the scratch segments, which move with them
+				mvector<std::pair<ins_bo_segment*, ins_bo_segment>> scratch;
+				for (auto& s : m_cullScratch) {
+					if (s.second.buffer != buf || !s.second.is_valid()) continue;
+					segments.push_back(&s.second);
+					scratch.push_back(std::pair<ins_bo_segment*, ins_bo_segment>(&s.second, s.second));
+				}
+
+				compact_buffer(buf, segments, ((instance_buffer*)buf)->format()->size());
+
+				for (render_node* node : m_nodes) {
+					ins_bo_segment& view = node->m_visibleInstanceData;
+					if (!node->m_instancesCulled || view.buffer != buf) continue;
+					for (auto& s : scratch) {
+						const ins_bo_segment& old = s.second;
+						if (view.memBegin < old.memBegin || view.memEnd > old.memEnd) continue;
+						view = s.first->sub(view.begin - old.begin, view.end - old.begin, view.memBegin - old.memBegin, view.memEnd - old.memBegin);
+						break;
+					}
+				}
+			}
+		}
+	}
+
 	void scene::sync_buffers() {
 		render_driver* driver = r2engine::get()->renderer()->driver();
 		if (!driver) {
@@ -594,10 +972,12 @@ namespace r2 {
 			return;
 		}
 
-		for(auto buf : m_vtx_buffers) buf.second.sync_buffers(driver);
-		for(auto buf : m_idx_buffers) buf.second.sync_buffers(driver);
-		for(auto buf : m_ins_buffers) buf.second.sync_buffers(driver);
-		for(auto buf : m_ufm_buffers) buf.second.sync_buffers(driver);
+		compact_buffers();
+
+		for(auto& buf : m_vtx_buffers) buf.second.sync_buffers(driver);
+		for(auto& buf : m_idx_buffers) buf.second.sync_buffers(driver);
+		for(auto& buf : m_ins_buffers) buf.second.sync_buffers(driver);
+		for(auto& buf : m_ufm_buffers) buf.second.sync_buffers(driver);
 		for(auto tex : m_textures) driver->sync_texture(tex);
 		for(auto trg : m_targets) driver->sync_render_target(trg);
 	}
@@ -611,6 +991,8 @@ namespace r2 {
 
 		// TODO: Optimize
 
+		frustum viewFrustum;
+		bool cullNodes = false;
 		if (camera && camera->camera) {
 			camera->camera->update_projection();
 			mat4f proj = camera->camera->projection();
@@ -620,29 +1002,41 @@ namespace r2 {
 			}
 			mat4f invView = glm::inverse(view);
 
-			m_sceneUniforms->uniform_mat4f("view", view);
-			m_sceneUniforms->uniform_mat4f("invView", invView);
-			m_sceneUniforms->uniform_mat4f("projection", proj);
-			m_sceneUniforms->uniform_mat4f("view_proj", proj * view);
+			mat4f viewProj = proj * view;
+			m_sceneUniforms->set(m_sceneFields.view, view);
+			m_sceneUniforms->set(m_sceneFields.invView, invView);
+			m_sceneUniforms->set(m_sceneFields.projection, proj);
+			m_sceneUniforms->set(m_sceneFields.view_proj, viewProj);
+			viewFrustum.set(viewProj);
+			cullNodes = true;
 
 			vec3f pos = invView[3];
 			f32 c = proj[2][2];
 			f32 d = proj[2][3];
 			f32 near = d / (c - 1.0f);
 			f32 far = d / (c + 1.0f);
-			m_sceneUniforms->uniform_vec3f("camera_pos", invView[3]);
-			m_sceneUniforms->uniform_vec3f("camera_left", invView[0]);
-			m_sceneUniforms->uniform_vec3f("camera_up", invView[1]);
-			m_sceneUniforms->uniform_vec3f("camera_forward", invView[2]);
-			m_sceneUniforms->uniform_float("camera_near", near);
-			m_sceneUniforms->uniform_float("camera_far", far);
-			m_sceneUniforms->uniform_float("camera_fov", atanf(1.0f / proj[1][1]) * 2.0f);
+			m_sceneUniforms->set(m_sceneFields.camera_pos, vec3f(invView[3]));
+			m_sceneUniforms->set(m_sceneFields.camera_left, vec3f(invView[0]));
+			m_sceneUniforms->set(m_sceneFields.camera_up, vec3f(invView[1]));
+			m_sceneUniforms->set(m_sceneFields.camera_forward, vec3f(invView[2]));
+			m_sceneUniforms->set(m_sceneFields.camera_near, near);
+			m_sceneUniforms->set(m_sceneFields.camera_far, far);
+			m_sceneUniforms->set(m_sceneFields.camera_fov, atanf(1.0f / proj[1][1]) * 2.0f);
+		}
+
+		if (cullNodes) cull_nodes(viewFrustum);
+		else {
+			for (render_node* node : m_nodes) {
+				node->m_visible = true;
+				node->m_instancesCulled = false;
+			}
 		}
 
-		generate_vaos();
 		sync_buffers();
 
+		mvector<render_node*> opaque;
 		mvector<render_node*> transparent;
+		opaque.reserve(m_nodes.size());
 		transparent.reserve(m_nodes.size());
 
 		driver->bind_render_target(m_renderTarget);
@@ -710,16 +1104,20 @@ namespace r2 {
 			}
 
 			if (node->vertex_count() == 0 || (node->indices().is_valid() && node->index_count() == 0)) continue;
+			if (!node->is_visible()) continue;
 
 			if (node->has_transparency) transparent.push_back(node);
-			else driver->render_node(node, m_sceneUniforms);
+			else opaque.push_back(node);
 		}
 
-		if (transparent.size() > 0) {
-			for (auto node : transparent) {
-				driver->render_node(node, m_sceneUniforms);
-			}
-		}
+		// opaque nodes can be drawn in any order, so let the driver batch them
+		driver->render_nodes(opaque, m_sceneUniforms);
+
+		// transparent nodes are drawn in order, only adjacent compatible nodes share a draw call
+		if (transparent.size() > 0) driver->render_nodes(transparent, m_sceneUniforms, true);
+
+		// read back whatever was requested from this frame's render targets
+		for (auto trg : m_targets) driver->process_readbacks(trg);
 
 		driver->bind_render_target(nullptr);
 	}
@@ -753,6 +1151,11 @@ namespace r2 {
 		for(auto buf : m_idx_buffers) buf.second.free_buffers(driver);
 		m_idx_buffers.clear();
 
+		for(auto& s : m_cullScratch) {
+			if (s.second.buffer) s.second.buffer->release(s.second);
+		}
+		m_cullScratch.clear();
+
 		for(auto buf : m_ins_buffers) buf.second.free_buffers(driver);
 		m_ins_buffers.clear();
 
@@ -773,6 +1176,10 @@ namespace r2 {
 		m_targets.clear();
 	}
 
+	void scene::detach_script_views() {
+		for(auto node : m_nodes) node->detach_script_views();
+	}
+
     bool scene::check_mesh(size_t vc) const {
         if(vc == 0) {
             r2Error("Call to scene::add_mesh failed. Mesh has no vertices");
@@ -818,6 +1225,10 @@ namespace r2 {
         return s;
     }
 
+	void scene_man::detach_script_views() {
+		for(auto s : m_scenes) s->detach_script_views();
+	}
+
 	scene* scene_man::get(const mstring& name) {
 		for(auto i = m_scenes.begin();i != m_scenes.end();i++) {
 			if((*i)->name() == name) {
@@ -7,12 +7,16 @@
 #include <r2/utilities/mesh.h>
 #include <r2/utilities/uniformbuffer.h>
 #include <r2/utilities/texture.h>
+#include <r2/utilities/frustum.h>
 
 #define DEFAULT_MAX_VERTICES		65536
 #define DEFAULT_MAX_INDICES			65536
 #define DEFAULT_MAX_INSTANCES		65536
 #define DEFAULT_MAX_UNIFORM_BLOCKS	16384
 
+// Approximate number of bounding sphere tests each culling task performs
+#define SCENE_CULL_TESTS_PER_TASK	4096
+
 namespace r2 {
 	typedef size_t instanceId;
 	class render_node;
@@ -110,6 +114,8 @@ namespace r2 {
 			void update_indices_raw(const void* data, size_t count);
 			void* index_data();
 			bool instance_valid(instanceId id) const;
+			// Index of the instance in the node's storage, SIZE_MAX if it's invalid
+			size_t instance_index(instanceId id) const;
 			void set_vertex_count(size_t count);
 			void set_index_count(size_t count);
 			void add_uniform_block(uniform_block* uniforms);
@@ -122,6 +128,36 @@ namespace r2 {
 			inline size_t max_vertex_count() const { return m_vertexData.size(); }
 			inline size_t max_index_count() const { return m_indexData.size(); }
 
+			// recomputes the node's local bounds from its current vertices, vertex
+			// writes only flag them and they're recomputed when the node is next culled
+			void update_bounds();
+			inline const bounding_volume& bounds() const { return m_bounds; }
+
+			// Tests the node (or each of its instances) against the frustum. The scene
+			// then packs the visible instances into a shared segment, which is what gets drawn
+			void cull(const frustum& f);
+			inline bool is_visible() const { return m_visible; }
+			// copies the visible instances to m_visibleInstanceData, once the scene has assigned it
+			void pack_visible_instances();
+
+			// Flags ranges of elements that were written directly to the node's storage
+			void vertices_updated(size_t first, size_t count);
+			void indices_updated(size_t first, size_t count);
+			void instances_updated(size_t first, size_t count);
+
+			// ArrayBuffer over part of the node's storage, for scripts. Views are detached
+			// whenever the node's storage moves, or the node is destroyed
+			v8::Local<v8::ArrayBuffer> script_view(v8::Isolate* isolate, void* data, size_t size);
+			void detach_script_views();
+
+			// Identifies the node's vertex/instance format pair
+			u32 format_key() const;
+			// Vertex array handle owned by the render driver, 0 until one is generated
+			inline u32 vertex_array() const { return m_vertexArray; }
+			inline void set_vertex_array(u32 vao) { m_vertexArray = vao; }
+			inline const ins_bo_segment& visible_instances() const { return m_instancesCulled ? m_visibleInstanceData : m_instanceData; }
+			inline size_t visible_instance_count() const { return m_instancesCulled ? m_visibleInstanceCount : m_nextInstanceIdx; }
+
 			template <typename T>
 			void update_instance(instanceId id, const T& data) {
 				assert(sizeof(T) == m_instanceData.buffer->format()->size());
@@ -142,6 +178,7 @@ namespace r2 {
 
 			bool destroy_when_unused;
 			bool has_transparency;
+			bool enable_culling;
 			primitive_type primitives;
 
         protected:
@@ -156,7 +193,26 @@ namespace r2 {
 			size_t m_nextInstanceIdx;
 			size_t m_vertexCount;
 			size_t m_indexCount;
+			u32 m_vertexArray;
 			munordered_map<instanceId, size_t> m_instanceIndices;
+
+			struct script_view_info {
+				v8::Persistent<v8::ArrayBuffer, v8::CopyablePersistentTraits<v8::ArrayBuffer>> buffer;
+				void* data;
+				size_t size;
+			};
+			mlist<script_view_info> m_scriptViews;
+
+			bounding_volume m_bounds;
+			bool m_boundsDirty;
+			mvector<vec4f> m_instanceBounds;
+			mvector<u8> m_instanceVisibility;
+			bool m_instanceBoundsDirty;
+			// part of the scene's culling scratch segment for the node's instance format
+			ins_bo_segment m_visibleInstanceData;
+			size_t m_visibleInstanceCount;
+			bool m_instancesCulled;
+			bool m_visible;
     };
 
 	class node_material {
@@ -218,6 +274,10 @@ namespace r2 {
 			scene* get(const mstring& name);
             void destroy(scene* s);
 
+			// Detaches every script view of every scene's nodes. Must be called before the script
+			// manager is destroyed, since the views belong to its isolate
+			void detach_script_views();
+
         protected:
             mvector<scene*> m_scenes;
     };
@@ -245,10 +305,13 @@ namespace r2 {
 			bool remove_node(render_node* node);
 
 			void generate_vaos();
+			void cull_nodes(const frustum& f);
+			void compact_buffers();
 			void sync_buffers();
 			void render(f32 dt);
 
 			void release_resources();
+			void detach_script_views();
 
 			scene_entity* camera;
 			vec4f clearColor;
@@ -263,6 +326,13 @@ namespace r2 {
             mstring m_name;
 
 			uniform_block* m_sceneUniforms;
+
+			// the scene block's fields, resolved once when the scene is created
+			struct {
+				uniform_handle view, invView, projection, view_proj;
+				uniform_handle camera_pos, camera_left, camera_up, camera_forward;
+				uniform_handle camera_near, camera_far, camera_fov;
+			} m_sceneFields;
 			render_buffer* m_renderTarget;
 
             // one buffer pool per vertex format
@@ -271,6 +341,9 @@ namespace r2 {
 			munordered_map<u8, buffer_pool> m_idx_buffers;
             // one buffer pool per instance data format
 			munordered_map<mstring, buffer_pool> m_ins_buffers;
+			// Visible instances of the nodes culled each frame, one segment per instance data format. They
+			// only grow, and are shared by every node of the format
+			munordered_map<u16, ins_bo_segment> m_cullScratch;
 			// one buffer pool per uniform block format
 			munordered_map<mstring, buffer_pool> m_ufm_buffers;
 
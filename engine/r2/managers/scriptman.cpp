@@ -1,6 +1,7 @@
 #include <r2/managers/scriptman.h>
 #include <r2/engine.h>
 #include <r2/bindings/bindings.h>
+#include <r2/utilities/utils.h>
 
 #include <algorithm>
 
@@ -148,6 +149,9 @@ namespace r2 {
 		return true;
 	}
 
+	// Set while a snapshot is being created, collects every file the prelude requires
+	static mvector<mstring>* snapshot_dependencies = nullptr;
+
 	void js_require(v8Args args) {
 		Isolate* i = args.GetIsolate();
 		if (args.Length() != 1 || !args[0]->IsString()) {
@@ -175,6 +179,7 @@ namespace r2 {
 		mstring require_path = current_dir + file;
 		mstring source = get_contents(require_path);
 		if (source.length() == 0) return;
+		if (snapshot_dependencies) snapshot_dependencies->push_back(require_path);
 
 		if (source.find("//r2-do-not-wrap") == string::npos) {
 			auto exportIdx = source.rfind("export");
@@ -192,9 +197,9 @@ namespace r2 {
 
 		EscapableHandleScope scope(i);
 		TryCatch tc(i);
-		ScriptOrigin origin(convert<mstring>::to_v8(i, require_path));
 		Local<Script> script;
-		bool is_valid = Script::Compile(context, convert<mstring>::to_v8(i, source), &origin).ToLocal(&script);
+		u64 cacheHash = 0;
+		bool is_valid = r2engine::get()->scripts()->compile(context, source, require_path, &script, &cacheHash);
 
 		if (tc.HasCaught()) script_exception(i, tc.Exception(), tc.Message());
 		if (!is_valid) { return; }
@@ -209,14 +214,304 @@ namespace r2 {
 				return;
 			} else if(!result.ToLocal(&localResult)) r2Error("Failed to get exports from module \"%s\"", require_path.c_str());
 
+			r2engine::get()->scripts()->update_code_cache(script, require_path, cacheHash);
+
 			args.GetReturnValue().Set(scope.Escape(localResult));
 		} else r2Error("Module \"%s\" is empty", require_path.c_str());
 	}
 
-	script_man::script_man() : m_context(new v8pp::context(nullptr, new ArrayBufferAllocator(), false)), m_global_scope(m_context->isolate()) {
+	// Native functions reachable from the snapshot heap, must be identical when creating and when loading it
+	static const intptr_t snapshot_external_references[] = {
+		(intptr_t)&js_require,
+		0
+	};
+
+	script_man::script_man() : m_snapshot({ nullptr, 0 }), m_codeCacheStats({ 0, 0, 0, 0 }), m_allocator(new ArrayBufferAllocator()), m_context(new v8pp::context(create_isolate(m_allocator), m_allocator, false)), m_global_scope(m_context->isolate()) {
+		m_profiler = new script_profiler(m_context->isolate());
+
+		// once worker isolates use Lockers, V8 expects every isolate to be locked by the thread using it
+		m_locker = new v8::Locker(m_context->isolate());
+		m_jobs = new script_job_pool(m_context->isolate(), new ArrayBufferAllocator());
+	}
+
+	// snapshot file layout: this header, 'dependencyCount' dependencies (u32 path length, path, u64 hash of the
+	// file's contents) for the files the prelude required, followed by the V8 startup blob
+	#define SCRIPT_SNAPSHOT_MAGIC 0x6e73326a
+	struct snapshot_header {
+		u32 magic;
+		// snapshots are only valid for the V8 version and flags that created them
+		u32 versionTag;
+		u64 versionHash;
+		u64 preludeHash;
+		u32 dependencyCount;
+	};
+
+	// Doesn't log, it runs before the engine instance exists
+	static bool file_hash(const mstring& file, u64* hash) {
+		FILE* fp = fopen(file.c_str(), "rb");
+		if (!fp) return false;
+		fclose(fp);
+
+		*hash = hash_string(get_contents(file));
+		return true;
+	}
+
+	// Called before the engine instance exists, problems are logged later by initialize
+	v8::Isolate* script_man::create_isolate(v8::ArrayBuffer::Allocator* allocator) {
+		FILE* fp = fopen(SCRIPT_SNAPSHOT_FILE, "rb");
+		if (!fp) return nullptr;
+
+		fseek(fp, 0, SEEK_END);
+		size_t fsz = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+
+		snapshot_header header;
+		if (fread(&header, sizeof(snapshot_header), 1, fp) != 1 || header.magic != SCRIPT_SNAPSHOT_MAGIC) {
+			fclose(fp);
+			m_snapshotWarning = mstring(SCRIPT_SNAPSHOT_FILE) + " is invalid, it will be ignored";
+			return nullptr;
+		}
+
+		if (header.versionTag != ScriptCompiler::CachedDataVersionTag() || header.versionHash != hash_string(V8::GetVersion())) {
+			fclose(fp);
+			m_snapshotWarning = mstring(SCRIPT_SNAPSHOT_FILE) + " was built by a different version of V8 or with different flags, it will be ignored. Rebuild the snapshot to restore fast startup";
+			return nullptr;
+		}
+
+		u64 hash = 0;
+		bool changed = !file_hash(SCRIPT_PRELUDE_FILE, &hash) || hash != header.preludeHash;
+		mstring changedFile = SCRIPT_PRELUDE_FILE;
+		for (u32 d = 0;d < header.dependencyCount && !changed;d++) {
+			u32 length = 0;
+			if (fread(&length, sizeof(u32), 1, fp) != 1 || length == 0 || length > fsz) {
+				fclose(fp);
+				m_snapshotWarning = mstring(SCRIPT_SNAPSHOT_FILE) + " is invalid, it will be ignored";
+				return nullptr;
+			}
+
+			changedFile.resize(length);
+			u64 expected = 0;
+			if (fread(&changedFile[0], length, 1, fp) != 1 || fread(&expected, sizeof(u64), 1, fp) != 1) {
+				fclose(fp);
+				m_snapshotWarning = mstring(SCRIPT_SNAPSHOT_FILE) + " is invalid, it will be ignored";
+				return nullptr;
+			}
+
+			changed = !file_hash(changedFile, &hash) || hash != expected;
+		}
+
+		if (changed) {
+			fclose(fp);
+			m_snapshotWarning = mstring(SCRIPT_SNAPSHOT_FILE) + " was built from a different " + changedFile + ", it will be ignored. Rebuild the snapshot to restore fast startup";
+			return nullptr;
+		}
+
+		size_t offset = ftell(fp);
+		if (offset >= fsz) {
+			fclose(fp);
+			m_snapshotWarning = mstring(SCRIPT_SNAPSHOT_FILE) + " is invalid, it will be ignored";
+			return nullptr;
+		}
+
+		size_t size = fsz - offset;
+		char* data = new char[size];
+		if (fread(data, size, 1, fp) != 1) {
+			fclose(fp);
+			delete [] data;
+			m_snapshotWarning = mstring("Failed to read ") + SCRIPT_SNAPSHOT_FILE + ", it will be ignored";
+			return nullptr;
+		}
+		fclose(fp);
+
+		// the blob must outlive the isolate, which is never disposed (see ~script_man)
+		m_snapshot.data = data;
+		m_snapshot.raw_size = (int)size;
+
+		Isolate::CreateParams params;
+		params.array_buffer_allocator = allocator;
+		params.snapshot_blob = &m_snapshot;
+		params.external_references = snapshot_external_references;
+
+		Isolate* isolate = Isolate::New(params);
+		isolate->Enter();
+		return isolate;
+	}
+
+	bool script_man::create_snapshot(const mstring& outFile, const mstring& preludeFile) {
+		mstring source = get_contents(preludeFile);
+		if (source.length() == 0) return false;
+
+		SnapshotCreator creator(snapshot_external_references);
+		Isolate* isolate = creator.GetIsolate();
+		mvector<mstring> dependencies;
+		snapshot_dependencies = &dependencies;
+		{
+			Isolate::Scope isolateScope(isolate);
+			HandleScope scope(isolate);
+			Local<Context> context = Context::New(isolate);
+			Context::Scope contextScope(context);
+
+			Local<String> requireName = convert<mstring>::to_v8(isolate, "require");
+			context->Global()->Set(context, requireName, Function::New(context, &js_require).ToLocalChecked()).FromJust();
+
+			TryCatch try_catch(isolate);
+			ScriptOrigin origin(convert<mstring>::to_v8(isolate, preludeFile));
+			Local<Script> script;
+			if (!Script::Compile(context, convert<mstring>::to_v8(isolate, source), &origin).ToLocal(&script) || script->Run(context).IsEmpty()) {
+				if (try_catch.HasCaught()) script_exception(isolate, try_catch);
+				r2Error("Failed to run %s while creating startup snapshot", preludeFile.c_str());
+				snapshot_dependencies = nullptr;
+				return false;
+			}
+
+			// script_man::initialize binds the real require, along with the rest of the engine
+			context->Global()->Delete(context, requireName).FromJust();
+			creator.SetDefaultContext(context);
+		}
+		snapshot_dependencies = nullptr;
+
+		// keep compiled functions, so the prelude doesn't need to be compiled again at startup
+		StartupData blob = creator.CreateBlob(SnapshotCreator::FunctionCodeHandling::kKeep);
+		if (!blob.data) {
+			r2Error("Failed to create startup snapshot from %s", preludeFile.c_str());
+			return false;
+		}
+
+		FILE* fp = fopen(outFile.c_str(), "wb");
+		if (!fp) {
+			r2Error("Failed to open %s for writing", outFile.c_str());
+			delete [] blob.data;
+			return false;
+		}
+
+		snapshot_header header;
+		header.magic = SCRIPT_SNAPSHOT_MAGIC;
+		header.versionTag = ScriptCompiler::CachedDataVersionTag();
+		header.versionHash = hash_string(V8::GetVersion());
+		header.preludeHash = hash_string(source);
+		header.dependencyCount = (u32)dependencies.size();
+
+		bool success = fwrite(&header, sizeof(snapshot_header), 1, fp) == 1;
+		for (size_t d = 0;d < dependencies.size() && success;d++) {
+			u32 length = (u32)dependencies[d].length();
+			u64 hash = hash_string(get_contents(dependencies[d]));
+			success = fwrite(&length, sizeof(u32), 1, fp) == 1 && fwrite(dependencies[d].c_str(), length, 1, fp) == 1 && fwrite(&hash, sizeof(u64), 1, fp) == 1;
+		}
+		success = success && fwrite(blob.data, blob.raw_size, 1, fp) == 1;
+		fclose(fp);
+		delete [] blob.data;
+
+		if (!success) {
+			r2Error("Failed to write startup snapshot to %s", outFile.c_str());
+			return false;
+		}
+
+		r2Log("Wrote startup snapshot of %s to %s (%d bytes)", preludeFile.c_str(), outFile.c_str(), blob.raw_size);
+		return true;
+	}
+
+	// code cache file layout: this header, followed by the V8 cache data
+	#define SCRIPT_CODE_CACHE_MAGIC 0x6373326A
+	struct code_cache_header {
+		u32 magic;
+		u32 versionTag;
+		u64 sourceHash;
+		u32 size;
+	};
+
+	// Returns cache data made from source with 'hash' by this V8 version, or nullptr
+	static ScriptCompiler::CachedData* read_code_cache(const mstring& file, u64 hash) {
+		FILE* fp = fopen(file.c_str(), "rb");
+		if (!fp) return nullptr;
+
+		code_cache_header header;
+		if (fread(&header, sizeof(code_cache_header), 1, fp) != 1 || header.magic != SCRIPT_CODE_CACHE_MAGIC) {
+			fclose(fp);
+			return nullptr;
+		}
+
+		if (header.versionTag != ScriptCompiler::CachedDataVersionTag() || header.sourceHash != hash || header.size == 0) {
+			fclose(fp);
+			return nullptr;
+		}
+
+		// CachedData::BufferOwned frees with delete []
+		u8* data = new u8[header.size];
+		if (fread(data, header.size, 1, fp) != 1) {
+			fclose(fp);
+			delete [] data;
+			return nullptr;
+		}
+		fclose(fp);
+
+		return new ScriptCompiler::CachedData(data, header.size, ScriptCompiler::CachedData::BufferOwned);
+	}
+
+	static bool write_code_cache(const mstring& file, u64 hash, const ScriptCompiler::CachedData* cache) {
+		FILE* fp = fopen(file.c_str(), "wb");
+		if (!fp) {
+			r2Warn("Failed to open %s for writing, script will be compiled again next time it's loaded", file.c_str());
+			return false;
+		}
+
+		code_cache_header header = { SCRIPT_CODE_CACHE_MAGIC, ScriptCompiler::CachedDataVersionTag(), hash, (u32)cache->length };
+		bool success = fwrite(&header, sizeof(code_cache_header), 1, fp) == 1 && fwrite(cache->data, cache->length, 1, fp) == 1;
+		fclose(fp);
+
+		if (!success) {
+			r2Warn("Failed to write code cache %s", file.c_str());
+			remove(file.c_str());
+		}
+
+		return success;
+	}
+
+	bool script_man::compile(Local<Context> context, const mstring& source, const mstring& name, Local<Script>* script, u64* cacheHash) {
+		Isolate* isolate = context->GetIsolate();
+		ScriptOrigin origin(convert<mstring>::to_v8(isolate, name), Integer::New(isolate, 0));
+		Local<String> code = convert<mstring>::to_v8(isolate, source);
+		if (!cacheHash) return Script::Compile(context, code, &origin).ToLocal(script);
+
+		u64 hash = hash_string(source);
+		ScriptCompiler::CachedData* cached = read_code_cache(name + SCRIPT_CODE_CACHE_EXTENSION, hash);
+		*cacheHash = hash;
+
+		if (cached) {
+			// source takes ownership of the cache data
+			ScriptCompiler::Source compilerSource(code, origin, cached);
+			if (!ScriptCompiler::Compile(context, &compilerSource, ScriptCompiler::kConsumeCodeCache).ToLocal(script)) return false;
+			if (!compilerSource.GetCachedData()->rejected) {
+				m_codeCacheStats.hits++;
+				*cacheHash = 0;
+				return true;
+			}
+
+			// V8 compiled from source instead, the cache is replaced after the script runs
+			m_codeCacheStats.rejections++;
+			r2Warn("Code cache for \"%s\" was rejected, it will be rebuilt", name.c_str());
+			return true;
+		}
+
+		m_codeCacheStats.misses++;
+		ScriptCompiler::Source compilerSource(code, origin);
+		return ScriptCompiler::Compile(context, &compilerSource).ToLocal(script);
+	}
+
+	void script_man::update_code_cache(Local<Script> script, const mstring& name, u64 cacheHash) {
+		if (cacheHash == 0 || script.IsEmpty()) return;
+
+		ScriptCompiler::CachedData* cache = ScriptCompiler::CreateCodeCache(script->GetUnboundScript());
+		if (cache) {
+			if (write_code_cache(name + SCRIPT_CODE_CACHE_EXTENSION, cacheHash, cache)) m_codeCacheStats.writes++;
+			delete cache;
+		}
 	}
 
 	script_man::~script_man() {
+		delete m_jobs;
+		delete m_profiler;
+		delete m_locker;
+
 		// purposely not deleting m_context.
 		// v8pp::context will attempt to deallocate objects that are managed by the engine
 		// The memory allocated by the context and the memory allocated for the context itself
@@ -224,6 +519,7 @@ namespace r2 {
 	}
 
 	void script_man::initialize() {
+		if (m_snapshotWarning.length() > 0) r2Warn(m_snapshotWarning.c_str());
 		bind_engine(m_context);
 		m_context->set("require", wrap_function(m_context->isolate(), "require", &js_require));
 	}
@@ -236,9 +532,8 @@ namespace r2 {
 
 		TryCatch try_catch(isolate);
 		try_catch.SetVerbose(false);
-		ScriptOrigin origin(convert<mstring>::to_v8(isolate, "command"), Local<Integer>::New(isolate, Integer::New(isolate, 0)));
 		Local<Script> script;
-		bool is_valid = Script::Compile(context, convert<mstring>::to_v8(isolate, source), &origin).ToLocal(&script);
+		bool is_valid = compile(context, source, "command", &script);
 
 		if (try_catch.HasCaught()) {
 			script_exception(isolate, try_catch.Exception(), try_catch.Message());
@@ -275,9 +570,9 @@ namespace r2 {
 
 		TryCatch try_catch(isolate);
 		try_catch.SetVerbose(true);
-		ScriptOrigin origin(convert<mstring>::to_v8(isolate, file), Local<Integer>::New(isolate, Integer::New(isolate, 0)));
 		Local<Script> script;
-		bool is_valid = Script::Compile(context, convert<mstring>::to_v8(isolate, source), &origin).ToLocal(&script);
+		u64 cacheHash = 0;
+		bool is_valid = compile(context, source, file, &script, &cacheHash);
 
 		if (try_catch.HasCaught()) {
 			script_exception(isolate, try_catch);
@@ -297,6 +592,8 @@ namespace r2 {
 				script_exception(isolate, try_catch);
 				return false;
 			}
+
+			update_code_cache(script, file, cacheHash);
 		} else {
 			r2Error("Script \"%s\" is empty", file.c_str());
 			return false;
@@ -307,7 +604,7 @@ namespace r2 {
 
 
 
-	script::script(state* parentState) : m_state(parentState), m_is_valid(false) {
+	script::script(state* parentState) : m_state(parentState), m_is_valid(false), m_cacheHash(0) {
 		// todo: make m_script persistent
 	}
 
@@ -321,9 +618,8 @@ namespace r2 {
 		auto ctx = r2engine::get()->scripts()->context();
 
 		TryCatch try_catch(ctx->isolate());
-		ScriptOrigin origin(to_v8(ctx->isolate(), m_filename));
 		Local<Context> context = ctx->isolate()->GetCurrentContext();
-		m_is_valid = Script::Compile(context, to_v8(ctx->isolate(), source), &origin).ToLocal(&m_script);
+		m_is_valid = r2engine::get()->scripts()->compile(context, source, m_filename, &m_script, &m_cacheHash);
 		if (try_catch.HasCaught()) script_exception(ctx->isolate(), try_catch.Exception(), try_catch.Message());
 		
 		return true;
@@ -344,8 +640,17 @@ namespace r2 {
 			result.isolate = isolate;
 			bool success = m_script->Run(v8context).ToLocal(&result.value);
 
-			if (try_catch.HasCaught()) script_exception(ctx->isolate(), try_catch.Exception(), try_catch.Message());
-			else if (logResult) r2Log("Script output: %s", string(result).c_str());
+			if (try_catch.HasCaught()) {
+				script_exception(ctx->isolate(), try_catch.Exception(), try_catch.Message());
+				return;
+			}
+
+			if (m_cacheHash != 0) {
+				r2engine::get()->scripts()->update_code_cache(m_script, m_filename, m_cacheHash);
+				m_cacheHash = 0;
+			}
+
+			if (logResult) r2Log("Script output: %s", string(result).c_str());
 		}
 	}
 };
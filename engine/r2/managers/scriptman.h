@@ -2,6 +2,8 @@
 #include <r2/config.h>
 #include <r2/managers/assetman.h>
 #include <r2/managers/memman.h>
+#include <r2/utilities/script_profiler.h>
+#include <r2/utilities/script_jobs.h>
 
 #include <v8pp/context.hpp>
 #include <v8pp/module.hpp>
@@ -10,6 +12,15 @@
 
 using namespace std;
 
+// JS prelude that every context is initialized with
+#define SCRIPT_PRELUDE_FILE "./builtin.js"
+
+// startup snapshot of a context which has already run the prelude, see script_man::create_snapshot
+#define SCRIPT_SNAPSHOT_FILE "./builtin.snapshot"
+
+// appended to a script's path to get the path of its V8 code cache
+#define SCRIPT_CODE_CACHE_EXTENSION ".jscache"
+
 namespace r2 {
 	class r2engine;
 	class script_man;
@@ -33,6 +44,17 @@ namespace r2 {
 			state* m_state;
 			v8::Local<v8::Script> m_script;
 			bool m_is_valid;
+
+			// set until the first run rewrites the script's code cache
+			u64 m_cacheHash;
+	};
+
+	// counted by script_man::compile and update_code_cache, since startup
+	struct code_cache_stats {
+		u32 hits;
+		u32 misses;
+		u32 rejections;
+		u32 writes;
 	};
 
 	class script_man {
@@ -47,8 +69,41 @@ namespace r2 {
 
 			v8pp::context* context() { return m_context; }
 
+			// Compiles 'source' as 'name'. When 'cacheHash' is passed, the code cache stored at name + SCRIPT_CODE_CACHE_EXTENSION
+			// is consumed if it was made from the same source by the same V8 version. If it wasn't, *cacheHash is set to the
+			// hash of 'source' (otherwise 0) and should be passed to update_code_cache once the script has run
+			bool compile(v8::Local<v8::Context> context, const mstring& source, const mstring& name, v8::Local<v8::Script>* script, u64* cacheHash = nullptr);
+
+			// Rewrites the code cache of 'name'. Done after the first run, so that the functions V8 compiled lazily while
+			// running it are cached too. Does nothing if 'cacheHash' is 0
+			void update_code_cache(v8::Local<v8::Script> script, const mstring& name, u64 cacheHash);
+			const code_cache_stats& code_cache() const { return m_codeCacheStats; }
+
+			// Times engine->JS calls, and optionally samples them with V8's CPU profiler
+			script_profiler* profiler() { return m_profiler; }
+
+			// Runs pure-data script jobs on worker isolates, see script_job_pool
+			script_job_pool* jobs() { return m_jobs; }
+
+			// True if the context was deserialized from SCRIPT_SNAPSHOT_FILE, and the prelude does not need to be run
+			bool booted_from_snapshot() const { return m_snapshot.data != nullptr; }
+
+			// Runs 'preludeFile' in a fresh context and writes a V8 startup snapshot of the result to 'outFile'.
+			// Engine bindings wrap C++ callbacks that can't be serialized, so they're still registered at startup
+			static bool create_snapshot(const mstring& outFile, const mstring& preludeFile);
+
 		protected:
+			v8::Isolate* create_isolate(v8::ArrayBuffer::Allocator* allocator);
+
+			v8::StartupData m_snapshot;
+			mstring m_snapshotWarning;
+			code_cache_stats m_codeCacheStats;
+			// used by the main isolate, whether it was booted from the snapshot or created by v8pp
+			v8::ArrayBuffer::Allocator* m_allocator;
 			v8pp::context* m_context;
 			v8::HandleScope m_global_scope;
+			script_profiler* m_profiler;
+			script_job_pool* m_jobs;
+			v8::Locker* m_locker;
 	};
 };
\ No newline at end of file
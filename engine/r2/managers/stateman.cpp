@@ -17,6 +17,8 @@ namespace r2 {
 		m_desiredMemorySize(MBtoB(2)),
 		m_scripted(true)
 	{
+		for (u8 i = 0;i < ssf_count;i++) m_scriptSites[i] = SCRIPT_CALL_SITE_NONE;
+
 		if (!r2engine::get()->renderer()->driver()) {
 			r2Error("No states can be created until after a render driver has been specified");
 			return;
@@ -74,6 +76,8 @@ namespace r2 {
 		m_desiredMemorySize(max_memory),
 		m_scripted(false)
 	{
+		for (u8 i = 0;i < ssf_count;i++) m_scriptSites[i] = SCRIPT_CALL_SITE_NONE;
+
 		if (name.length() == 0) {
 			r2Error("State names must not be empty.");
 			return;
@@ -241,6 +245,7 @@ namespace r2 {
 		if (m_scripted) {
 			if (m_scriptState.IsEmpty()) init_script_data();
 			if (!m_willBecomeActive.IsEmpty()) {
+				script_call_scope scope(r2engine::scripts()->profiler(), script_site(ssf_willBecomeActive));
 				m_willBecomeActive.Get(isolate)->Call(isolate->GetCurrentContext(), m_scriptState.Get(isolate), 0, NULL);
 			}
 		}
@@ -257,6 +262,7 @@ namespace r2 {
 
 		if (m_scripted) {
 			if (!m_becameActive.IsEmpty()) {
+				script_call_scope scope(r2engine::scripts()->profiler(), script_site(ssf_becameActive));
 				m_becameActive.Get(isolate)->Call(isolate->GetCurrentContext(), m_scriptState.Get(isolate), 0, NULL);
 			}
 		}
@@ -271,6 +277,7 @@ namespace r2 {
 
 		if (m_scripted) {
 			if (!m_willBecomeInactive.IsEmpty()) {
+				script_call_scope scope(r2engine::scripts()->profiler(), script_site(ssf_willBecomeInactive));
 				m_willBecomeInactive.Get(isolate)->Call(isolate->GetCurrentContext(), m_scriptState.Get(isolate), 0, NULL);
 			}
 		}
@@ -286,6 +293,7 @@ namespace r2 {
 		becameInactive();
 
 		if (!m_becameInactive.IsEmpty()) {
+			script_call_scope scope(r2engine::scripts()->profiler(), script_site(ssf_becameInactive));
 			m_becameInactive.Get(isolate)->Call(isolate->GetCurrentContext(), m_scriptState.Get(isolate), 0, NULL);
 		}
 
@@ -298,6 +306,7 @@ namespace r2 {
 		willBeDestroyed();
 
 		if (!m_willBeDestroyed.IsEmpty()) {
+			script_call_scope scope(r2engine::scripts()->profiler(), script_site(ssf_willBeDestroyed));
 			m_willBeDestroyed.Get(isolate)->Call(isolate->GetCurrentContext(), m_scriptState.Get(isolate), 0, NULL);
 		}
 
@@ -314,6 +323,7 @@ namespace r2 {
 				to_v8(isolate, frameDt),
 				to_v8(isolate, updateDt)
 			};
+			script_call_scope scope(r2engine::scripts()->profiler(), script_site(ssf_update));
 			m_update.Get(isolate)->Call(isolate->GetCurrentContext(), m_scriptState.Get(isolate), 2, args);
 		}
 
@@ -326,6 +336,7 @@ namespace r2 {
 		onRender();
 
 		if (!m_render.IsEmpty()) {
+			script_call_scope scope(r2engine::scripts()->profiler(), script_site(ssf_render));
 			m_render.Get(isolate)->Call(isolate->GetCurrentContext(), m_scriptState.Get(isolate), 0, NULL);
 		}
 
@@ -339,12 +350,28 @@ namespace r2 {
 
 		if (!m_handleEvent.IsEmpty() && !evt->is_internal_only()) {
 			auto param = Local<Value>::Cast(convert<event>::to_v8(isolate, *evt));
+			script_call_scope scope(r2engine::scripts()->profiler(), script_site(ssf_handleEvent));
 			m_handleEvent.Get(isolate)->Call(isolate->GetCurrentContext(), m_scriptState.Get(isolate), 1, &param);
 		}
 
 		deactivate_allocator(true);
 	}
 
+	static const char* state_script_function_names[ssf_count] = {
+		"willBecomeActive",
+		"becameActive",
+		"willBecomeInactive",
+		"becameInactive",
+		"willBeDestroyed",
+		"update",
+		"render",
+		"handleEvent"
+	};
+
+	script_call_site state::script_site(state_script_function func) {
+		return r2engine::scripts()->profiler()->site(m_scriptSites[func], "state", *m_name, state_script_function_names[func]);
+	}
+
 	void state::belowFrequencyWarning(f32 percentLessThanDesired, f32 desiredFreq, f32 timeSpentLowerThanDesired) {
 		r2Warn("State \"%s\" has been updating at %0.2f%% less than the desired frequency (%0.2f Hz) for more than %0.2f seconds", m_name->c_str(), percentLessThanDesired, desiredFreq, timeSpentLowerThanDesired);
 	}
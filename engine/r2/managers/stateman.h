@@ -15,6 +15,19 @@ namespace r2 {
     class asset;
 	class scene;
 
+	// Script functions of a state, in the order of state_script_function_names
+	enum state_script_function {
+		ssf_willBecomeActive = 0,
+		ssf_becameActive,
+		ssf_willBecomeInactive,
+		ssf_becameInactive,
+		ssf_willBeDestroyed,
+		ssf_update,
+		ssf_render,
+		ssf_handleEvent,
+		ssf_count
+	};
+
     class state : public event_receiver, public periodic_update {
         public:
             state(v8Args args);
@@ -65,6 +78,7 @@ namespace r2 {
 			virtual void belowFrequencyWarning(f32 percentLessThanDesired, f32 desiredFreq, f32 timeSpentLowerThanDesired);
 
 			void releaseResources();
+			script_call_site script_site(state_script_function func);
 
 
 			mvector<engine_state_data*>* m_engineData;
@@ -79,6 +93,7 @@ namespace r2 {
 			PersistentFunctionHandle m_update;
 			PersistentFunctionHandle m_render;
 			PersistentFunctionHandle m_handleEvent;
+			script_call_site m_scriptSites[ssf_count];
 
 			memory_allocator* m_memory;
 			size_t m_desiredMemorySize;
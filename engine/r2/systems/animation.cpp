@@ -2,6 +2,19 @@
 #include <r2/engine.h>
 
 namespace r2 {
+	transform_trs decompose_trs(const mat4f& transform) {
+		transform_trs t;
+		vec3f skew;
+		vec4f perspective;
+		if (!glm::decompose(transform, t.scale, t.rotation, t.translation, skew, perspective)) {
+			// degenerate (zero scale) transforms only keep their translation
+			t.translation = vec3f(transform[3]);
+			t.rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+			t.scale = vec3f(0.0f);
+		}
+		return t;
+	}
+
 	void animation_deserializer::register_track(const mstring& track, create_keyframe_func create_keyframe, create_track_func create_track) {
 		auto it = track_properties.find(track);
 		if (it != track_properties.end()) {
@@ -16,6 +29,32 @@ namespace r2 {
 		};
 	}
 
+	size_t animation_track_base::find_segment(f32 time) {
+		const f32* times = keyframe_times.data();
+		size_t count = keyframe_times.size();
+
+		// during playback the time is almost always in the last sampled segment or the one after it
+		size_t k = last_keyframe;
+		if (k + 1 < count && times[k] <= time) {
+			if (time < times[k + 1]) return k;
+			if (k + 2 < count && time < times[k + 2]) {
+				last_keyframe = k + 1;
+				return k + 1;
+			}
+		}
+
+		k = size_t(std::upper_bound(times, times + count, time) - times) - 1;
+		last_keyframe = k;
+		return k;
+	}
+
+	size_t animation_track_base::find_insert(f32 time, bool* exists) const {
+		// keyframes closer together than this are the same keyframe
+		auto it = std::lower_bound(keyframe_times.begin(), keyframe_times.end(), time - 0.0001f);
+		*exists = it != keyframe_times.end() && *it < time + 0.0001f;
+		return size_t(it - keyframe_times.begin());
+	}
+
 	animation_group::animation_group(const mstring& name, f32 duration, bool loops) {
 		m_name = name;
 		m_duration = duration;
@@ -69,16 +108,15 @@ namespace r2 {
 			u8 keyframe_value_size = track->value_size();
 			if (!out->write(keyframe_value_size)) return false;
 
-			if (!out->write_data(track->initial_value_data(), keyframe_value_size)) return false;
+			if (!out->write_data(track->peek_initial_value(), keyframe_value_size)) return false;
 
-			u16 keyframe_count = track->keyframes.size();
+			u16 keyframe_count = track->keyframe_count();
 			if (!out->write(keyframe_count)) return false;
 
-			for (auto it = track->keyframes.begin();it != track->keyframes.end();it++) {
-				keyframe_base* k = *it;
-				if (!out->write(k->time)) return false;
-				if (!out->write(k->interpolation_mode)) return false;
-				if (!out->write_data(k->data(), keyframe_value_size)) return false;
+			for (u16 k = 0;k < keyframe_count;k++) {
+				if (!out->write(track->keyframe_times[k])) return false;
+				if (!out->write(track->keyframes[k].interpolation_mode)) return false;
+				if (!out->write_data((const u8*)track->peek_keyframes() + (k * keyframe_value_size), keyframe_value_size)) return false;
 			}
 		}
 
@@ -149,6 +187,7 @@ namespace r2 {
 				m_tracks.clear();
 				return false;
 			}
+			track->reserve_keyframes(keyframe_count);
 
 			for (u16 kn = 0;kn < keyframe_count;kn++) {
 				if (!in->read(m_time)) {
@@ -167,7 +206,7 @@ namespace r2 {
 					m_tracks.clear();
 					return false;
 				}
-				keyframe_base* k = entity->create_keyframe(track_name, this, mode);
+				void* k = entity->create_keyframe(track_name, this, mode);
 				m_time = 0.0f;
 				if (!k) {
 					for (auto i = m_contiguous_tracks.begin();i != m_contiguous_tracks.end();i++) delete *i;
@@ -176,7 +215,7 @@ namespace r2 {
 					return false;
 				}
 
-				if (!r2engine::deserialize_entity_property(track_name, k->data(), in)) {
+				if (!r2engine::deserialize_entity_property(track_name, k, in)) {
 					for (auto i = m_contiguous_tracks.begin();i != m_contiguous_tracks.end();i++) delete *i;
 					m_contiguous_tracks.clear();
 					m_tracks.clear();
@@ -263,6 +302,7 @@ namespace r2 {
 				m_tracks.clear();
 				return false;
 			}
+			track->reserve_keyframes(keyframe_count);
 
 			for (u16 kn = 0;kn < keyframe_count;kn++) {
 				f32 time = 0.0f;
@@ -289,7 +329,7 @@ namespace r2 {
 					return false;
 				}
 
-				keyframe_base* k = ti.keyframe_func(track_name, time, value, track, mode);
+				void* k = ti.keyframe_func(track_name, time, value, track, mode);
 				delete [] value;
 				if (!k) {
 					for (auto i = m_contiguous_tracks.begin();i != m_contiguous_tracks.end();i++) delete *i;
@@ -350,7 +390,7 @@ namespace r2 {
 
 		for (auto i = m_contiguous_tracks.begin();i != m_contiguous_tracks.end();i++) {
 			animation_track_base* track = *i;
-			if (track->keyframes.size() > 0 && track->keyframes.back()->time >= duration - 0.0001f) {
+			if (track->keyframe_count() > 0 && track->keyframe_times.back() >= duration - 0.0001f) {
 				r2Warn("Can't decrease animation '%s' duration to %.2f, track '%s' contains keyframes beyond that time", m_name.c_str(), duration, track->name.c_str());
 				return false;
 			}
@@ -366,13 +406,20 @@ namespace r2 {
 	}
 
 	void animation_group::update(f32 dt, scene_entity* target) {
-		if ((!m_playing && !m_sync) || (m_sync && !m_sync->playing())) return;
+		f32 time = 0.0f;
+		if (!advance(dt, &time)) return;
+
+		for (auto i = m_contiguous_tracks.begin();i != m_contiguous_tracks.end();i++) {
+			(*i)->update(time, target);
+		}
+	}
+
+	bool animation_group::advance(f32 dt, f32* sample_time) {
+		if ((!m_playing && !m_sync) || (m_sync && !m_sync->playing())) return false;
 
 		if (m_sync) {
-			for (auto i = m_contiguous_tracks.begin();i != m_contiguous_tracks.end();i++) {
-				(*i)->update(m_sync->current_time(), target);
-			}
-			return;
+			*sample_time = m_sync->current_time();
+			return true;
 		}
 
 		m_time += dt;
@@ -382,14 +429,14 @@ namespace r2 {
 			m_time = m_duration;
 		}
 
-		for (auto i = m_contiguous_tracks.begin();i != m_contiguous_tracks.end();i++) {
-			(*i)->update(m_time, target);
-		}
+		*sample_time = m_time;
 
 		if (reached_end) {
 			m_time = 0.0f;
 			m_playing = m_loops;
 		}
+
+		return true;
 	}
 
 	void animation_group::set_time(f32 time) {
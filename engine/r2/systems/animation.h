@@ -3,6 +3,11 @@
 #include <glm/gtx/matrix_decompose.hpp>
 #include <glm/gtx/quaternion.hpp>
 
+// identifies clips written by animation_group::serialize_clip
+#define ANIMATION_CLIP_MAGIC 0x43413252
+#define ANIMATION_CLIP_VERSION 1
+#define ANIMATION_CLIP_DEFAULT_TOLERANCE 0.001f
+
 namespace r2 {
 	class scene_entity;
 	class data_container;
@@ -13,78 +18,180 @@ namespace r2 {
 		InterpolationFactorCallback from_enum(interpolation_transition_mode mode);
 	};
 
-	class keyframe_base {
-		public:
-			virtual ~keyframe_base() { };
-			virtual inline void* data() = 0;
-			f32 time;
-			void* user_data;
-			interpolate::InterpolationFactorCallback interpolation_factor_cb;
-			interpolate::interpolation_transition_mode interpolation_mode;
+	struct keyframe_info {
+		void* user_data;
+		interpolate::InterpolationFactorCallback interpolation_factor_cb;
+		interpolate::interpolation_transition_mode interpolation_mode;
 	};
 
-	template <typename T>
-	class keyframe : public keyframe_base {
-		public:
-			keyframe(const T& value, f32 time, interpolate::interpolation_transition_mode mode, void* user_data = nullptr) {
-				this->value = value;
-				this->time = time;
-				this->user_data = user_data;
-				interpolation_factor_cb = interpolate::from_enum(mode);
-				interpolation_mode = mode;
-			}
-			virtual ~keyframe() { }
-
-			virtual void* data() { return &value; }
-
-			T value;
+	// How keyframe values of a track are stored in animation clips
+	enum animation_key_format {
+		akf_raw = 0,
+		akf_float,
+		akf_transform
 	};
 
+	// Keyframes are kept in parallel arrays sorted by time, so sampling is a binary search over contiguous
+	// times, or a step from the last sampled keyframe during playback
 	class animation_track_base {
 		public:
+			animation_track_base() : user_data(nullptr), entity_property(false), last_keyframe(0), last_time(0.0f) { }
 			virtual ~animation_track_base() { }
 
 			virtual inline void* initial_value_data() = 0;
 			virtual inline size_t value_size() const = 0;
 
+			// Value of keyframe 'idx', valid until keyframes are added to the track
+			virtual inline void* keyframe_data(size_t idx) = 0;
+
+			// Read only views of the initial value and of every keyframe's value, one after another. Unlike the
+			// above, these leave the keyframe cache alone. peek_keyframes() is nullptr if there are no keyframes
+			virtual inline const void* peek_initial_value() const = 0;
+			virtual inline const void* peek_keyframes() const = 0;
+
+			virtual void reserve_keyframes(size_t count) = 0;
+
+			// Sets the number of keyframes without initializing new ones, for filling them in place
+			virtual void resize_keyframes(size_t count) = 0;
+
+			virtual animation_key_format key_format() const = 0;
+			virtual bool linear_interpolation() const = 0;
+
 			virtual void update(f32 time, scene_entity* target) = 0;
 
+			// Builds anything sampling would otherwise build on demand, so that sample() doesn't allocate
+			virtual void prepare_sample() = 0;
+
+			// Writes the value at 'time' to 'out', which must have room for value_size() bytes
+			virtual void sample(f32 time, void* out) = 0;
+
+			// Passes a value written by sample() to the track's setter
+			virtual void apply(const void* value, scene_entity* target) = 0;
+
+			inline size_t keyframe_count() const { return keyframe_times.size(); }
+
+			// Index of the last keyframe at or before 'time', which must be between the first and last keyframe times
+			size_t find_segment(f32 time);
+
+			// Index a keyframe at 'time' belongs at, 'exists' is set if there is already one there
+			size_t find_insert(f32 time, bool* exists) const;
+
 			mstring name;
 			void* user_data;
-			mlist<keyframe_base*> keyframes;
-			mlist<keyframe_base*>::iterator last_keyframe;
+
+			// Set when the track writes to an entity property, 'user_data' is then its animatable_property_data
+			bool entity_property;
+
+			mvector<f32> keyframe_times;
+			mvector<keyframe_info> keyframes;
+			size_t last_keyframe;
 			f32 last_time;
 	};
 
+	// A transform split into the parts that interpolate independently
+	struct transform_trs {
+		vec3f translation;
+		glm::quat rotation;
+		vec3f scale;
+	};
+
+	transform_trs decompose_trs(const mat4f& transform);
+
+	inline mat4f compose_trs(const transform_trs& t) {
+		mat4f o = glm::toMat4(t.rotation);
+		o[0] *= t.scale.x;
+		o[1] *= t.scale.y;
+		o[2] *= t.scale.z;
+		o[3] = vec4f(t.translation, 1.0f);
+		return o;
+	}
+
+	inline transform_trs mix_trs(const transform_trs& a, const transform_trs& b, f32 w) {
+		return {
+			a.translation + ((b.translation - a.translation) * w),
+			glm::slerp(a.rotation, b.rotation, w),
+			a.scale + ((b.scale - a.scale) * w)
+		};
+	}
+
+	// These aren't static so that tracks can tell whether they were given the default, see keyframe_cache<mat4f>
 	template <typename T>
-	static inline typename std::enable_if<!std::is_same<T, mat4f>::value, T>::type default_interpolator(const T& a, const T& b, f32 w) {
+	inline typename std::enable_if<!std::is_same<T, mat4f>::value, T>::type default_interpolator(const T& a, const T& b, f32 w) {
 		return a + ((b - a) * w);
 	}
 
 	template <typename T>
-	static inline typename std::enable_if<std::is_same<T, mat4f>::value, mat4f>::type default_interpolator(const T& a, const T& b, f32 w) {
-		vec3f t_a, s_a, sk_a;
-		vec4f p_a;
-		glm::quat r_a;
-		glm::decompose(a, s_a, r_a, t_a, sk_a, p_a);
-
-		vec3f t_b, s_b, sk_b;
-		vec4f p_b;
-		glm::quat r_b;
-		glm::decompose(b, s_b, r_b, t_b, sk_b, p_b);
-
-		
-		vec3f t_r = t_a + ((t_b - t_a) * w);
-		vec3f s_r = s_a + ((s_b - s_a) * w);
-		glm::quat r_r = glm::slerp(r_a, r_b, w);
-
-		mat4f o = mat4f(1.0f);
-		o = glm::translate(o, t_r);
-		o = glm::scale(o, s_r);
-		o *= glm::toMat4(r_r);
-		return o;
+	inline typename std::enable_if<std::is_same<T, mat4f>::value, mat4f>::type default_interpolator(const T& a, const T& b, f32 w) {
+		return compose_trs(mix_trs(decompose_trs(a), decompose_trs(b), w));
 	}
 
+	// Tracks of f32 based values are quantized in clips, mat4 tracks are stored as TRS parts. 'linear' tells whether
+	// linear keyframes of a track are sampled with a plain lerp, which clips rely on to drop redundant keyframes
+	template <typename T>
+	struct keyframe_format {
+		static const animation_key_format format = akf_raw;
+		static inline bool linear(T (*interpolator)(const T&, const T&, float)) { return false; }
+	};
+
+	template <typename T, animation_key_format F>
+	struct interpolated_keyframe_format {
+		static const animation_key_format format = F;
+		static inline bool linear(T (*interpolator)(const T&, const T&, float)) {
+			return interpolator == (T (*)(const T&, const T&, float))default_interpolator<T>;
+		}
+	};
+
+	template <> struct keyframe_format<f32> : interpolated_keyframe_format<f32, akf_float> { };
+	template <> struct keyframe_format<vec2f> : interpolated_keyframe_format<vec2f, akf_float> { };
+	template <> struct keyframe_format<vec3f> : interpolated_keyframe_format<vec3f, akf_float> { };
+	template <> struct keyframe_format<vec4f> : interpolated_keyframe_format<vec4f, akf_float> { };
+	template <> struct keyframe_format<mat4f> : interpolated_keyframe_format<mat4f, akf_transform> { };
+
+	// Data an animation track derives from its keyframes to sample them faster. It's rebuilt on the next
+	// sample after the keyframes or initial value change
+	template <typename T>
+	struct keyframe_cache {
+		typedef T (*interpolator_callback)(const T&, const T&, float);
+
+		inline void invalidate() { }
+
+		inline void prepare(const T& initial, const mvector<T>& values) { }
+
+		// 'a' is SIZE_MAX for the initial value
+		inline T interpolate(interpolator_callback interpolator, const T& initial, const mvector<T>& values, size_t a, size_t b, f32 w) {
+			return interpolator(a == SIZE_MAX ? initial : values[a], values[b], w);
+		}
+	};
+
+	// Transform tracks using the default interpolator keep their keyframes decomposed, so that sampling
+	// doesn't decompose two matrices every time
+	template <>
+	struct keyframe_cache<mat4f> {
+		typedef mat4f (*interpolator_callback)(const mat4f&, const mat4f&, float);
+
+		keyframe_cache() : valid(false) { }
+
+		inline void invalidate() { valid = false; }
+
+		inline void prepare(const mat4f& initial_value, const mvector<mat4f>& values) {
+			if (valid) return;
+			initial = decompose_trs(initial_value);
+			keys.resize(values.size());
+			for (size_t i = 0;i < values.size();i++) keys[i] = decompose_trs(values[i]);
+			valid = true;
+		}
+
+		inline mat4f interpolate(interpolator_callback interpolator, const mat4f& initial_value, const mvector<mat4f>& values, size_t a, size_t b, f32 w) {
+			if (interpolator != (interpolator_callback)default_interpolator<mat4f>) return interpolator(a == SIZE_MAX ? initial_value : values[a], values[b], w);
+			prepare(initial_value, values);
+			return compose_trs(mix_trs(a == SIZE_MAX ? initial : keys[a], keys[b], w));
+		}
+
+		bool valid;
+		transform_trs initial;
+		mvector<transform_trs> keys;
+	};
+
 	template <typename T>
 	class animation_track : public animation_track_base {
 		public:
@@ -96,125 +203,111 @@ namespace r2 {
 				this->interpolator = interpolator;
 				this->user_data = user_data;
 				this->initial_value = initial_value;
-				last_keyframe = keyframes.end();
-				last_time = 0.0f;
 				set_value = set;
 			}
 
-			virtual ~animation_track() {
-				for (auto i = keyframes.begin();i != keyframes.end();i++) {
-					keyframe<T>* kf = (keyframe<T>*)*i;
-					delete kf;
-				}
-			}
+			virtual ~animation_track() { }
 
-			virtual inline void* initial_value_data() { return &initial_value; }
+			// the values may be written through these, so the keyframe cache is rebuilt
+			virtual inline void* initial_value_data() {
+				cache.invalidate();
+				return &initial_value;
+			}
 
 			virtual inline size_t value_size() const { return sizeof(T); }
 
+			virtual inline void* keyframe_data(size_t idx) {
+				cache.invalidate();
+				return &keyframe_values[idx];
+			}
+
+			virtual inline const void* peek_initial_value() const { return &initial_value; }
+			virtual inline const void* peek_keyframes() const { return keyframe_values.size() > 0 ? keyframe_values.data() : nullptr; }
+
+			virtual void reserve_keyframes(size_t count) {
+				keyframe_times.reserve(count);
+				keyframes.reserve(count);
+				keyframe_values.reserve(count);
+			}
+
+			virtual void resize_keyframes(size_t count) {
+				keyframe_times.resize(count);
+				keyframes.resize(count);
+				keyframe_values.resize(count);
+				last_keyframe = 0;
+				cache.invalidate();
+			}
+
+			virtual animation_key_format key_format() const { return keyframe_format<T>::format; }
+
+			virtual bool linear_interpolation() const { return keyframe_format<T>::linear(interpolator); }
+
 			inline T get(f32 time) {
-				if (!interpolator || keyframes.size() == 0) return initial_value;
-
-				auto start_forward_search = keyframes.begin();
-				if (last_keyframe != keyframes.end()) {
-					if (time > (*last_keyframe)->time) {
-						// iterate forward normally, starting
-						// from last used keyframe
-						start_forward_search = last_keyframe;
-					} else {
-						// iterate backward, starting from
-						// last used keyframe
-
-						for (auto i = last_keyframe;i != keyframes.begin();i--) {
-							keyframe<T>* f = (keyframe<T>*)*i;
-							auto p = std::prev(i);
-							keyframe<T>* pf = (keyframe<T>*)*p;
-							if (f->time >= time && pf->time <= time) {
-								last_keyframe = i;
-								last_time = time;
-								return interpolator(pf->value, f->value, f->interpolation_factor_cb((time - pf->time) / (f->time - pf->time)));
-							}
-						}
-
-						last_keyframe = keyframes.end();
-						last_time = time;
-						keyframe<T>* f = (keyframe<T>*)keyframes.front();
-						if (f->time == 0.0f) {
-							auto n = std::next(keyframes.begin());
-							if (n != keyframes.end()) {
-								return interpolator(f->value, ((keyframe<T>*)*n)->value, (*n)->interpolation_factor_cb(time / (*n)->time));
-							} else return f->value;
-						}
-						return interpolator(initial_value, f->value, f->interpolation_factor_cb(time / f->time));
-					}
-				}
+				size_t count = keyframe_times.size();
+				if (!interpolator || count == 0) return initial_value;
+				last_time = time;
 
-				if (keyframes.front()->time >= time) {
-					last_keyframe = keyframes.end();
-					last_time = time;
-					keyframe<T>* f = (keyframe<T>*)keyframes.front();
-					return interpolator(initial_value, f->value, f->interpolation_factor_cb(time / f->time));
+				const f32* times = keyframe_times.data();
+				if (time <= times[0]) {
+					// the track moves from its initial value to the first keyframe
+					if (times[0] <= 0.0f) return keyframe_values[0];
+					return cache.interpolate(interpolator, initial_value, keyframe_values, SIZE_MAX, 0, keyframes[0].interpolation_factor_cb(time / times[0]));
 				}
 
-				for (auto i = start_forward_search;i != keyframes.end();i++) {
-					keyframe<T>* f = (keyframe<T>*)*i;
-					auto n = std::next(i);
-					if (f->time <= time) {
-						if (n == keyframes.end()) {
-							last_keyframe = i;
-							last_time = time;
-							return f->value;
-						}
-						else {
-							keyframe<T>* nf = (keyframe<T>*)*n;
-							if (nf->time >= time) {
-								last_keyframe = i;
-								last_time = time;
-								return interpolator(f->value, nf->value, nf->interpolation_factor_cb((time - f->time) / (nf->time - f->time)));
-							}
-						}
-					}
-				}
+				if (time >= times[count - 1]) return keyframe_values[count - 1];
 
-				// this should never be reached
-				last_keyframe = keyframes.end();
-				last_time = time;
-				return initial_value;
+				size_t k = find_segment(time);
+				return cache.interpolate(interpolator, initial_value, keyframe_values, k, k + 1, keyframes[k + 1].interpolation_factor_cb((time - times[k]) / (times[k + 1] - times[k])));
 			}
 
-			inline keyframe_base* set(const T& value, float time, interpolate::interpolation_transition_mode mode, void* user_pointer = nullptr) {
-				for (auto i = keyframes.begin();i != keyframes.end();i++) {
-					keyframe<T>* kf = (keyframe<T>*)*i;
-					if (kf->time > time + 0.0001f) {
-						keyframe<T>* f = new keyframe<T>(value, time, mode, user_data);
-						keyframes.insert(i, f);
-						return f;
-					} else if (kf->time < time + 0.0001f && kf->time > time - 0.0001f) {
-						kf->user_data = user_pointer;
-						kf->value = value;
-						kf->interpolation_factor_cb = interpolate::from_enum(mode);
-						kf->interpolation_mode = mode;
-						return kf;
-					}
+			// Returns the index of the keyframe, replacing any keyframe already at 'time'
+			inline size_t set(const T& value, float time, interpolate::interpolation_transition_mode mode, void* user_pointer = nullptr) {
+				bool exists = false;
+				size_t idx = find_insert(time, &exists);
+				keyframe_info info = { user_pointer, interpolate::from_enum(mode), mode };
+				cache.invalidate();
+
+				if (exists) {
+					keyframes[idx] = info;
+					keyframe_values[idx] = value;
+					return idx;
 				}
 
-				keyframe<T>* f = new keyframe<T>(value, time, mode, user_data);
-				keyframes.push_back(f);
-				return f;
+				keyframe_times.insert(keyframe_times.begin() + idx, time);
+				keyframes.insert(keyframes.begin() + idx, info);
+				keyframe_values.insert(keyframe_values.begin() + idx, value);
+				return idx;
 			}
 
 			virtual void update(f32 time, scene_entity* target) {
 				set_value(get(time), target, user_data);
 			}
 
+			virtual void prepare_sample() {
+				cache.prepare(initial_value, keyframe_values);
+			}
+
+			virtual void sample(f32 time, void* out) {
+				*(T*)out = get(time);
+			}
+
+			virtual void apply(const void* value, scene_entity* target) {
+				set_value(*(const T*)value, target, user_data);
+			}
+
 			interpolator_callback interpolator;
 			T initial_value;
 			value_setter set_value;
+			mvector<T> keyframe_values;
+
+			// must be invalidated after writing to initial_value or keyframe_values directly
+			keyframe_cache<T> cache;
 	};
 
 	class animation_deserializer {
 		public:
-			typedef keyframe_base* (*create_keyframe_func)(const mstring& /*track_name*/, f32 /*time*/, void* /*value_data*/, animation_track_base* /*dest_track*/, interpolate::interpolation_transition_mode /*transition_mode*/);
+			// returns the new keyframe's value, or null if it couldn't be created
+			typedef void* (*create_keyframe_func)(const mstring& /*track_name*/, f32 /*time*/, void* /*value_data*/, animation_track_base* /*dest_track*/, interpolate::interpolation_transition_mode /*transition_mode*/);
 			typedef animation_track_base* (*create_track_func)(const mstring& /*track_name*/, void* /*initial_value_data*/);
 
 			void register_track(const mstring& track, create_keyframe_func create_keyframe, create_track_func create_track);
@@ -241,6 +334,13 @@ namespace r2 {
 			bool deserialize(data_container* in, scene_entity* entity);
 			bool deserialize(data_container* in, const animation_deserializer& deserializer);
 
+			// Compact binary clips. Float keys are quantized to 16 bits and linear keys that can be interpolated from
+			// their neighbors are dropped, both only as far as 'tolerance' allows. Reading decodes straight from the
+			// container's memory into the tracks
+			bool serialize_clip(data_container* out, f32 tolerance = ANIMATION_CLIP_DEFAULT_TOLERANCE);
+			bool deserialize_clip(data_container* in, scene_entity* entity);
+			bool deserialize_clip(data_container* in, const animation_deserializer& deserializer);
+
 			template <typename T>
 			inline animation_track_base* add_track(const mstring& name, const T& initial_value, typename animation_track<T>::value_setter set_value, typename animation_track<T>::interpolator_callback interpolator = default_interpolator<T>, void* user_data = nullptr) {
 				animation_track<T>* track = new animation_track<T>(name, initial_value, set_value, interpolator, user_data);
@@ -299,6 +399,10 @@ namespace r2 {
 
 			void update(f32 dt, scene_entity* target);
 
+			// Moves the animation forward by 'dt' without updating its tracks. Returns false if it isn't playing,
+			// otherwise 'sample_time' is set to the time the tracks should be sampled at
+			bool advance(f32 dt, f32* sample_time);
+
 			void set_time(f32 time);
 
 			void reset();
@@ -309,6 +413,11 @@ namespace r2 {
 
 		protected:
 			friend class animation_sync;
+
+			// Creates the track named 'name' while reading a clip, 'initial_value' is the raw initial value
+			typedef animation_track_base* (*clip_track_creator)(animation_group* group, const mstring& name, const void* initial_value, const void* context);
+			bool read_clip(data_container* in, clip_track_creator create_track, const void* context);
+
 			mstring m_name;
 			f32 m_duration;
 			f32 m_time;
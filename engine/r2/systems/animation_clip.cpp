@@ -0,0 +1,450 @@
+#include <r2/systems/animation.h>
+#include <r2/engine.h>
+
+namespace r2 {
+	// Every block of a clip starts 4 byte aligned. Offsets are from the start of the header
+	struct clip_header {
+		u32 magic;
+		u16 version;
+		u16 trackCount;
+		u32 size;
+		f32 duration;
+		u8 loops;
+		u8 nameLength;
+		u16 padding;
+	};
+
+	// Followed by the group's name, then the track table, then the track names
+	struct clip_track_entry {
+		u32 nameOffset;
+		u32 dataOffset;
+		u32 dataSize;
+		u16 keyCount;
+		u8 nameLength;
+		u8 format;
+		u8 valueSize;
+		u8 quantized;
+		u16 padding;
+	};
+
+	// Track data is the keyframe times (f32), the interpolation modes (u8), the initial value and then the values:
+	// akf_raw:       each value as it is
+	// akf_float:     quantized: f32 min and step per component, then u16 per component per key. Otherwise f32s
+	// akf_transform: quantized: f32 min and step for translation and scale, then u16 translations, i16 rotations, u16 scales.
+	//                Otherwise f32 translations, i16 rotations, f32 scales. Rotations are quaternions scaled to 32767
+
+	static inline void align_clip(mvector<u8>& clip) {
+		while (clip.size() % 4 != 0) clip.push_back(0);
+	}
+
+	template <typename T>
+	static inline void append(mvector<u8>& clip, const T* values, size_t count) {
+		const u8* bytes = (const u8*)values;
+		clip.insert(clip.end(), bytes, bytes + sizeof(T) * count);
+	}
+
+	template <typename T>
+	static inline void append(mvector<u8>& clip, const T& value) {
+		append(clip, &value, 1);
+	}
+
+	// Bounds checked reads straight out of the clip's memory
+	struct clip_reader {
+		const u8* data;
+		size_t size;
+		size_t offset;
+		bool failed;
+
+		const u8* take(size_t bytes) {
+			if (failed || offset + bytes > size) {
+				failed = true;
+				return nullptr;
+			}
+
+			const u8* ptr = data + offset;
+			offset += bytes;
+			return ptr;
+		}
+
+		template <typename T>
+		bool read(T* out, size_t count = 1) {
+			const u8* ptr = take(sizeof(T) * count);
+			if (!ptr) return false;
+			memcpy(out, ptr, sizeof(T) * count);
+			return true;
+		}
+
+		void align() {
+			offset = (offset + 3) & ~size_t(3);
+		}
+	};
+
+	static inline glm::quat aligned_rotation(const glm::quat& reference, const glm::quat& q) {
+		return glm::dot(reference, q) < 0.0f ? -q : q;
+	}
+
+	static f32 trs_error(const transform_trs& a, const transform_trs& b) {
+		glm::quat rb = aligned_rotation(a.rotation, b.rotation);
+		f32 error = 0.0f;
+		for (u8 c = 0;c < 3;c++) {
+			error = max(error, fabsf(a.translation[c] - b.translation[c]));
+			error = max(error, fabsf(a.scale[c] - b.scale[c]));
+		}
+		for (u8 c = 0;c < 4;c++) error = max(error, fabsf(a.rotation[c] - rb[c]));
+		return error;
+	}
+
+	// Indices of the keyframes worth keeping. A keyframe is dropped when it and the one after it are linear, and
+	// every keyframe dropped since the last kept one is within 'tolerance' of the line that would replace them
+	static mvector<u16> reduce_keys(animation_track_base* track, f32 tolerance, const mvector<transform_trs>& trs) {
+		size_t count = track->keyframe_count();
+		mvector<u16> kept;
+		if (count == 0) return kept;
+
+		kept.push_back(0);
+		if (!track->linear_interpolation()) {
+			for (size_t k = 1;k < count;k++) kept.push_back(u16(k));
+			return kept;
+		}
+
+		const f32* times = track->keyframe_times.data();
+		const f32* values = (const f32*)track->peek_keyframes();
+		size_t components = track->value_size() / sizeof(f32);
+		bool transform = track->key_format() == akf_transform;
+
+		for (size_t k = 1;k + 1 < count;k++) {
+			size_t p = kept.back();
+			size_t n = k + 1;
+			bool removable = track->keyframes[k].interpolation_mode == interpolate::itm_linear && track->keyframes[n].interpolation_mode == interpolate::itm_linear;
+
+			for (size_t j = p + 1;removable && j <= k;j++) {
+				f32 w = (times[j] - times[p]) / (times[n] - times[p]);
+				if (transform) removable = trs_error(mix_trs(trs[p], trs[n], w), trs[j]) <= tolerance;
+				else {
+					for (size_t c = 0;removable && c < components;c++) {
+						f32 a = values[p * components + c];
+						f32 b = values[n * components + c];
+						removable = fabsf(a + ((b - a) * w) - values[j * components + c]) <= tolerance;
+					}
+				}
+			}
+
+			if (!removable) kept.push_back(u16(k));
+		}
+
+		if (count > 1) kept.push_back(u16(count - 1));
+		return kept;
+	}
+
+	// Range of 'count' values 'stride' floats apart, quantized when the rounding error is within 'tolerance'
+	struct quantized_range {
+		f32 min;
+		f32 step;
+	};
+
+	static bool quantize_range(const mvector<f32>& values, size_t components, f32 tolerance, quantized_range* ranges) {
+		bool quantized = true;
+		size_t count = values.size() / components;
+		for (size_t c = 0;c < components;c++) {
+			f32 lo = values[c], hi = values[c];
+			for (size_t k = 1;k < count;k++) {
+				lo = min(lo, values[k * components + c]);
+				hi = max(hi, values[k * components + c]);
+			}
+
+			ranges[c] = { lo, (hi - lo) / 65535.0f };
+			if (ranges[c].step * 0.5f > tolerance) quantized = false;
+		}
+		return quantized;
+	}
+
+	static void append_values(mvector<u8>& clip, const mvector<f32>& values, size_t components, const quantized_range* ranges, bool quantized) {
+		if (!quantized) {
+			append(clip, values.data(), values.size());
+			return;
+		}
+
+		for (size_t i = 0;i < values.size();i++) {
+			const quantized_range& r = ranges[i % components];
+			u16 q = r.step > 0.0f ? u16(roundf((values[i] - r.min) / r.step)) : 0;
+			append(clip, q);
+		}
+	}
+
+	static bool read_values(clip_reader& in, f32* out, size_t count, size_t components, size_t stride, const quantized_range* ranges, bool quantized) {
+		for (size_t k = 0;k < count;k++) {
+			for (size_t c = 0;c < components;c++) {
+				f32 v = 0.0f;
+				if (quantized) {
+					u16 q = 0;
+					if (!in.read(&q)) return false;
+					v = ranges[c].min + (f32(q) * ranges[c].step);
+				} else if (!in.read(&v)) return false;
+				out[k * stride + c] = v;
+			}
+		}
+		return true;
+	}
+
+	static void write_track(animation_track_base* track, f32 tolerance, mvector<u8>& clip, clip_track_entry& entry) {
+		animation_key_format format = track->key_format();
+		size_t valueSize = track->value_size();
+
+		// keyframes are read through peek_keyframes, so that writing a clip doesn't throw away the track's cache
+		size_t count = track->keyframe_count();
+		const u8* keyValues = (const u8*)track->peek_keyframes();
+
+		mvector<transform_trs> trs;
+		if (format == akf_transform && count > 0) {
+			const mat4f* matrices = (const mat4f*)keyValues;
+			for (size_t k = 0;k < count;k++) trs.push_back(decompose_trs(matrices[k]));
+		}
+
+		mvector<u16> kept = format == akf_raw ? mvector<u16>() : reduce_keys(track, tolerance, trs);
+		if (format == akf_raw) {
+			for (size_t k = 0;k < count;k++) kept.push_back(u16(k));
+		}
+
+		entry.keyCount = u16(kept.size());
+		entry.format = u8(format);
+		entry.valueSize = u8(valueSize);
+		entry.quantized = 0;
+
+		for (u16 k : kept) append(clip, track->keyframe_times[k]);
+		for (u16 k : kept) append(clip, u8(track->keyframes[k].interpolation_mode));
+		align_clip(clip);
+
+		append(clip, (const u8*)track->peek_initial_value(), valueSize);
+		align_clip(clip);
+
+		if (format == akf_raw) {
+			for (u16 k : kept) append(clip, keyValues + (k * valueSize), valueSize);
+		} else if (format == akf_float) {
+			size_t components = valueSize / sizeof(f32);
+			mvector<f32> values;
+			if (count > 0) {
+				const f32* source = (const f32*)keyValues;
+				for (u16 k : kept) values.insert(values.end(), source + k * components, source + (k + 1) * components);
+			}
+
+			quantized_range ranges[4];
+			bool quantized = values.size() > 0 && quantize_range(values, components, tolerance, ranges);
+			entry.quantized = quantized ? 1 : 0;
+			if (quantized) append(clip, ranges, components);
+			append_values(clip, values, components, ranges, quantized);
+		} else {
+			mvector<f32> translations, scales;
+			for (u16 k : kept) {
+				for (u8 c = 0;c < 3;c++) {
+					translations.push_back(trs[k].translation[c]);
+					scales.push_back(trs[k].scale[c]);
+				}
+			}
+
+			quantized_range t[3], s[3];
+			bool quantized = kept.size() > 0 && quantize_range(translations, 3, tolerance, t);
+			quantized = quantized && quantize_range(scales, 3, tolerance, s);
+			entry.quantized = quantized ? 1 : 0;
+			if (quantized) {
+				append(clip, t, 3);
+				append(clip, s, 3);
+			}
+
+			append_values(clip, translations, 3, t, quantized);
+			align_clip(clip);
+			for (u16 k : kept) {
+				glm::quat r = glm::normalize(trs[k].rotation);
+				for (u8 c = 0;c < 4;c++) append(clip, i16(roundf(glm::clamp(r[c], -1.0f, 1.0f) * 32767.0f)));
+			}
+			append_values(clip, scales, 3, s, quantized);
+		}
+
+		align_clip(clip);
+	}
+
+	static bool read_track(clip_reader& in, const clip_track_entry& entry, animation_track_base* track) {
+		size_t count = entry.keyCount;
+		track->resize_keyframes(count);
+
+		if (count > 0 && !in.read(track->keyframe_times.data(), count)) return false;
+		for (size_t k = 0;k < count;k++) {
+			u8 mode = 0;
+			if (!in.read(&mode)) return false;
+			interpolate::interpolation_transition_mode m = (interpolate::interpolation_transition_mode)mode;
+			track->keyframes[k] = { nullptr, interpolate::from_enum(m), m };
+		}
+		in.align();
+
+		if (!in.read((u8*)track->initial_value_data(), entry.valueSize)) return false;
+		in.align();
+
+		if (count == 0) return true;
+
+		if (entry.format == akf_raw) return in.read((u8*)track->keyframe_data(0), entry.valueSize * count);
+
+		if (entry.format == akf_float) {
+			size_t components = entry.valueSize / sizeof(f32);
+			quantized_range ranges[4];
+			if (entry.quantized && !in.read(ranges, components)) return false;
+			return read_values(in, (f32*)track->keyframe_data(0), count, components, components, ranges, entry.quantized != 0);
+		}
+
+		quantized_range t[3], s[3];
+		if (entry.quantized && (!in.read(t, 3) || !in.read(s, 3))) return false;
+
+		// the parts are decoded into the output matrices' storage, then composed in place
+		mat4f* matrices = (mat4f*)track->keyframe_data(0);
+		f32* parts = (f32*)matrices;
+		if (!read_values(in, parts, count, 3, 16, t, entry.quantized != 0)) return false;
+		in.align();
+		for (size_t k = 0;k < count;k++) {
+			i16 r[4];
+			if (!in.read(r, 4)) return false;
+			for (u8 c = 0;c < 4;c++) parts[k * 16 + 3 + c] = f32(r[c]) / 32767.0f;
+		}
+		if (!read_values(in, parts + 7, count, 3, 16, s, entry.quantized != 0)) return false;
+
+		for (size_t k = 0;k < count;k++) {
+			const f32* p = parts + k * 16;
+			transform_trs trs;
+			trs.translation = vec3f(p[0], p[1], p[2]);
+			trs.rotation = glm::normalize(glm::quat(p[6], p[3], p[4], p[5]));
+			trs.scale = vec3f(p[7], p[8], p[9]);
+			matrices[k] = compose_trs(trs);
+		}
+
+		return true;
+	}
+
+	bool animation_group::serialize_clip(data_container* out, f32 tolerance) {
+		if (m_contiguous_tracks.size() > UINT16_MAX || m_name.length() > UINT8_MAX) {
+			r2Error("Animation '%s' has too many tracks or too long a name to be written as a clip", m_name.c_str());
+			return false;
+		}
+
+		mvector<u8> clip;
+		clip_header header = { ANIMATION_CLIP_MAGIC, ANIMATION_CLIP_VERSION, u16(m_contiguous_tracks.size()), 0, m_duration, u8(m_loops ? 1 : 0), u8(m_name.length()), 0 };
+		append(clip, header);
+		append(clip, m_name.data(), m_name.length());
+		align_clip(clip);
+
+		size_t tableOffset = clip.size();
+		mvector<clip_track_entry> entries(m_contiguous_tracks.size());
+		clip.resize(clip.size() + sizeof(clip_track_entry) * entries.size());
+
+		for (size_t t = 0;t < m_contiguous_tracks.size();t++) {
+			animation_track_base* track = m_contiguous_tracks[t];
+			if (track->name.length() > UINT8_MAX || track->value_size() > UINT8_MAX || track->keyframe_count() > UINT16_MAX) {
+				r2Error("Track '%s' of animation '%s' can't be written as part of a clip", track->name.c_str(), m_name.c_str());
+				return false;
+			}
+
+			entries[t] = { u32(clip.size()), 0, 0, 0, u8(track->name.length()), 0, 0, 0, 0 };
+			append(clip, track->name.data(), track->name.length());
+		}
+		align_clip(clip);
+
+		for (size_t t = 0;t < m_contiguous_tracks.size();t++) {
+			entries[t].dataOffset = u32(clip.size());
+			write_track(m_contiguous_tracks[t], tolerance, clip, entries[t]);
+			entries[t].dataSize = u32(clip.size()) - entries[t].dataOffset;
+		}
+
+		if (entries.size() > 0) memcpy(&clip[tableOffset], entries.data(), sizeof(clip_track_entry) * entries.size());
+		header.size = u32(clip.size());
+		memcpy(clip.data(), &header, sizeof(clip_header));
+
+		return out->write_data(clip.data(), u32(clip.size()));
+	}
+
+	bool animation_group::deserialize_clip(data_container* in, scene_entity* entity) {
+		return read_clip(in, [](animation_group* group, const mstring& name, const void* initial_value, const void* context) {
+			return ((scene_entity*)context)->animate_prop(name, group);
+		}, entity);
+	}
+
+	bool animation_group::deserialize_clip(data_container* in, const animation_deserializer& deserializer) {
+		return read_clip(in, [](animation_group* group, const mstring& name, const void* initial_value, const void* context) {
+			const animation_deserializer* deserializer = (const animation_deserializer*)context;
+			auto it = deserializer->track_properties.find(name);
+			if (it == deserializer->track_properties.end()) return (animation_track_base*)nullptr;
+
+			animation_track_base* track = it->second.track_func(name, (void*)initial_value);
+			if (track && group->track(name) != track) {
+				group->m_tracks[name] = track;
+				group->m_contiguous_tracks.push_back(track);
+			}
+			return track;
+		}, &deserializer);
+	}
+
+	bool animation_group::read_clip(data_container* in, clip_track_creator create_track, const void* context) {
+		clip_reader reader = { (const u8*)in->data(), size_t(in->size() - in->position()), 0, false };
+
+		clip_header header;
+		if (!reader.read(&header) || header.magic != ANIMATION_CLIP_MAGIC || header.version != ANIMATION_CLIP_VERSION || header.size > reader.size) {
+			r2Error("%s does not contain a valid animation clip", in->name().c_str());
+			return false;
+		}
+		reader.size = header.size;
+
+		const u8* name = reader.take(header.nameLength);
+		reader.align();
+		if (!name) return false;
+
+		auto destroy_tracks = [this]() {
+			for (auto i = m_contiguous_tracks.begin();i != m_contiguous_tracks.end();i++) delete *i;
+			m_contiguous_tracks.clear();
+			m_tracks.clear();
+			return false;
+		};
+
+		mvector<clip_track_entry> entries(header.trackCount);
+		if (header.trackCount > 0 && !reader.read(entries.data(), entries.size())) {
+			r2Error("The track table of animation clip %s is truncated", in->name().c_str());
+			return false;
+		}
+
+		m_name = mstring((const char*)name, header.nameLength);
+		m_duration = header.duration;
+		m_loops = header.loops != 0;
+
+		for (const clip_track_entry& entry : entries) {
+			clip_reader names = reader;
+			names.offset = entry.nameOffset;
+			const u8* trackName = names.take(entry.nameLength);
+			if (!trackName) return destroy_tracks();
+			mstring track_name = mstring((const char*)trackName, entry.nameLength);
+
+			clip_reader data = reader;
+			data.offset = entry.dataOffset;
+			data.size = min(size_t(entry.dataOffset) + entry.dataSize, reader.size);
+
+			// the initial value follows the times and modes
+			clip_reader initial = data;
+			initial.take(entry.keyCount * (sizeof(f32) + sizeof(u8)));
+			initial.align();
+			const u8* initialValue = initial.take(entry.valueSize);
+			if (!initialValue) {
+				r2Error("Track '%s' of animation clip %s is truncated", track_name.c_str(), in->name().c_str());
+				return destroy_tracks();
+			}
+
+			animation_track_base* track = create_track(this, track_name, initialValue, context);
+			if (!track) return destroy_tracks();
+
+			if (track->key_format() != entry.format || track->value_size() != entry.valueSize) {
+				r2Error("Track '%s' of animation clip %s doesn't match the type of the property it animates", track_name.c_str(), in->name().c_str());
+				return destroy_tracks();
+			}
+
+			if (!read_track(data, entry, track)) {
+				r2Error("Track '%s' of animation clip %s is truncated", track_name.c_str(), in->name().c_str());
+				return destroy_tracks();
+			}
+		}
+
+		in->seek(i32(header.size));
+		return true;
+	}
+};
@@ -1,7 +1,14 @@
 #include <r2/systems/animation_sys.h>
 #include <r2/engine.h>
 
+#include <marl/waitgroup.h>
+
 namespace r2 {
+	// track values are aligned so that any of them can be written in place
+	static inline size_t sample_stride(size_t value_size) {
+		return (value_size + 15) & ~size_t(15);
+	}
+
 	animation_component::animation_component() {
 	}
 
@@ -154,21 +161,110 @@ namespace r2 {
 		for (auto s = m_syncs.begin();s != m_syncs.end();s++) {
 			(*s)->update(updateDelta);
 		}
-		
+
 		auto& state = this->state();
 		state.enable();
-		state->for_each<animation_component>([updateDelta](animation_component* comp) {
+
+		// The buffers outlive the state, and are filled in before sampling so that the workers don't allocate
+		memory_man::push_current(memory_man::global());
+		m_sampled.clear();
+		size_t sampleSize = 0;
+		state->for_each<animation_component>([this, updateDelta, &sampleSize](animation_component* comp) {
 			scene_entity* target = comp->entity();
-			comp->animations.for_each([target, updateDelta](animation_group** anim) {
-				(*anim)->update(updateDelta, target);
+			comp->animations.for_each([this, target, updateDelta, &sampleSize](animation_group** anim) {
+				animation_group* group = *anim;
+				f32 time = 0.0f;
+				if (!group->advance(updateDelta, &time)) return true;
+
+				m_sampled.push_back({ group, target, time, sampleSize });
+				for (size_t t = 0;t < group->track_count();t++) {
+					animation_track_base* track = group->track(t);
+					track->prepare_sample();
+					sampleSize += sample_stride(track->value_size());
+				}
 				return true;
 			});
 
 			return true;
 		});
+		if (m_samples.size() < sampleSize) m_samples.resize(sampleSize);
+		memory_man::pop_current();
+
+		sample_animations();
+		apply_samples();
 		state.disable();
 	}
 
+	void animation_sys::sample_animations() {
+		auto sample = [this](size_t begin, size_t end) {
+			for (size_t i = begin;i < end;i++) {
+				const animation_sample& s = m_sampled[i];
+				u8* out = &m_samples[s.offset];
+				for (size_t t = 0;t < s.group->track_count();t++) {
+					animation_track_base* track = s.group->track(t);
+					track->sample(s.time, out);
+					out += sample_stride(track->value_size());
+				}
+			}
+		};
+
+		size_t count = m_sampled.size();
+		if (count <= ANIMATION_SAMPLE_CHUNK_SIZE) {
+			sample(0, count);
+			return;
+		}
+
+		// the calling thread samples the first chunk
+		size_t chunks = (count + ANIMATION_SAMPLE_CHUNK_SIZE - 1) / ANIMATION_SAMPLE_CHUNK_SIZE;
+		marl::WaitGroup wg(u32(chunks - 1));
+		for (size_t c = 1;c < chunks;c++) {
+			size_t b = c * ANIMATION_SAMPLE_CHUNK_SIZE;
+			size_t e = min(b + ANIMATION_SAMPLE_CHUNK_SIZE, count);
+			marl::schedule([&sample, &wg, b, e]() {
+				sample(b, e);
+				wg.done();
+			});
+		}
+
+		sample(0, ANIMATION_SAMPLE_CHUNK_SIZE);
+		wg.wait();
+	}
+
+	void animation_sys::apply_samples() {
+		// consecutive tracks almost always write to the same component, so it's only looked up when that changes
+		entity_system_state* lastState = nullptr;
+		componentId lastId = 0;
+		u8* component = nullptr;
+
+		for (const animation_sample& s : m_sampled) {
+			const u8* value = &m_samples[s.offset];
+			for (size_t t = 0;t < s.group->track_count();t++) {
+				animation_track_base* track = s.group->track(t);
+				size_t size = track->value_size();
+
+				if (track->entity_property) {
+					animatable_property_data* prop = (animatable_property_data*)track->user_data;
+					component_ref<scene_entity_component*>& ref = prop->ref;
+					if (ref.state != lastState || ref.id != lastId) {
+						lastState = ref.state;
+						lastId = ref.id;
+						component = (u8*)ref.get();
+					}
+
+					if (component) memcpy(component + prop->offset, value, size);
+				} else {
+					// custom setters could add components, moving the one that was looked up
+					track->apply(value, s.target);
+					lastState = nullptr;
+					lastId = 0;
+					component = nullptr;
+				}
+
+				value += sample_stride(size);
+			}
+		}
+	}
+
 	void animation_sys::handle(event* evt) {
 	}
 
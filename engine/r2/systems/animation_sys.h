@@ -2,6 +2,9 @@
 #include <r2/systems/entity.h>
 #include <r2/systems/animation.h>
 
+// number of playing animations each marl task samples
+#define ANIMATION_SAMPLE_CHUNK_SIZE 16
+
 namespace r2 {
 	class animation_component : public scene_entity_component {
 		public:
@@ -68,8 +71,23 @@ namespace r2 {
 			static void remove_sync(animation_sync* sync);
 
 		protected:
+			// One playing animation for the current update, its track values are at m_samples[offset]
+			struct animation_sample {
+				animation_group* group;
+				scene_entity* target;
+				f32 time;
+				size_t offset;
+			};
+
+			void sample_animations();
+			void apply_samples();
+
 			animation_sys();
 			static animation_sys* instance;
 			mlist <animation_sync*> m_syncs;
+
+			// Rebuilt every update, they're kept to reuse their memory
+			mvector<animation_sample> m_sampled;
+			mvector<u8> m_samples;
 	};
 };
\ No newline at end of file
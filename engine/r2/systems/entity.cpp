@@ -25,7 +25,7 @@ namespace r2 {
 
 	entityId scene_entity::nextEntityId = 1;
 	scene_entity::scene_entity(v8Args args)
-		: m_id(scene_entity::nextEntityId++), m_name(nullptr), m_scriptFuncs(nullptr), m_destroyed(false), m_parent(nullptr), m_children(nullptr) {
+		: m_id(scene_entity::nextEntityId++), m_name(nullptr), m_scriptFuncs(nullptr), m_scriptCallSites(nullptr), m_destroyed(false), m_parent(nullptr), m_children(nullptr) {
 		isolate = args.GetIsolate();
 		if (args.Length() != 1) {
 			r2Warn("No name parameter passed to entity constructor");
@@ -46,6 +46,7 @@ namespace r2 {
 		}
 
 		m_scriptFuncs = new munordered_map<mstring, PersistentFunctionHandle>();
+		m_scriptCallSites = new munordered_map<mstring, script_call_site>();
 		m_children = new mlist<scene_entity*>();
 		m_propInterpolation = new munordered_map<mstring, prop_interpolate_info>();
 		m_propAnimation = new munordered_map<mstring, prop_animate_info>();
@@ -59,9 +60,10 @@ namespace r2 {
 	}
 
 	scene_entity::scene_entity(const mstring& name)
-		: m_id(scene_entity::nextEntityId++), m_name(nullptr), m_scriptFuncs(nullptr), m_destroyed(false), m_parent(nullptr), m_children(nullptr), isolate(nullptr) {
+		: m_id(scene_entity::nextEntityId++), m_name(nullptr), m_scriptFuncs(nullptr), m_scriptCallSites(nullptr), m_destroyed(false), m_parent(nullptr), m_children(nullptr), isolate(nullptr) {
 		m_name = new mstring(name);
 		m_scriptFuncs = new munordered_map<mstring, PersistentFunctionHandle>();
+		m_scriptCallSites = new munordered_map<mstring, script_call_site>();
 		m_children = new mlist<scene_entity*>();
 		m_propInterpolation = new munordered_map<mstring, prop_interpolate_info>();
 		m_propAnimation = new munordered_map<mstring, prop_animate_info>();
@@ -86,6 +88,10 @@ namespace r2 {
 			delete m_scriptFuncs;
 			m_scriptFuncs = nullptr;
 		}
+		if (m_scriptCallSites) {
+			delete m_scriptCallSites;
+			m_scriptCallSites = nullptr;
+		}
 		delete m_children;
 		m_children = nullptr;
 
@@ -117,7 +123,18 @@ namespace r2 {
 		PersistentFunctionHandle func = funcIter->second;
 		if (func.IsEmpty()) return;
 
+		// call sites are only registered while profiling, and entities with the same name share them, so
+		// entities that come and go don't add any
+		script_profiler* profiler = r2engine::scripts()->profiler();
+		script_call_site site = SCRIPT_CALL_SITE_NONE;
+		if (profiler->enabled()) {
+			auto siteIter = m_scriptCallSites->find(function);
+			if (siteIter != m_scriptCallSites->end()) site = siteIter->second;
+			else site = (*m_scriptCallSites)[function] = profiler->register_site("entity:" + *m_name + "." + function);
+		}
+
 		TryCatch tc(isolate);
+		script_call_scope scope(profiler, site);
 		func.Get(isolate)->Call(isolate->GetCurrentContext(), m_scriptObj.Get(isolate), argc, args);
 		check_script_exception(isolate, tc);
 	}
@@ -462,7 +479,7 @@ namespace r2 {
 		return pai.add_to_anim(prop, pai.propAccess, animation);
 	}
 
-	keyframe_base* scene_entity::create_keyframe(const mstring& prop, animation_group* animation, interpolate::interpolation_transition_mode mode) {
+	void* scene_entity::create_keyframe(const mstring& prop, animation_group* animation, interpolate::interpolation_transition_mode mode) {
 		auto it = m_propAnimation->find(prop);
 		if (it == m_propAnimation->end()) {
 			r2Error("Entity '%s' has no animatable property named '%s'", m_name->c_str(), prop.c_str());
@@ -4,6 +4,7 @@
 #include <r2/utilities/event.h>
 #include <r2/bindings/v8helpers.h>
 #include <r2/utilities/periodic_update.h>
+#include <r2/utilities/script_profiler.h>
 #include <r2/utilities/dynamic_array.hpp>
 #include <r2/bindings/math_converters.h>
 #include <r2/systems/animation.h>
@@ -48,6 +49,7 @@ namespace r2 {
 			friend class mesh_sys;
 			friend class transform_sys;
 			friend class camera_sys;
+			friend class animation_sys;
 
 			componentId id;
 			entity_system_state* state;
@@ -74,14 +76,16 @@ namespace r2 {
 
 	template <typename T>
 	inline animation_track_base* bind_property_to_animation(const mstring& prop, animatable_property_data* propAccess, animation_group* anim) {
-		return anim->add_track<T>(prop, *(T*)(((u8*)propAccess->ref.get()) + propAccess->offset), animation_property_setter<T>, default_interpolator<T>, propAccess);
+		animation_track_base* track = anim->add_track<T>(prop, *(T*)(((u8*)propAccess->ref.get()) + propAccess->offset), animation_property_setter<T>, default_interpolator<T>, propAccess);
+		track->entity_property = true;
+		return track;
 	}
 	
 	template <typename T>
-	inline keyframe_base* create_property_keyframe(const mstring& prop, animatable_property_data* propAccess, animation_group* anim, interpolate::interpolation_transition_mode mode) {
+	inline void* create_property_keyframe(const mstring& prop, animatable_property_data* propAccess, animation_group* anim, interpolate::interpolation_transition_mode mode) {
 		animation_track<T>* track = anim->track<T>(prop);
 		if (!track) return nullptr;
-		return track->set(*(T*)(((u8*)propAccess->ref.get()) + propAccess->offset), anim->current_time(), mode);
+		return track->keyframe_data(track->set(*(T*)(((u8*)propAccess->ref.get()) + propAccess->offset), anim->current_time(), mode));
 	}
 
 	class scene_entity : public event_receiver, public periodic_update {
@@ -446,7 +450,7 @@ namespace r2 {
 			void set_interpolation(const mstring& prop, interpolate::interpolation_transition_mode transition, f32 duration);
 			void animatable_props(mvector<mstring>& out) const;
 			animation_track_base* animate_prop(const mstring& prop, animation_group* animation);
-			keyframe_base* create_keyframe(const mstring& prop, animation_group* animation, interpolate::interpolation_transition_mode mode);
+			void* create_keyframe(const mstring& prop, animation_group* animation, interpolate::interpolation_transition_mode mode);
 			mvector<scene_entity*> children();
 			
 			template <typename F>
@@ -487,13 +491,14 @@ namespace r2 {
 			struct prop_animate_info {
 				animatable_property_data* propAccess;
 				animation_track_base* (*add_to_anim)(const mstring& /*prop*/, animatable_property_data* /*propAccess*/, animation_group* /*anim*/);
-				keyframe_base* (*create_keyframe)(const mstring& /*prop*/, animatable_property_data* /*propAccess*/, animation_group* /*anim*/, interpolate::interpolation_transition_mode /*mode*/);
+				void* (*create_keyframe)(const mstring& /*prop*/, animatable_property_data* /*propAccess*/, animation_group* /*anim*/, interpolate::interpolation_transition_mode /*mode*/);
 			};
 
 			static entityId nextEntityId;
 			v8::Isolate* isolate;
 			PersistentValueHandle m_scriptObj;
 			munordered_map<mstring, PersistentFunctionHandle>* m_scriptFuncs;
+			munordered_map<mstring, script_call_site>* m_scriptCallSites;
 			munordered_map<mstring, prop_interpolate_info>* m_propInterpolation;
 			munordered_map<mstring, prop_animate_info>* m_propAnimation;
 			mlist<scene_entity*>* m_children;
@@ -4,6 +4,50 @@
 #include <r2/bindings/math_converters.h>
 
 namespace r2 {
+	// Components per attribute shape (scalar, vec2, vec3, vec4, mat2, mat3, mat4), each type comes in int/float/uint
+	static const u32 attribute_components[] = { 1, 2, 3, 4, 4, 9, 16 };
+
+	// Wraps 'count' elements of 'format' in 'buffer', all vertex and instance attribute components are 4 bytes
+	template <typename format_type>
+	static Local<Object> element_view(Isolate* isolate, Local<ArrayBuffer> buffer, format_type* format, size_t count, size_t maxCount) {
+		size_t components = buffer->ByteLength() / 4;
+		auto attrs = format->attributes();
+
+		Local<Array> attributes = Array::New(isolate, attrs.size());
+		for (u16 a = 0;a < attrs.size();a++) {
+			u32 t = (u32)attrs[a];
+			u32 componentCount = attribute_components[t / 3];
+
+			Local<Object> attr = Object::New(isolate);
+			attr->Set(v8str("offset"), Number::New(isolate, f64(format->offsetOf(a) / 4)));
+			attr->Set(v8str("components"), Number::New(isolate, componentCount));
+			attr->Set(v8str("kind"), v8str(t % 3 == 0 ? "int" : (t % 3 == 1 ? "float" : "uint")));
+			attributes->Set(a, attr);
+		}
+
+		Local<Object> view = Object::New(isolate);
+		view->Set(v8str("buffer"), buffer);
+		view->Set(v8str("floats"), Float32Array::New(buffer, 0, components));
+		view->Set(v8str("ints"), Int32Array::New(buffer, 0, components));
+		view->Set(v8str("uints"), Uint32Array::New(buffer, 0, components));
+		view->Set(v8str("stride"), Number::New(isolate, f64(format->size() / 4)));
+		view->Set(v8str("count"), Number::New(isolate, f64(count)));
+		view->Set(v8str("max_count"), Number::New(isolate, f64(maxCount)));
+		view->Set(v8str("attributes"), attributes);
+		return view;
+	}
+
+	// Reads optional (first, count) arguments, defaulting to the whole range
+	static bool parse_range(v8Args args, size_t total, size_t* first, size_t* count) {
+		*first = 0;
+		*count = total;
+		if (args.Length() > 0 && args[0]->IsNumber()) *first = (size_t)args[0]->NumberValue(args.GetIsolate()->GetCurrentContext()).FromJust();
+		if (args.Length() > 1 && args[1]->IsNumber()) *count = (size_t)args[1]->NumberValue(args.GetIsolate()->GetCurrentContext()).FromJust();
+		else if (*first < total) *count = total - *first;
+		else *count = 0;
+		return *count > 0;
+	}
+
 	mesh_component::mesh_component() {
 	}
 
@@ -207,7 +251,7 @@ namespace r2 {
 		auto node = m_instance.node();
 		auto format = node->vertices().buffer->format();
 		size_t vsize = format->size();
-		u8* data = (u8*)node->vertices().buffer->data();
+		u8* data = (u8*)node->vertex_data();
 		size_t count = node->vertex_count();
 
 		auto isolate = args.GetIsolate();
@@ -303,7 +347,7 @@ namespace r2 {
 		EscapableHandleScope scope(args.GetIsolate());
 		auto node = m_instance.node();
 		auto type = node->indices().buffer->type();
-		u8* data = (u8*)node->indices().buffer->data();
+		u8* data = (u8*)node->index_data();
 		size_t count = node->index_count();
 
 		auto isolate = args.GetIsolate();
@@ -347,6 +391,114 @@ namespace r2 {
 		args.GetReturnValue().Set(scope.Escape(arr));
 	}
 
+	void mesh_component::get_vertex_view(v8Args args) {
+		if (!m_instance) {
+			r2Error("Attempted to get mesh component's vertex view when the mesh doesn't have a valid reference to a node");
+			return;
+		}
+
+		Isolate* isolate = args.GetIsolate();
+		EscapableHandleScope scope(isolate);
+		render_node* node = m_instance.node();
+		vertex_format* format = node->vertices().buffer->format();
+		Local<ArrayBuffer> buffer = node->script_view(isolate, node->vertex_data(), node->max_vertex_count() * format->size());
+		args.GetReturnValue().Set(scope.Escape(element_view(isolate, buffer, format, node->vertex_count(), node->max_vertex_count())));
+	}
+
+	void mesh_component::get_index_view(v8Args args) {
+		if (!m_instance) {
+			r2Error("Attempted to get mesh component's index view when the mesh doesn't have a valid reference to a node");
+			return;
+		}
+
+		render_node* node = m_instance.node();
+		if (!node->indices().buffer) {
+			args.GetReturnValue().Set(Null(args.GetIsolate()));
+			return;
+		}
+
+		Isolate* isolate = args.GetIsolate();
+		EscapableHandleScope scope(isolate);
+		index_type type = node->indices().buffer->type();
+		size_t maxCount = node->max_index_count();
+		Local<ArrayBuffer> buffer = node->script_view(isolate, node->index_data(), maxCount * type);
+
+		Local<Object> view = Object::New(isolate);
+		view->Set(v8str("buffer"), buffer);
+		switch (type) {
+			case it_unsigned_byte: { view->Set(v8str("indices"), Uint8Array::New(buffer, 0, maxCount)); break; }
+			case it_unsigned_short: { view->Set(v8str("indices"), Uint16Array::New(buffer, 0, maxCount)); break; }
+			case it_unsigned_int: { view->Set(v8str("indices"), Uint32Array::New(buffer, 0, maxCount)); break; }
+		}
+		view->Set(v8str("count"), Number::New(isolate, f64(node->index_count())));
+		view->Set(v8str("max_count"), Number::New(isolate, f64(maxCount)));
+		args.GetReturnValue().Set(scope.Escape(view));
+	}
+
+	void mesh_component::get_instance_view(v8Args args) {
+		if (!m_instance) {
+			r2Error("Attempted to get mesh component's instance view when the mesh doesn't have a valid reference to a node");
+			return;
+		}
+
+		render_node* node = m_instance.node();
+		if (!node->instances().buffer) {
+			args.GetReturnValue().Set(Null(args.GetIsolate()));
+			return;
+		}
+
+		Isolate* isolate = args.GetIsolate();
+		EscapableHandleScope scope(isolate);
+		instance_format* format = node->instances().buffer->format();
+		Local<ArrayBuffer> buffer = node->script_view(isolate, node->instance_data(m_instance.id()), format->size());
+		args.GetReturnValue().Set(scope.Escape(element_view(isolate, buffer, format, 1, 1)));
+	}
+
+	void mesh_component::mark_vertices_dirty(v8Args args) {
+		if (!m_instance) {
+			r2Error("Attempted to mark mesh component's vertices as dirty when the mesh doesn't have a valid reference to a node");
+			return;
+		}
+
+		render_node* node = m_instance.node();
+		size_t first, count;
+		if (!parse_range(args, node->vertex_count(), &first, &count)) return;
+
+		// writing past the current vertex count through a view adds vertices to the mesh
+		if (first + count > node->vertex_count() && first + count <= node->max_vertex_count()) node->set_vertex_count(first + count);
+		node->vertices_updated(first, count);
+	}
+
+	void mesh_component::mark_indices_dirty(v8Args args) {
+		if (!m_instance) {
+			r2Error("Attempted to mark mesh component's indices as dirty when the mesh doesn't have a valid reference to a node");
+			return;
+		}
+
+		render_node* node = m_instance.node();
+		size_t first, count;
+		if (!parse_range(args, node->index_count(), &first, &count)) return;
+
+		if (first + count > node->index_count() && first + count <= node->max_index_count()) node->set_index_count(first + count);
+		node->indices_updated(first, count);
+	}
+
+	void mesh_component::mark_instance_dirty(v8Args args) {
+		if (!m_instance) {
+			r2Error("Attempted to mark mesh component's instance as dirty when the mesh doesn't have a valid reference to a node");
+			return;
+		}
+
+		render_node* node = m_instance.node();
+		size_t idx = node->instance_index(m_instance.id());
+		if (idx == SIZE_MAX) {
+			r2Error("Attempted to mark mesh component's instance as dirty when the instance is no longer valid");
+			return;
+		}
+
+		node->instances_updated(idx, 1);
+	}
+
 	void mesh_component::set_instance_transform(const mat4f& transform) {
 		m_instance.update_instance_transform(transform);
 	}
@@ -438,6 +590,12 @@ namespace r2 {
 		if (entity->is_scripted()) {
 			entity->unbind("node");
 			entity->unbind("instance");
+			entity->unbind("instance_view");
+			entity->unbind("mark_instance_dirty");
+			entity->unbind("vertex_view");
+			entity->unbind("mark_vertices_dirty");
+			entity->unbind("index_view");
+			entity->unbind("mark_indices_dirty");
 			entity->unbind("max_vertex_count");
 			entity->unbind("vertex_count");
 			entity->unbind("get_vertices");
@@ -473,6 +631,14 @@ namespace r2 {
 			entity->mesh->set_instance_data(args);
 		});
 		entity->bind(component, "instance", get, set);
+
+		entity->bind(this, "instance_view", [](entity_system* sys, scene_entity* entity, v8Args args) {
+			entity->mesh->get_instance_view(args);
+		});
+
+		entity->bind(this, "mark_instance_dirty", [](entity_system* sys, scene_entity* entity, v8Args args) {
+			entity->mesh->mark_instance_dirty(args);
+		});
 	}
 
 	void mesh_sys::bind_vertex_data(mesh_component* component, scene_entity* entity) {
@@ -492,6 +658,14 @@ namespace r2 {
 		entity->bind(this, "set_vertices", [](entity_system* sys, scene_entity* entity, v8Args args) {
 			entity->mesh->set_vertex_data(args);
 		});
+
+		entity->bind(this, "vertex_view", [](entity_system* sys, scene_entity* entity, v8Args args) {
+			entity->mesh->get_vertex_view(args);
+		});
+
+		entity->bind(this, "mark_vertices_dirty", [](entity_system* sys, scene_entity* entity, v8Args args) {
+			entity->mesh->mark_vertices_dirty(args);
+		});
 	}
 
 	void mesh_sys::bind_index_data(mesh_component* component, scene_entity* entity) {
@@ -511,6 +685,14 @@ namespace r2 {
 		entity->bind(this, "set_indices", [](entity_system* sys, scene_entity* entity, v8Args args) {
 			entity->mesh->set_index_data(args);
 		});
+
+		entity->bind(this, "index_view", [](entity_system* sys, scene_entity* entity, v8Args args) {
+			entity->mesh->get_index_view(args);
+		});
+
+		entity->bind(this, "mark_indices_dirty", [](entity_system* sys, scene_entity* entity, v8Args args) {
+			entity->mesh->mark_indices_dirty(args);
+		});
 	}
 
 	void mesh_sys::bind_node(mesh_component* component, scene_entity* entity) {
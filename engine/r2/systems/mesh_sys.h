@@ -11,6 +11,7 @@ namespace r2 {
 			void set_node(render_node* node);
 			void release_node();
 			render_node* get_node();
+			inline const render_node_instance& instance() const { return m_instance; }
 
 			void set_instance_data(v8Args args);
 			void get_instance_data(v8Args args);
@@ -23,6 +24,15 @@ namespace r2 {
 			void set_index_data(v8Args args);
 			void get_index_data(v8Args args);
 
+			// Zero-copy views of the node's storage. Views are detached when the storage moves,
+			// so scripts should fetch them again each frame instead of holding on to them
+			void get_vertex_view(v8Args args);
+			void get_index_view(v8Args args);
+			void get_instance_view(v8Args args);
+			void mark_vertices_dirty(v8Args args);
+			void mark_indices_dirty(v8Args args);
+			void mark_instance_dirty(v8Args args);
+
 			template <typename instance_type>
 			void set_instance_data(const instance_type& i) {
 				if (!m_instance) {
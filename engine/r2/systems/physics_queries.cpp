@@ -0,0 +1,234 @@
+#include <r2/systems/physics_queries.h>
+#include <r2/systems/physics_sys.h>
+#include <r2/engine.h>
+
+#include <BulletCollision/NarrowPhaseCollision/btGjkPairDetector.h>
+#include <BulletCollision/NarrowPhaseCollision/btGjkEpaPenetrationDepthSolver.h>
+#include <BulletCollision/NarrowPhaseCollision/btPointCollector.h>
+#include <BulletCollision/NarrowPhaseCollision/btVoronoiSimplexSolver.h>
+
+#include <marl/waitgroup.h>
+
+namespace r2 {
+	static inline btVector3 to_bt(const vec3f& v) {
+		return btVector3(v.x, v.y, v.z);
+	}
+
+	static inline vec3f from_bt(const btVector3& v) {
+		return vec3f(v.x(), v.y(), v.z());
+	}
+
+	static inline entityId entity_of(const btCollisionObject* obj) {
+		scene_entity* entity = (scene_entity*)obj->getUserPointer();
+		return entity ? entity->id() : 0;
+	}
+
+	// Calls 'query(begin, end)' for chunks of the batch on the marl workers, the calling thread takes the first chunk
+	template <typename F>
+	static void run_queries(size_t count, F&& query) {
+		if (count <= PHYSICS_QUERY_CHUNK_SIZE) {
+			query(0, count);
+			return;
+		}
+
+		size_t chunks = (count + PHYSICS_QUERY_CHUNK_SIZE - 1) / PHYSICS_QUERY_CHUNK_SIZE;
+		marl::WaitGroup wg(u32(chunks - 1));
+		for (size_t c = 1;c < chunks;c++) {
+			size_t b = c * PHYSICS_QUERY_CHUNK_SIZE;
+			size_t e = min(b + PHYSICS_QUERY_CHUNK_SIZE, count);
+			marl::schedule([&query, &wg, b, e]() {
+				query(b, e);
+				wg.done();
+			});
+		}
+
+		query(0, PHYSICS_QUERY_CHUNK_SIZE);
+		wg.wait();
+	}
+
+	// btDbvt::rayTest and collideTV keep their traversal stacks local, unlike the broadphase's own ray test,
+	// so these can run on any number of threads at once
+	struct ray_query : public btDbvt::ICollide {
+		btTransform from;
+		btTransform to;
+		entityId ignore;
+		btCollisionWorld::ClosestRayResultCallback* result;
+
+		virtual void Process(const btDbvtNode* leaf) {
+			btCollisionObject* obj = (btCollisionObject*)((btBroadphaseProxy*)leaf->data)->m_clientObject;
+			if (ignore != 0 && entity_of(obj) == ignore) return;
+			// same filtering as btCollisionWorld::rayTest, including the callback's collision groups
+			if (!result->needsCollision(obj->getBroadphaseHandle())) return;
+			btCollisionWorld::rayTestSingle(from, to, obj, obj->getCollisionShape(), obj->getWorldTransform(), *result);
+		}
+	};
+
+	struct sweep_query : public btDbvt::ICollide {
+		const btConvexShape* shape;
+		btTransform from;
+		btTransform to;
+		entityId ignore;
+		btCollisionWorld::ClosestConvexResultCallback* result;
+
+		virtual void Process(const btDbvtNode* leaf) {
+			btCollisionObject* obj = (btCollisionObject*)((btBroadphaseProxy*)leaf->data)->m_clientObject;
+			if (ignore != 0 && entity_of(obj) == ignore) return;
+			if (!result->needsCollision(obj->getBroadphaseHandle())) return;
+			btCollisionWorld::objectQuerySingle(shape, from, to, obj, obj->getCollisionShape(), obj->getWorldTransform(), *result, btScalar(0));
+		}
+	};
+
+	struct overlap_query : public btDbvt::ICollide {
+		const btSphereShape* shape;
+		btTransform transform;
+		entityId ignore;
+		btAlignedObjectArray<entityId>* results;
+
+		virtual void Process(const btDbvtNode* leaf) {
+			const btCollisionObject* obj = (const btCollisionObject*)((btBroadphaseProxy*)leaf->data)->m_clientObject;
+			entityId entity = entity_of(obj);
+			if (entity == 0 || entity == ignore) return;
+
+			const btCollisionShape* objShape = obj->getCollisionShape();
+			if (objShape->isConvex()) {
+				btVoronoiSimplexSolver simplex;
+				btGjkEpaPenetrationDepthSolver penetration;
+				btGjkPairDetector detector(shape, (const btConvexShape*)objShape, &simplex, &penetration);
+				btGjkPairDetector::ClosestPointInput input;
+				input.m_transformA = transform;
+				input.m_transformB = obj->getWorldTransform();
+				btPointCollector output;
+				detector.getClosestPoints(input, output, nullptr);
+				if (!output.m_hasResult || output.m_distance > btScalar(0)) return;
+			} else {
+				btVector3 min, max;
+				objShape->getAabb(obj->getWorldTransform(), min, max);
+				btVector3 center = transform.getOrigin();
+				btVector3 closest = center;
+				closest.setMax(min);
+				closest.setMin(max);
+				if (closest.distance2(center) > shape->getRadius() * shape->getRadius()) return;
+			}
+
+			results->push_back(entity);
+		}
+	};
+
+	static btDbvtBroadphase* broadphase_of(physics_system_state* state) {
+		return (btDbvtBroadphase*)state->broadphaseInterface;
+	}
+
+	void physics_raycast(physics_system_state* state, const physics_ray* rays, size_t count, physics_hit* hits, const entityId* ignore) {
+		btDbvtBroadphase* broadphase = broadphase_of(state);
+
+		run_queries(count, [broadphase, rays, hits, ignore](size_t begin, size_t end) {
+			for (size_t i = begin;i < end;i++) {
+				btVector3 from = to_bt(rays[i].from);
+				btVector3 to = to_bt(rays[i].to);
+				btCollisionWorld::ClosestRayResultCallback result(from, to);
+
+				ray_query query;
+				query.from.setIdentity();
+				query.from.setOrigin(from);
+				query.to.setIdentity();
+				query.to.setOrigin(to);
+				query.ignore = ignore ? ignore[i] : 0;
+				query.result = &result;
+
+				// dynamic and static proxies live in separate trees
+				for (u32 s = 0;s < 2;s++) btDbvt::rayTest(broadphase->m_sets[s].m_root, from, to, query);
+
+				physics_hit& hit = hits[i];
+				if (result.hasHit()) {
+					hit.entity = entity_of(result.m_collisionObject);
+					hit.fraction = result.m_closestHitFraction;
+					hit.point = from_bt(result.m_hitPointWorld);
+					hit.normal = from_bt(result.m_hitNormalWorld);
+				} else hit = { 0, 1.0f, rays[i].to, vec3f(0.0f) };
+			}
+		});
+	}
+
+	void physics_sweep(physics_system_state* state, const physics_sphere_sweep* sweeps, size_t count, physics_hit* hits, const entityId* ignore) {
+		btDbvtBroadphase* broadphase = broadphase_of(state);
+
+		run_queries(count, [broadphase, sweeps, hits, ignore](size_t begin, size_t end) {
+			for (size_t i = begin;i < end;i++) {
+				const physics_sphere_sweep& sweep = sweeps[i];
+				btVector3 from = to_bt(sweep.from);
+				btVector3 to = to_bt(sweep.to);
+				btSphereShape sphere(sweep.radius);
+				btCollisionWorld::ClosestConvexResultCallback result(from, to);
+
+				sweep_query query;
+				query.shape = &sphere;
+				query.from.setIdentity();
+				query.from.setOrigin(from);
+				query.to.setIdentity();
+				query.to.setOrigin(to);
+				query.ignore = ignore ? ignore[i] : 0;
+				query.result = &result;
+
+				// everything the sphere passes through is inside the bounds of both ends of the sweep
+				btVector3 extent(sweep.radius, sweep.radius, sweep.radius);
+				btVector3 min = from, max = from;
+				min.setMin(to);
+				max.setMax(to);
+				btDbvtVolume bounds = btDbvtVolume::FromMM(min - extent, max + extent);
+				for (u32 s = 0;s < 2;s++) broadphase->m_sets[s].collideTV(broadphase->m_sets[s].m_root, bounds, query);
+
+				physics_hit& hit = hits[i];
+				if (result.hasHit()) {
+					hit.entity = entity_of(result.m_hitCollisionObject);
+					hit.fraction = result.m_closestHitFraction;
+					hit.point = from_bt(result.m_hitPointWorld);
+					hit.normal = from_bt(result.m_hitNormalWorld);
+				} else hit = { 0, 1.0f, sweep.to, vec3f(0.0f) };
+			}
+		});
+	}
+
+	void physics_overlap(physics_system_state* state, const physics_sphere* spheres, size_t count, mvector<u32>& offsets, mvector<entityId>& entities, const entityId* ignore) {
+		btDbvtBroadphase* broadphase = broadphase_of(state);
+		offsets.resize(count + 1);
+		entities.clear();
+		if (count == 0) {
+			offsets[0] = 0;
+			return;
+		}
+
+		// Each chunk collects its results separately, they're joined in query order afterwards. These are Bullet arrays
+		// because operator new waits on the memory manager's lock, which the calling thread may be holding
+		size_t chunks = (count + PHYSICS_QUERY_CHUNK_SIZE - 1) / PHYSICS_QUERY_CHUNK_SIZE;
+		mvector<btAlignedObjectArray<entityId>> chunkResults(chunks);
+		u32* counts = &offsets[1];
+
+		run_queries(count, [broadphase, spheres, ignore, counts, &chunkResults](size_t begin, size_t end) {
+			btAlignedObjectArray<entityId>& results = chunkResults[begin / PHYSICS_QUERY_CHUNK_SIZE];
+			for (size_t i = begin;i < end;i++) {
+				const physics_sphere& s = spheres[i];
+				btSphereShape sphere(s.radius);
+
+				overlap_query query;
+				query.shape = &sphere;
+				query.transform.setIdentity();
+				query.transform.setOrigin(to_bt(s.center));
+				query.ignore = ignore ? ignore[i] : 0;
+				query.results = &results;
+
+				i32 before = results.size();
+				btDbvtVolume bounds = btDbvtVolume::FromCR(to_bt(s.center), s.radius);
+				for (u32 t = 0;t < 2;t++) broadphase->m_sets[t].collideTV(broadphase->m_sets[t].m_root, bounds, query);
+				counts[i] = u32(results.size() - before);
+			}
+		});
+
+		offsets[0] = 0;
+		for (size_t i = 1;i <= count;i++) offsets[i] += offsets[i - 1];
+
+		entities.reserve(offsets[count]);
+		for (btAlignedObjectArray<entityId>& results : chunkResults) {
+			for (i32 i = 0;i < results.size();i++) entities.push_back(results[i]);
+		}
+	}
+};
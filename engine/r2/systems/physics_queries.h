@@ -0,0 +1,48 @@
+#pragma once
+#include <btBulletCollisionCommon.h>
+
+#include <r2/config.h>
+#include <r2/managers/memman.h>
+#include <r2/systems/entity.h>
+
+// number of queries each marl task runs
+#define PHYSICS_QUERY_CHUNK_SIZE 32
+
+namespace r2 {
+	class physics_system_state;
+
+	// These are laid out to be read straight out of / written straight into script TypedArrays
+	struct physics_ray {
+		vec3f from;
+		vec3f to;
+	};
+
+	struct physics_sphere_sweep {
+		vec3f from;
+		vec3f to;
+		f32 radius;
+	};
+
+	struct physics_sphere {
+		vec3f center;
+		f32 radius;
+	};
+
+	// 'entity' is 0 and 'fraction' is 1 when nothing was hit. Bodies that don't belong to an entity are hit with 'entity' 0
+	struct physics_hit {
+		entityId entity;
+		f32 fraction;
+		vec3f point;
+		vec3f normal;
+	};
+
+	// Batched queries against a physics state's broadphase, split across the marl workers. These only read the
+	// world, and must not run while it's being stepped. 'ignore' optionally holds an entity per query to skip,
+	// usually the one asking
+	void physics_raycast(physics_system_state* state, const physics_ray* rays, size_t count, physics_hit* hits, const entityId* ignore = nullptr);
+	void physics_sweep(physics_system_state* state, const physics_sphere_sweep* sweeps, size_t count, physics_hit* hits, const entityId* ignore = nullptr);
+
+	// Entities whose bodies overlap each sphere. The results of sphere i are entities[offsets[i]] to entities[offsets[i + 1]].
+	// Convex shapes are tested exactly, concave and compound shapes by their bounding box
+	void physics_overlap(physics_system_state* state, const physics_sphere* spheres, size_t count, mvector<u32>& offsets, mvector<entityId>& entities, const entityId* ignore = nullptr);
+};
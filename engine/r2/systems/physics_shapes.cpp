@@ -0,0 +1,227 @@
+#include <r2/systems/physics_shapes.h>
+#include <r2/engine.h>
+#include <r2/utilities/utils.h>
+
+#include <BulletCollision/CollisionShapes/btScaledBvhTriangleMeshShape.h>
+
+namespace r2 {
+	struct bvh_file_header {
+		u32 magic;
+		u32 version;
+		u64 meshHash;
+		u32 bvhSize;
+		u32 padding;
+	};
+
+	// scales that differ by float noise from decomposing the transform would otherwise each get a shape
+	static f32 quantize(f32 v) {
+		return roundf(v * 10000.0f) / 10000.0f;
+	}
+
+	physics_shape_cache::physics_shape_cache() {
+	}
+
+	physics_shape_cache::~physics_shape_cache() {
+		// scaled mesh shapes refer to the unscaled ones, which are deleted with the mesh data
+		for (auto& shape : m_shapes) {
+			if (m_sources[shape.second].kind == psk_triangle_mesh && shape.second->getShapeType() == TRIANGLE_MESH_SHAPE_PROXYTYPE) continue;
+			delete shape.second;
+		}
+
+		for (auto& mesh : m_meshes) {
+			delete mesh.second->shape;
+			delete mesh.second->array;
+			if (mesh.second->bvhBuffer) btAlignedFree(mesh.second->bvhBuffer);
+			delete mesh.second;
+		}
+	}
+
+	btCollisionShape* physics_shape_cache::box(const vec3f& halfExtents) {
+		return get({ psk_box, halfExtents, 0, vec3f(1.0f) });
+	}
+
+	btCollisionShape* physics_shape_cache::sphere(f32 radius) {
+		return get({ psk_sphere, vec3f(radius, 0.0f, 0.0f), 0, vec3f(1.0f) });
+	}
+
+	btCollisionShape* physics_shape_cache::capsule(f32 radius, f32 height) {
+		return get({ psk_capsule, vec3f(radius, height, 0.0f), 0, vec3f(1.0f) });
+	}
+
+	btCollisionShape* physics_shape_cache::cylinder(const vec3f& halfExtents) {
+		return get({ psk_cylinder, halfExtents, 0, vec3f(1.0f) });
+	}
+
+	btCollisionShape* physics_shape_cache::triangle_mesh(const vec3f* vertices, u32 vertexCount, const u32* indices, u32 indexCount, const mstring& bvhFile) {
+		if (vertexCount == 0 || indexCount < 3 || indexCount % 3 != 0) {
+			r2Error("physics_shape_cache::triangle_mesh: %u vertices and %u indices don't make up a triangle list", vertexCount, indexCount);
+			return nullptr;
+		}
+
+		u64 hash = hash_bytes(vertices, sizeof(vec3f) * vertexCount);
+		hash = hash_bytes(indices, sizeof(u32) * indexCount, hash);
+
+		if (m_meshes.count(hash) == 0) {
+			triangle_mesh_data* mesh = new triangle_mesh_data();
+			mesh->vertices.assign(vertices, vertices + vertexCount);
+			mesh->indices.assign(indices, indices + indexCount);
+			mesh->bvhBuffer = nullptr;
+
+			btIndexedMesh part;
+			part.m_numTriangles = i32(indexCount / 3);
+			part.m_triangleIndexBase = (const u8*)mesh->indices.data();
+			part.m_triangleIndexStride = sizeof(u32) * 3;
+			part.m_numVertices = i32(vertexCount);
+			part.m_vertexBase = (const u8*)mesh->vertices.data();
+			part.m_vertexStride = sizeof(vec3f);
+			part.m_indexType = PHY_INTEGER;
+			part.m_vertexType = PHY_FLOAT;
+
+			mesh->array = new btTriangleIndexVertexArray();
+			mesh->array->addIndexedMesh(part, PHY_INTEGER);
+			mesh->shape = create_mesh_shape(mesh, hash, bvhFile);
+			m_meshes[hash] = mesh;
+		}
+
+		return get({ psk_triangle_mesh, vec3f(0.0f), hash, vec3f(1.0f) });
+	}
+
+	btCollisionShape* physics_shape_cache::scaled(btCollisionShape* shape, const vec3f& scale) {
+		auto source = m_sources.find(shape);
+		if (source == m_sources.end()) {
+			r2Error("physics_shape_cache::scaled: Shape was not created by this cache");
+			return shape;
+		}
+
+		shape_source s = source->second;
+		s.scale = scale;
+		return get(s);
+	}
+
+	void physics_shape_cache::release(btCollisionShape* shape) {
+		auto source = m_sources.find(shape);
+		if (source == m_sources.end() || source->second.scale == vec3f(1.0f)) return;
+
+		// scaled mesh shapes only wrap the unscaled one, which stays
+		m_shapes.erase(key_of(source->second));
+		m_sources.erase(source);
+		delete shape;
+	}
+
+	u64 physics_shape_cache::key_of(const shape_source& s) {
+		u32 kind = s.kind;
+		u64 key = hash_bytes(&kind, sizeof(u32));
+		key = hash_bytes(&s.params, sizeof(vec3f), key);
+		key = hash_bytes(&s.meshHash, sizeof(u64), key);
+		return hash_bytes(&s.scale, sizeof(vec3f), key);
+	}
+
+	btCollisionShape* physics_shape_cache::get(const shape_source& source) {
+		shape_source s = source;
+		s.scale = vec3f(quantize(s.scale.x), quantize(s.scale.y), quantize(s.scale.z));
+
+		u64 key = key_of(s);
+		auto existing = m_shapes.find(key);
+		if (existing != m_shapes.end()) return existing->second;
+
+		btCollisionShape* shape = create(s);
+		if (!shape) return nullptr;
+
+		m_shapes[key] = shape;
+		m_sources[shape] = s;
+		return shape;
+	}
+
+	btCollisionShape* physics_shape_cache::create(const shape_source& s) {
+		btVector3 scale(s.scale.x, s.scale.y, s.scale.z);
+		btCollisionShape* shape = nullptr;
+		switch (s.kind) {
+			case psk_box: {
+				shape = new btBoxShape(btVector3(s.params.x, s.params.y, s.params.z));
+				break;
+			}
+			case psk_sphere: {
+				shape = new btSphereShape(s.params.x);
+				break;
+			}
+			case psk_capsule: {
+				shape = new btCapsuleShape(s.params.x, s.params.y);
+				break;
+			}
+			case psk_cylinder: {
+				shape = new btCylinderShape(btVector3(s.params.x, s.params.y, s.params.z));
+				break;
+			}
+			case psk_triangle_mesh: {
+				// the BVH is only built once per mesh, other scales wrap the unscaled shape
+				btBvhTriangleMeshShape* base = m_meshes[s.meshHash]->shape;
+				if (s.scale == vec3f(1.0f)) return base;
+				return new btScaledBvhTriangleMeshShape(base, scale);
+			}
+		}
+
+		shape->setLocalScaling(scale);
+		return shape;
+	}
+
+	btBvhTriangleMeshShape* physics_shape_cache::create_mesh_shape(triangle_mesh_data* mesh, u64 hash, const mstring& bvhFile) {
+		if (bvhFile.length() > 0 && read_bvh(mesh, hash, bvhFile)) return mesh->shape;
+
+		btBvhTriangleMeshShape* shape = new btBvhTriangleMeshShape(mesh->array, true);
+		if (bvhFile.length() > 0) write_bvh(shape, hash, bvhFile);
+		return shape;
+	}
+
+	bool physics_shape_cache::read_bvh(triangle_mesh_data* mesh, u64 hash, const mstring& bvhFile) {
+		file_man* files = r2engine::files();
+		if (!files->exists(bvhFile)) return false;
+
+		data_container* file = files->load(bvhFile, DM_BINARY);
+		if (!file) return false;
+
+		bvh_file_header header;
+		bool valid = file->read(header) && header.magic == PHYSICS_BVH_FILE_MAGIC && header.version == PHYSICS_BVH_FILE_VERSION;
+		if (!valid || header.meshHash != hash) {
+			r2Log("%s was built from a different mesh, it will be rebuilt", bvhFile.c_str());
+			files->destroy(file);
+			return false;
+		}
+
+		// the BVH is deserialized in place, so its buffer has to be aligned and outlive the shape
+		void* buffer = btAlignedAlloc(header.bvhSize, 16);
+		btOptimizedBvh* bvh = nullptr;
+		if (file->read_data(buffer, header.bvhSize)) bvh = (btOptimizedBvh*)btOptimizedBvh::deSerializeInPlace(buffer, header.bvhSize, false);
+		files->destroy(file);
+
+		if (!bvh) {
+			r2Warn("Failed to read BVH from %s, it will be rebuilt", bvhFile.c_str());
+			btAlignedFree(buffer);
+			return false;
+		}
+
+		mesh->bvhBuffer = buffer;
+		mesh->shape = new btBvhTriangleMeshShape(mesh->array, true, false);
+		mesh->shape->setOptimizedBvh(bvh);
+		return true;
+	}
+
+	void physics_shape_cache::write_bvh(btBvhTriangleMeshShape* shape, u64 hash, const mstring& bvhFile) {
+		btOptimizedBvh* bvh = shape->getOptimizedBvh();
+		u32 size = bvh->calculateSerializeBufferSize();
+		void* buffer = btAlignedAlloc(size, 16);
+		if (!bvh->serialize(buffer, size, false)) {
+			r2Warn("Failed to serialize BVH for %s", bvhFile.c_str());
+			btAlignedFree(buffer);
+			return;
+		}
+
+		file_man* files = r2engine::files();
+		data_container* file = files->create(DM_BINARY);
+		bvh_file_header header = { PHYSICS_BVH_FILE_MAGIC, PHYSICS_BVH_FILE_VERSION, hash, size, 0 };
+		file->write(header);
+		file->write_data(buffer, size);
+		files->save(file, bvhFile);
+		files->destroy(file);
+		btAlignedFree(buffer);
+	}
+};
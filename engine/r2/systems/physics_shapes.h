@@ -0,0 +1,77 @@
+#pragma once
+#include <btBulletCollisionCommon.h>
+
+#include <r2/config.h>
+#include <r2/managers/memman.h>
+
+// identifies files written by physics_shape_cache::triangle_mesh
+#define PHYSICS_BVH_FILE_MAGIC 0x56423252
+#define PHYSICS_BVH_FILE_VERSION 1
+
+namespace r2 {
+	enum physics_shape_kind {
+		psk_box = 0,
+		psk_sphere,
+		psk_capsule,
+		psk_cylinder,
+		psk_triangle_mesh
+	};
+
+	// Hands out shared collision shapes, so that bodies with equivalent shapes use the same instance.
+	// Shapes are keyed by their parameters and local scaling, since a shared shape can't be scaled per body.
+	// Every shape is owned by the cache. Unscaled shapes live as long as it does, scaled variants only until
+	// they're released by the last body using them
+	class physics_shape_cache {
+		public:
+			physics_shape_cache();
+			~physics_shape_cache();
+
+			btCollisionShape* box(const vec3f& halfExtents);
+			btCollisionShape* sphere(f32 radius);
+			btCollisionShape* capsule(f32 radius, f32 height);
+			btCollisionShape* cylinder(const vec3f& halfExtents);
+
+			// Static triangle mesh, shared between meshes with the same content. If 'bvhFile' is set, the mesh's BVH is
+			// read from it when it was built from the same content, and otherwise built and written to it
+			btCollisionShape* triangle_mesh(const vec3f* vertices, u32 vertexCount, const u32* indices, u32 indexCount, const mstring& bvhFile = "");
+
+			bool owns(btCollisionShape* shape) const { return m_sources.count(shape) > 0; }
+
+			// The equivalent of a shape from this cache with 'scale' as its local scaling
+			btCollisionShape* scaled(btCollisionShape* shape, const vec3f& scale);
+
+			// Called when no body uses 'shape' anymore. Deletes it if it's a scaled variant
+			void release(btCollisionShape* shape);
+
+			size_t shape_count() const { return m_shapes.size(); }
+
+		protected:
+			struct shape_source {
+				physics_shape_kind kind;
+				vec3f params;
+				u64 meshHash;
+				vec3f scale;
+			};
+
+			struct triangle_mesh_data {
+				mvector<vec3f> vertices;
+				mvector<u32> indices;
+				btTriangleIndexVertexArray* array;
+				btBvhTriangleMeshShape* shape;
+
+				// aligned buffer the BVH was deserialized into, when it was read from a file
+				void* bvhBuffer;
+			};
+
+			static u64 key_of(const shape_source& source);
+			btCollisionShape* get(const shape_source& source);
+			btCollisionShape* create(const shape_source& source);
+			btBvhTriangleMeshShape* create_mesh_shape(triangle_mesh_data* mesh, u64 hash, const mstring& bvhFile);
+			bool read_bvh(triangle_mesh_data* mesh, u64 hash, const mstring& bvhFile);
+			void write_bvh(btBvhTriangleMeshShape* shape, u64 hash, const mstring& bvhFile);
+
+			munordered_map<u64, btCollisionShape*> m_shapes;
+			munordered_map<btCollisionShape*, shape_source> m_sources;
+			munordered_map<u64, triangle_mesh_data*> m_meshes;
+	};
+};
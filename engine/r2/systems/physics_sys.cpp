@@ -1,14 +1,108 @@
 #include <r2/systems/physics_sys.h>
 #include <r2/systems/cascade_functions.h>
+#include <r2/utilities/utils.h>
 #include <r2/engine.h>
 
+#include <BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
+#include <BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#include <BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolverMt.h>
+
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <marl/waitgroup.h>
 
 namespace r2 {
-	motion_state::motion_state(scene_entity* _entity) : entity(_entity) {
+	static void physics_internal_tick(btDynamicsWorld* world, btScalar timeStep) {
+		((physics_system_state*)world->getWorldUserInfo())->collect_contacts();
+	}
+
+	static bool creates_collision_events(const btCollisionObject* obj) {
+		scene_entity* entity = (scene_entity*)obj->getUserPointer();
+		return entity && entity->physics && entity->physics->creates_collision_events;
+	}
+
+	physics_task_scheduler::physics_task_scheduler() : btITaskScheduler("r2_marl") {
+		// marl's workers plus the main thread, which works on the first chunk of every loop
+		m_maxThreads = min(i32(marl::Thread::numLogicalCPUs()) + 1, i32(BT_MAX_THREAD_COUNT));
+		m_numThreads = m_maxThreads;
+	}
+
+	physics_task_scheduler::~physics_task_scheduler() {
+	}
+
+	void physics_task_scheduler::setNumThreads(int numThreads) {
+		m_numThreads = max(1, min(numThreads, m_maxThreads));
+	}
+
+	int physics_task_scheduler::chunk_size(int count, int grainSize) const {
+		int grain = max(grainSize, 1);
+		int chunks = min(m_numThreads, (count + grain - 1) / grain);
+		if (chunks <= 1) return count;
+		return (count + chunks - 1) / chunks;
+	}
+
+	void physics_task_scheduler::parallelFor(int iBegin, int iEnd, int grainSize, const btIParallelForBody& body) {
+		int count = iEnd - iBegin;
+		if (count <= 0) return;
+
+		int size = chunk_size(count, grainSize);
+		int chunks = (count + size - 1) / size;
+		if (chunks == 1) {
+			body.forLoop(iBegin, iEnd);
+			return;
+		}
+
+		marl::WaitGroup wg(chunks - 1);
+		for (int c = 1;c < chunks;c++) {
+			int b = iBegin + c * size;
+			int e = min(b + size, iEnd);
+			marl::schedule([&body, &wg, b, e]() {
+				body.forLoop(b, e);
+				wg.done();
+			});
+		}
+
+		body.forLoop(iBegin, iBegin + size);
+		wg.wait();
+	}
+
+	btScalar physics_task_scheduler::parallelSum(int iBegin, int iEnd, int grainSize, const btIParallelSumBody& body) {
+		int count = iEnd - iBegin;
+		if (count <= 0) return btScalar(0);
+
+		int size = chunk_size(count, grainSize);
+		int chunks = (count + size - 1) / size;
+		if (chunks == 1) return body.sumLoop(iBegin, iEnd);
+
+		mvector<btScalar> sums(chunks, btScalar(0));
+		marl::WaitGroup wg(chunks - 1);
+		for (int c = 1;c < chunks;c++) {
+			int b = iBegin + c * size;
+			int e = min(b + size, iEnd);
+			btScalar* sum = &sums[c];
+			marl::schedule([&body, &wg, sum, b, e]() {
+				*sum = body.sumLoop(b, e);
+				wg.done();
+			});
+		}
+
+		sums[0] = body.sumLoop(iBegin, iBegin + size);
+		wg.wait();
+
+		btScalar total = btScalar(0);
+		for (btScalar s : sums) total += s;
+		return total;
+	}
+
+
+
+	motion_state::motion_state(scene_entity* _entity, physics_system_state* state) : entity(_entity), m_state(state), m_step(0), m_moved(false) {
+		m_previous.setIdentity();
+		m_current.setIdentity();
 	}
 
 	motion_state::~motion_state() {
+		if (m_moved) m_state->forget_moved(this);
 	}
 
 	void motion_state::getWorldTransform(btTransform& worldTrans) const {
@@ -19,29 +113,23 @@ namespace r2 {
 		worldTrans.setFromOpenGLMatrix(glm::value_ptr(transform));
 	}
 
+	// Only records the transform, everything that moved is written by physics_system_state::synchronize_transforms
 	void motion_state::setWorldTransform(const btTransform& worldTrans) {
-		mat4f worldTransform;
-		mat4f objectTransform;
-		worldTrans.getOpenGLMatrix(glm::value_ptr(worldTransform));
-
-		if (entity->parent() && entity->parent()->transform) {
-			// worldTrans must be converted to the space of the parent
-			mat4f ptransform = entity->parent()->transform->cascaded_property(&transform_component::transform, &cascade_mat4f);
-			objectTransform = glm::inverse(ptransform) * worldTransform;
-		} else objectTransform = worldTransform;
-
-		entity->transform->transform = objectTransform;
-
-		if (entity->mesh && entity->physics->update_mesh_when_moved) {
-			render_node* node = entity->mesh->get_node();
-			if (node->instances().is_valid()) {
-				entity->mesh->set_instance_transform(worldTransform);
-			} else {
-				node->uniforms()->uniform_mat4f("transform", worldTransform);
-			}
+		// a body that wasn't moved by the last step is still resting where it was last written
+		m_previous = m_step > 0 ? m_current : worldTrans;
+		m_current = worldTrans;
+		m_step = m_state->stepCount;
+
+		if (!m_moved) {
+			m_moved = true;
+			m_state->m_moved.push_back(this);
 		}
 	}
 
+	void motion_state::reset(const btTransform& worldTrans) {
+		m_previous = m_current = worldTrans;
+	}
+
 
 
 	physics_component::physics_component() {
@@ -64,14 +152,8 @@ namespace r2 {
 			m_rigidBody = nullptr;
 		}
 
-		if (m_collisionShape) {
-			i32 refcount = m_collisionShape->getUserIndex() - 1;
-			m_collisionShape->setUserIndex(refcount);
-			if (refcount == 0) {
-				m_sysState->collisionShapes.remove(m_collisionShape);
-			}
-			m_collisionShape = nullptr;
-		}
+		release_shape(m_collisionShape);
+		m_collisionShape = nullptr;
 
 		if (m_motionState) delete m_motionState;
 		m_motionState = nullptr;
@@ -82,9 +164,8 @@ namespace r2 {
 		f32 sx = glm::length(vec3f(transform[0]));
 		f32 sy = glm::length(vec3f(transform[1]));
 		f32 sz = glm::length(vec3f(transform[2]));
-		if (m_collisionShape) {
-			m_collisionShape->setLocalScaling(btVector3(sx, sy, sz));
-		}
+		if (m_collisionShape) set_shape(m_collisionShape, vec3f(sx, sy, sz));
+
 		mat4f unscaled = transform;
 		unscaled[0] = glm::normalize(unscaled[0]);
 		unscaled[1] = glm::normalize(unscaled[1]);
@@ -93,18 +174,32 @@ namespace r2 {
 		btTransform t;
 		t.setFromOpenGLMatrix(glm::value_ptr(unscaled));
 		m_rigidBody->setWorldTransform(t);
+		if (m_motionState) m_motionState->reset(t);
 	}
 
 	void physics_component::set_shape(btCollisionShape* shape) {
+		vec3f scale(1.0f);
+		if (shape) {
+			mat4f transform = entity()->transform->cascaded_property(&transform_component::transform, &cascade_mat4f);
+			scale = vec3f(glm::length(vec3f(transform[0])), glm::length(vec3f(transform[1])), glm::length(vec3f(transform[2])));
+		}
+
+		set_shape(shape, scale);
+	}
+
+	void physics_component::set_shape(btCollisionShape* shape, const vec3f& scale) {
 		bool dynamic = m_mass != 0.0f;
-		if (shape == m_collisionShape) return;
 
-		if (m_collisionShape) {
-			i32 refcount = m_collisionShape->getUserIndex() - 1;
-			m_collisionShape->setUserIndex(refcount);
-			if (refcount == 0) m_sysState->collisionShapes.remove(m_collisionShape);
+		if (shape) {
+			// shared shapes can't be scaled per body
+			if (m_sysState->shapes->owns(shape)) shape = m_sysState->shapes->scaled(shape, scale);
+			else shape->setLocalScaling(btVector3(scale.x, scale.y, scale.z));
 		}
 
+		if (shape == m_collisionShape) return;
+
+		// the previous shape is released once the body no longer refers to it, it may be deleted
+		btCollisionShape* previous = m_collisionShape;
 		m_collisionShape = shape;
 
 		if (shape) {
@@ -115,12 +210,6 @@ namespace r2 {
 			}
 			refcount++;
 			shape->setUserIndex(refcount);
-
-			mat4f transform = entity()->transform->cascaded_property(&transform_component::transform, &cascade_mat4f);
-			f32 sx = glm::length(vec3f(transform[0]));
-			f32 sy = glm::length(vec3f(transform[1]));
-			f32 sz = glm::length(vec3f(transform[2]));
-			shape->setLocalScaling(btVector3(sx, sy, sz));
 		} else {
 			if (m_rigidBody) {
 				m_sysState->world->removeRigidBody(m_rigidBody);
@@ -131,6 +220,7 @@ namespace r2 {
 			if (m_motionState) delete m_motionState;
 			m_motionState = nullptr;
 
+			release_shape(previous);
 			return;
 		}
 
@@ -139,8 +229,13 @@ namespace r2 {
 			if (dynamic && shape->getShapeType() != EMPTY_SHAPE_PROXYTYPE) shape->calculateLocalInertia(m_mass, inertia);
 			m_rigidBody->setCollisionShape(shape);
 			m_rigidBody->setMassProps(m_mass, inertia);
+
+			// collision algorithms made for the previous shape may refer to it
+			if (m_rigidBody->getBroadphaseHandle()) {
+				m_sysState->world->getBroadphase()->getOverlappingPairCache()->cleanProxyFromPairs(m_rigidBody->getBroadphaseHandle(), m_sysState->world->getDispatcher());
+			}
 		} else {
-			m_motionState = new motion_state(entity());
+			m_motionState = new motion_state(entity(), m_sysState);
 			
 			btVector3 inertia(0.0f, 0.0f, 0.0f);
 			if (dynamic && m_collisionShape->getShapeType() != EMPTY_SHAPE_PROXYTYPE) {
@@ -149,9 +244,27 @@ namespace r2 {
 
 			btRigidBody::btRigidBodyConstructionInfo rbInfo(m_mass, m_motionState, m_collisionShape, inertia);
 			m_rigidBody = new btRigidBody(rbInfo);
+			m_rigidBody->setUserPointer(entity());
 
 			m_sysState->world->addRigidBody(m_rigidBody);
 		}
+
+		release_shape(previous);
+	}
+
+	void physics_component::release_shape(btCollisionShape* shape) {
+		if (!shape) return;
+
+		i32 refcount = shape->getUserIndex() - 1;
+		if (refcount > 0) {
+			shape->setUserIndex(refcount);
+			return;
+		}
+
+		// back to Bullet's default, so that the next body to use it adds it to collisionShapes again
+		shape->setUserIndex(-1);
+		m_sysState->collisionShapes.remove(shape);
+		if (m_sysState->shapes->owns(shape)) m_sysState->shapes->release(shape);
 	}
 
 	void physics_component::set_mass(f32 mass) {
@@ -167,10 +280,25 @@ namespace r2 {
 
 	physics_system_state::physics_system_state() {
 		collisionConfig = new btDefaultCollisionConfiguration();
-		collisionDispatcher = new btCollisionDispatcher(collisionConfig);
 		broadphaseInterface = new btDbvtBroadphase();
-		constraintSolver = new btSequentialImpulseConstraintSolver();
-		world = new btDiscreteDynamicsWorld(collisionDispatcher, broadphaseInterface, constraintSolver, collisionConfig);
+		solverPool = nullptr;
+		accumulator = 0.0f;
+		stepCount = 0;
+		shapes = new physics_shape_cache();
+
+		if (physics_sys::get()->multithreaded && physics_sys::get()->use_task_scheduler()) {
+			// islands are solved in parallel by the pool, islands too large to split go to the Mt solver
+			collisionDispatcher = new btCollisionDispatcherMt(collisionConfig, PHYSICS_MT_DISPATCH_GRAIN_SIZE);
+			solverPool = new btConstraintSolverPoolMt(btGetTaskScheduler()->getNumThreads());
+			constraintSolver = new btSequentialImpulseConstraintSolverMt();
+			world = new btDiscreteDynamicsWorldMt(collisionDispatcher, broadphaseInterface, solverPool, constraintSolver, collisionConfig);
+		} else {
+			collisionDispatcher = new btCollisionDispatcher(collisionConfig);
+			constraintSolver = new btSequentialImpulseConstraintSolver();
+			world = new btDiscreteDynamicsWorld(collisionDispatcher, broadphaseInterface, constraintSolver, collisionConfig);
+		}
+
+		world->setInternalTickCallback(physics_internal_tick, this);
 	}
 
 	physics_system_state::~physics_system_state() {
@@ -192,7 +320,9 @@ namespace r2 {
 		*/
 
 		delete world;
+		delete shapes;
 		delete constraintSolver;
+		if (solverPool) delete solverPool;
 		delete broadphaseInterface;
 		delete collisionDispatcher;
 		delete collisionConfig;
@@ -200,6 +330,168 @@ namespace r2 {
 	
 
 
+	void physics_system_state::collect_contacts() {
+		m_stepContacts.clear();
+
+		i32 manifoldCount = collisionDispatcher->getNumManifolds();
+		for (i32 i = 0;i < manifoldCount;i++) {
+			btPersistentManifold* manifold = collisionDispatcher->getManifoldByIndexInternal(i);
+			i32 contactCount = manifold->getNumContacts();
+			if (contactCount == 0) continue;
+
+			const btCollisionObject* body0 = manifold->getBody0();
+			const btCollisionObject* body1 = manifold->getBody1();
+			if (!creates_collision_events(body0) && !creates_collision_events(body1)) continue;
+
+			scene_entity* entity0 = (scene_entity*)body0->getUserPointer();
+			scene_entity* entity1 = (scene_entity*)body1->getUserPointer();
+			if (!entity0 || !entity1) continue;
+
+			f32 impulse = 0.0f;
+			i32 deepest = 0;
+			for (i32 c = 0;c < contactCount;c++) {
+				const btManifoldPoint& pt = manifold->getContactPoint(c);
+				impulse += pt.getAppliedImpulse();
+				if (pt.getDistance() < manifold->getContactPoint(deepest).getDistance()) deepest = c;
+			}
+
+			// compound shapes produce a manifold per child, those are merged into one record per pair
+			entityId a = entity0->id();
+			entityId b = entity1->id();
+			u64 key = a < b ? (u64(a) << 32) | b : (u64(b) << 32) | a;
+			auto existing = m_stepContacts.find(key);
+			if (existing != m_stepContacts.end()) {
+				for (auto r = collisions.rbegin();r != collisions.rend();r++) {
+					if ((r->a == a && r->b == b) || (r->a == b && r->b == a)) {
+						r->impulse += impulse;
+						break;
+					}
+				}
+				continue;
+			}
+			m_stepContacts[key] = { a, b };
+
+			const btManifoldPoint& pt = manifold->getContactPoint(deepest);
+			const btVector3& p = pt.getPositionWorldOnB();
+			const btVector3& n = pt.m_normalWorldOnB;
+			collision_event_type type = m_contacts.count(key) > 0 ? cet_persist : cet_begin;
+			collisions.push_back({ type, a, b, vec3f(p.x(), p.y(), p.z()), vec3f(n.x(), n.y(), n.z()), impulse });
+		}
+
+		for (auto& contact : m_contacts) {
+			if (m_stepContacts.count(contact.first) > 0) continue;
+			collisions.push_back({ cet_end, contact.second.a, contact.second.b, vec3f(0.0f), vec3f(0.0f), 0.0f });
+		}
+
+		m_contacts.swap(m_stepContacts);
+	}
+
+
+
+	void physics_system_state::synchronize_transforms(f32 alpha) {
+		if (m_moved.size() == 0) return;
+
+		// gather the world transforms of everything that moved into one dense array
+		m_sync.clear();
+		for (size_t i = 0;i < m_moved.size();) {
+			motion_state* ms = m_moved[i];
+			btTransform t;
+			if (ms->m_step != stepCount) {
+				// came to rest, or was only moved by earlier steps. Settle on the last transform
+				t = ms->m_current;
+				ms->m_moved = false;
+				m_moved[i] = m_moved.back();
+				m_moved.pop_back();
+			} else {
+				if (alpha >= 1.0f) t = ms->m_current;
+				else {
+					t.setOrigin(ms->m_previous.getOrigin().lerp(ms->m_current.getOrigin(), alpha));
+					t.setRotation(ms->m_previous.getRotation().slerp(ms->m_current.getRotation(), alpha));
+				}
+				i++;
+			}
+
+			m_sync.push_back({ ms->entity, nullptr, SIZE_MAX, mat4f(1.0f) });
+			t.getOpenGLMatrix(glm::value_ptr(m_sync.back().world));
+		}
+
+		// transform components hold transforms relative to the parent, which siblings share
+		m_parentInverses.clear();
+		for (moved_body& body : m_sync) {
+			scene_entity* entity = body.entity;
+			mat4f local = body.world;
+
+			scene_entity* parent = entity->parent();
+			if (parent && parent->transform) {
+				auto inverse = m_parentInverses.find(parent);
+				if (inverse == m_parentInverses.end()) {
+					mat4f ptransform = parent->transform->cascaded_property(&transform_component::transform, &cascade_mat4f);
+					inverse = m_parentInverses.emplace(parent, glm::inverse(ptransform)).first;
+				}
+				local = inverse->second * body.world;
+			}
+
+			if (entity->transform) entity->transform->transform = local;
+
+			if (!entity->mesh || !entity->physics->update_mesh_when_moved) continue;
+			mesh_component* mesh = entity->mesh.get();
+			render_node* node = mesh->get_node();
+			if (!node) continue;
+
+			if (node->instances().is_valid()) {
+				body.node = node;
+				body.instanceIdx = node->instance_index(mesh->instance().id());
+			} else {
+				if (!m_nodeTransform.is_valid()) m_nodeTransform = node->uniforms()->handle("transform");
+				node->uniforms()->set(m_nodeTransform, body.world);
+			}
+		}
+
+		// instance transforms are written straight into each node's storage in index order, then each
+		// node's buffer is flagged once for the range that was written
+		std::sort(m_sync.begin(), m_sync.end(), [](const moved_body& a, const moved_body& b) {
+			return a.node != b.node ? a.node < b.node : a.instanceIdx < b.instanceIdx;
+		});
+
+		for (size_t i = 0;i < m_sync.size();) {
+			render_node* node = m_sync[i].node;
+			if (!node || m_sync[i].instanceIdx == SIZE_MAX) {
+				i++;
+				continue;
+			}
+
+			const ins_bo_segment& instances = node->instances();
+			instance_format* fmt = instances.buffer->format();
+			if (!fmt->hasModelMatrix()) {
+				for (;i < m_sync.size() && m_sync[i].node == node;i++);
+				continue;
+			}
+
+			u8* data = ((u8*)instances.buffer->data()) + instances.memBegin + fmt->modelMatrixOffset();
+			size_t stride = fmt->size();
+			size_t first = m_sync[i].instanceIdx;
+			size_t last = first;
+			for (;i < m_sync.size() && m_sync[i].node == node;i++) {
+				if (m_sync[i].instanceIdx == SIZE_MAX) continue;
+				last = m_sync[i].instanceIdx;
+				memcpy(data + (last * stride), &m_sync[i].world[0].x, sizeof(mat4f));
+			}
+
+			node->instances_updated(first, (last - first) + 1);
+		}
+	}
+
+	void physics_system_state::forget_moved(motion_state* state) {
+		for (size_t i = 0;i < m_moved.size();i++) {
+			if (m_moved[i] != state) continue;
+			m_moved[i] = m_moved.back();
+			m_moved.pop_back();
+			break;
+		}
+	}
+
+
+
 	physics_system_state_factory::physics_system_state_factory() {
 	}
 
@@ -215,9 +507,39 @@ namespace r2 {
 	physics_sys::physics_sys() {
 		max_simulation_steps_per_frame = 1;
 		simulation_time_step = 1.0f / 60.0f;
+		multithreaded = false;
+		fixed_timestep = false;
+		m_taskScheduler = nullptr;
 	}
 
 	physics_sys::~physics_sys() {
+		if (m_taskScheduler) {
+			btSetTaskScheduler(btGetSequentialTaskScheduler());
+			delete m_taskScheduler;
+		}
+	}
+
+	bool physics_sys::use_task_scheduler() {
+		if (m_taskScheduler) return true;
+
+		#if BT_THREADSAFE
+			// Bullet indexes its per-thread data by the order threads first call into it, and every thread
+			// marl can run a task on may end up doing so
+			if (marl::Thread::numLogicalCPUs() + 1 > BT_MAX_THREAD_COUNT) {
+				r2Warn("Physics can't use more than %d threads, falling back to single threaded physics", BT_MAX_THREAD_COUNT);
+				return false;
+			}
+
+			// the main thread has to be index 0
+			btGetCurrentThreadIndex();
+
+			m_taskScheduler = new physics_task_scheduler();
+			btSetTaskScheduler(m_taskScheduler);
+			return true;
+		#else
+			r2Warn("Bullet was built without BT_THREADSAFE, falling back to single threaded physics");
+			return false;
+		#endif
 	}
 	
 	void physics_sys::initialize_entity(scene_entity* entity) {
@@ -254,10 +576,71 @@ namespace r2 {
 		m_physState = stateMgr->register_state_data_factory<physics_system_state>(fac);
 	}
 
+	const mvector<collision_record>& physics_sys::collisions() {
+		m_physState.enable();
+		const mvector<collision_record>& records = m_physState->collisions;
+		m_physState.disable();
+		return records;
+	}
+
+	physics_shape_cache* physics_sys::shapes() {
+		m_physState.enable();
+		physics_shape_cache* cache = m_physState->shapes;
+		m_physState.disable();
+		return cache;
+	}
+
+	void physics_sys::raycast(const physics_ray* rays, size_t count, physics_hit* hits, const entityId* ignore) {
+		m_physState.enable();
+		physics_raycast(m_physState.get(), rays, count, hits, ignore);
+		m_physState.disable();
+	}
+
+	void physics_sys::sweep(const physics_sphere_sweep* sweeps, size_t count, physics_hit* hits, const entityId* ignore) {
+		m_physState.enable();
+		physics_sweep(m_physState.get(), sweeps, count, hits, ignore);
+		m_physState.disable();
+	}
+
+	void physics_sys::overlap(const physics_sphere* spheres, size_t count, mvector<u32>& offsets, mvector<entityId>& entities, const entityId* ignore) {
+		m_physState.enable();
+		physics_overlap(m_physState.get(), spheres, count, offsets, entities, ignore);
+		m_physState.disable();
+	}
+
 	void physics_sys::tick(f32 dt) {
 		m_physState.enable();
-		m_physState->world->stepSimulation(dt, max_simulation_steps_per_frame, simulation_time_step);
+		physics_system_state* state = m_physState.get();
+		state->collisions.clear();
+		if (fixed_timestep) {
+			state->accumulator += dt;
+			u32 steps = u32(state->accumulator / simulation_time_step);
+			if (steps > max_simulation_steps_per_frame) {
+				steps = max_simulation_steps_per_frame;
+				state->accumulator = simulation_time_step * f32(steps);
+			}
+			state->accumulator -= simulation_time_step * f32(steps);
+
+			// with no substeps Bullet writes exactly the stepped transforms to the motion states
+			for (u32 s = 0;s < steps;s++) {
+				state->stepCount++;
+				state->world->stepSimulation(simulation_time_step, 0, simulation_time_step);
+			}
+
+			state->synchronize_transforms(state->accumulator / simulation_time_step);
+		} else {
+			// Bullet interpolates the motion states itself here
+			state->stepCount++;
+			state->world->stepSimulation(dt, max_simulation_steps_per_frame, simulation_time_step);
+			state->synchronize_transforms(1.0f);
+		}
 		m_physState.disable();
+
+		if (state->collisions.size() == 0) return;
+
+		event e = evt(EVT_NAME_COLLISION_EVENTS);
+		e.set_buffer(state->collisions.data(), state->collisions.size() * sizeof(collision_record));
+		r2engine::get()->dispatch(&e);
 	}
 
 	void physics_sys::handle(event* evt) {
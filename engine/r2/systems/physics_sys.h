@@ -1,21 +1,84 @@
 #pragma once
 #include <btBulletCollisionCommon.h>
 #include <btBulletDynamicsCommon.h>
+#include <LinearMath/btThreads.h>
 
 #include <r2/systems/entity.h>
+#include <r2/systems/physics_shapes.h>
+#include <r2/systems/physics_queries.h>
+#include <r2/utilities/uniformbuffer.h>
+
+class btConstraintSolverPoolMt;
+
+// number of collision pairs each marl task processes during the narrowphase of a multithreaded world
+#define PHYSICS_MT_DISPATCH_GRAIN_SIZE 40
 
 namespace r2 {
 	class physics_system_state;
+	class render_node;
+
+	enum collision_event_type {
+		cet_begin = 0,
+		cet_persist,
+		cet_end
+	};
+
+	// One pair of bodies touching during a simulation step, at least one of which creates collision events.
+	// 'point' and 'normal' come from the deepest contact, 'normal' points from b to a, 'impulse' is the total
+	// over all contacts. End records only have the entity ids.
+	// Scripts receive these as they are laid out here, 10 32-bit words per record: type, a and b as Uint32,
+	// then point, normal and impulse as Float32
+	struct collision_record {
+		collision_event_type type;
+		entityId a;
+		entityId b;
+		vec3f point;
+		vec3f normal;
+		f32 impulse;
+	};
+	static_assert(sizeof(collision_record) == 10 * sizeof(u32), "collision_record is shared with scripts as 32-bit words");
+
+	// Runs Bullet's parallel loops as tasks on the engine's marl scheduler
+	class physics_task_scheduler : public btITaskScheduler {
+		public:
+			physics_task_scheduler();
+			~physics_task_scheduler();
+
+			virtual int getMaxNumThreads() const { return m_maxThreads; }
+			virtual int getNumThreads() const { return m_numThreads; }
+			virtual void setNumThreads(int numThreads);
+			virtual void parallelFor(int iBegin, int iEnd, int grainSize, const btIParallelForBody& body);
+			virtual btScalar parallelSum(int iBegin, int iEnd, int grainSize, const btIParallelSumBody& body);
+
+		protected:
+			int chunk_size(int count, int grainSize) const;
+
+			int m_maxThreads;
+			int m_numThreads;
+	};
 
 	class motion_state : public btMotionState {
 		public:
-			motion_state(scene_entity* entity);
+			motion_state(scene_entity* entity, physics_system_state* state);
 			~motion_state();
 
 			virtual void getWorldTransform(btTransform& worldTrans) const;
 			virtual void setWorldTransform(const btTransform& worldTrans);
 
+			// Forgets the previous step's transform, for when the body was moved rather than simulated
+			void reset(const btTransform& worldTrans);
+
 			scene_entity* entity;
+
+		protected:
+			friend class physics_system_state;
+			physics_system_state* m_state;
+
+			// the body's transforms after the last two steps it moved in, see physics_sys::fixed_timestep
+			btTransform m_previous;
+			btTransform m_current;
+			u64 m_step;
+			bool m_moved;
 	};
 
 	class physics_component : public scene_entity_component {
@@ -26,6 +89,9 @@ namespace r2 {
 			virtual void destroy();
 
 			void set_transform(const mat4f& transform);
+
+			// Shapes from the state's physics_shape_cache are swapped for the variant matching the entity's scale,
+			// other shapes have the scale applied to them directly
 			void set_shape(btCollisionShape* shape);
 			void set_mass(f32 mass);
 
@@ -41,6 +107,13 @@ namespace r2 {
 			btRigidBody* m_rigidBody;
 			motion_state* m_motionState;
 			physics_system_state* m_sysState;
+
+		private:
+			// 'scale' is the scale the shape should have, rather than the one the entity's transform currently has
+			void set_shape(btCollisionShape* shape, const vec3f& scale);
+
+			// Drops this body's reference to 'shape', which is forgotten (or freed by the shape cache) after the last one
+			void release_shape(btCollisionShape* shape);
 	};
 
 	class physics_system_state : public engine_state_data {
@@ -51,10 +124,54 @@ namespace r2 {
 			btDefaultCollisionConfiguration* collisionConfig;
 			btCollisionDispatcher* collisionDispatcher;
 			btBroadphaseInterface* broadphaseInterface;
-			btSequentialImpulseConstraintSolver* constraintSolver;
+			btConstraintSolver* constraintSolver;
+			btConstraintSolverPoolMt* solverPool;
 			btDiscreteDynamicsWorld* world;
 
 			btAlignedObjectArray<btCollisionShape*> collisionShapes;
+
+			// shared shapes for the bodies of this state
+			physics_shape_cache* shapes;
+
+			// Diffs the dispatcher's contact manifolds against the previous step, appending to 'collisions'
+			void collect_contacts();
+
+			// Writes the transforms of every body that moved to its transform component and mesh in one pass,
+			// blended between the body's last two steps by 'alpha'
+			void synchronize_transforms(f32 alpha);
+			void forget_moved(motion_state* state);
+
+			// every step of the last physics_sys::tick
+			mvector<collision_record> collisions;
+
+			// fixed timestep mode only
+			f32 accumulator;
+
+			// stepSimulation calls so far
+			u64 stepCount;
+
+		protected:
+			friend class motion_state;
+
+			struct contact_pair {
+				entityId a;
+				entityId b;
+			};
+
+			munordered_map<u64, contact_pair> m_contacts;
+			munordered_map<u64, contact_pair> m_stepContacts;
+			// bodies Bullet moved since they were last written, and the scratch data used to write them
+			mvector<motion_state*> m_moved;
+			struct moved_body {
+				scene_entity* entity;
+				render_node* node;
+				size_t instanceIdx;
+				mat4f world;
+			};
+			mvector<moved_body> m_sync;
+			munordered_map<scene_entity*, mat4f> m_parentInverses;
+			// every node block shares the same format, so the transform field is resolved from the first one written
+			uniform_handle m_nodeTransform;
 	};
 
 	class physics_system_state_factory : public engine_state_data_factory {
@@ -87,13 +204,38 @@ namespace r2 {
 
 			engine_state_data_ref<physics_system_state>& physState() { return m_physState; }
 
+			// Contacts of bodies that create collision events from the last tick. These are also dispatched
+			// to scripts as one EVT_NAME_COLLISION_EVENTS event per tick, with the records in its 'buffer'
+			const mvector<collision_record>& collisions();
+
+			// Shape cache of the active state
+			physics_shape_cache* shapes();
+
+			// Batched queries against the active state, see physics_queries.h
+			void raycast(const physics_ray* rays, size_t count, physics_hit* hits, const entityId* ignore = nullptr);
+			void sweep(const physics_sphere_sweep* sweeps, size_t count, physics_hit* hits, const entityId* ignore = nullptr);
+			void overlap(const physics_sphere* spheres, size_t count, mvector<u32>& offsets, mvector<entityId>& entities, const entityId* ignore = nullptr);
+
+			// Installs the marl task scheduler for Bullet, returns false if Bullet can't run on the engine's threads
+			bool use_task_scheduler();
+
 			u32 max_simulation_steps_per_frame;
 			f32 simulation_time_step;
 
+			// Steps the simulation exactly every simulation_time_step seconds, up to max_simulation_steps_per_frame
+			// times per tick. Time beyond that is dropped, so the simulation falls behind instead of taking longer
+			// every frame. Transforms are written once per tick, interpolated between the last two steps
+			bool fixed_timestep;
+
+			// States created while this is set get a btDiscreteDynamicsWorldMt, which needs Bullet
+			// to be built with BT_THREADSAFE (R2_BULLET_MULTITHREADING)
+			bool multithreaded;
+
 		protected:
 			physics_sys();
 			static physics_sys* instance;
 			engine_state_data_ref<physics_system_state> m_physState;
+			physics_task_scheduler* m_taskScheduler;
 	};
 };
 
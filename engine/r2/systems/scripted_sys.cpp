@@ -18,9 +18,12 @@ namespace r2 {
 	scripted_system_state::scripted_system_state(LocalObjectHandle& object) {
 		Isolate* isolate = r2engine::scripts()->context()->isolate();
 		data.Reset(isolate, object);
+		components.Reset(isolate, Array::New(isolate, 0));
 	}
 
 	scripted_system_state::~scripted_system_state() {
+		data.Reset();
+		components.Reset();
 	}
 
 
@@ -35,7 +38,7 @@ namespace r2 {
 	}
 
 
-	scripted_sys::scripted_sys(v8Args args) : factory(nullptr) {
+	scripted_sys::scripted_sys(v8Args args) : factory(nullptr), m_tickSite(SCRIPT_CALL_SITE_NONE), m_handleSite(SCRIPT_CALL_SITE_NONE) {
 		if (args.Length() != 3 && args.Length() != 4) {
 			r2Error("Script systems must be constructed with 'super(<system state class>, <component class>, <name of system>);'");
 			return;
@@ -125,6 +128,8 @@ namespace r2 {
 	}
 
 	void scripted_sys::bind(scene_entity_component* component, scene_entity* entity) {
+		add_to_component_list((scripted_component*)component, entity);
+
 		if (entity->is_scripted()) {
 			// bind scripted component properties
 			// entity->bind(component, "transform", &c::transform, false, true, &cascade_mat4f, "full_transform");
@@ -154,6 +159,57 @@ namespace r2 {
 
 			entity->unbind(m_componentScriptAccessorName);
 		}
+
+		remove_from_component_list(entity);
+	}
+
+	void scripted_sys::add_to_component_list(scripted_component* component, scene_entity* entity) {
+		Isolate* isolate = r2engine::scripts()->context()->isolate();
+		HandleScope scope(isolate);
+		Local<Context> context = isolate->GetCurrentContext();
+
+		// plain properties, so scripts don't call back into the engine to read them
+		Local<Object> object = component->data->handle.Get(isolate);
+		object->DefineOwnProperty(context, v8str("entity"), Local<Value>::Cast(convert<scene_entity*>::to_v8(isolate, entity)), PropertyAttribute::ReadOnly).FromJust();
+		object->DefineOwnProperty(context, v8str("id"), Local<Value>::Cast(convert<componentId>::to_v8(isolate, component->id())), PropertyAttribute::ReadOnly).FromJust();
+
+		scriptedState.enable();
+		Local<Array> list = scriptedState->components.Get(isolate);
+		u32 idx = list->Length();
+		list->Set(context, idx, object).FromJust();
+		scriptedState->componentEntities.push_back(entity);
+		scriptedState->componentIndices[entity->id()] = idx;
+		scriptedState.disable();
+	}
+
+	void scripted_sys::remove_from_component_list(scene_entity* entity) {
+		Isolate* isolate = r2engine::scripts()->context()->isolate();
+		HandleScope scope(isolate);
+		Local<Context> context = isolate->GetCurrentContext();
+
+		scriptedState.enable();
+		auto& indices = scriptedState->componentIndices;
+		auto& entities = scriptedState->componentEntities;
+		auto it = indices.find(entity->id());
+		if (it == indices.end()) {
+			scriptedState.disable();
+			return;
+		}
+
+		// move the last component into the removed one's place
+		u32 idx = it->second;
+		u32 last = u32(entities.size() - 1);
+		Local<Array> list = scriptedState->components.Get(isolate);
+		if (idx != last) {
+			list->Set(context, idx, list->Get(context, last).ToLocalChecked()).FromJust();
+			entities[idx] = entities[last];
+			indices[entities[idx]->id()] = idx;
+		}
+
+		list->Set(context, v8str("length"), Integer::NewFromUnsigned(isolate, last)).FromJust();
+		entities.pop_back();
+		indices.erase(entity->id());
+		scriptedState.disable();
 	}
 
 	void scripted_sys::initialize() {
@@ -197,6 +253,8 @@ namespace r2 {
 			Local<Value>::Cast(convert<f32>::to_v8(isolate, frameDt)),
 			Local<Value>::Cast(convert<f32>::to_v8(isolate, updateDt))
 		};
+		script_profiler* profiler = r2engine::scripts()->profiler();
+		script_call_scope scope(profiler, profiler->site(m_tickSite, "system", name, "tick"));
 		m_tickFunc.Get(isolate)->Call(isolate->GetCurrentContext(), m_self.Get(isolate), 2, params);
 		check_script_exception(isolate, tc);
 	}
@@ -205,32 +263,93 @@ namespace r2 {
 		Isolate* isolate = r2engine::scripts()->context()->isolate();
 		TryCatch tc(isolate);
 		auto param = Local<Value>::Cast(convert<event>::to_v8(isolate, *evt));
+		script_profiler* profiler = r2engine::scripts()->profiler();
+		script_call_scope scope(profiler, profiler->site(m_handleSite, "system", name, "handleEvent"));
 		m_handleFunc.Get(isolate)->Call(isolate->GetCurrentContext(), m_self.Get(isolate), 1, &param);
 		check_script_exception(isolate, tc);
 	}
 
+	// Bits for the engine components that query_components can filter by
+	enum builtin_component_bit {
+		bcb_transform = 1 << 0,
+		bcb_camera = 1 << 1,
+		bcb_mesh = 1 << 2,
+		bcb_physics = 1 << 3,
+		bcb_lighting = 1 << 4,
+		bcb_animation = 1 << 5
+	};
+
+	static bool parse_component_mask(Isolate* isolate, Local<Value> names, u32* mask) {
+		*mask = 0;
+		if (names.IsEmpty() || names->IsUndefined()) return true;
+		if (!names->IsArray()) {
+			r2Error("query_components filters 'with' and 'without' must be arrays of component names");
+			return false;
+		}
+
+		Local<Array> arr = Local<Array>::Cast(names);
+		for (u32 i = 0;i < arr->Length();i++) {
+			mstring name = convert<mstring>::from_v8(isolate, arr->Get(i));
+			if (name == "transform") *mask |= bcb_transform;
+			else if (name == "camera") *mask |= bcb_camera;
+			else if (name == "mesh") *mask |= bcb_mesh;
+			else if (name == "physics") *mask |= bcb_physics;
+			else if (name == "lighting") *mask |= bcb_lighting;
+			else if (name == "animation") *mask |= bcb_animation;
+			else {
+				r2Error("query_components can't filter by unknown component '%s'", name.c_str());
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	static u32 component_mask(scene_entity* entity, u32 relevant) {
+		u32 mask = 0;
+		if ((relevant & bcb_transform) && entity->transform) mask |= bcb_transform;
+		if ((relevant & bcb_camera) && entity->camera) mask |= bcb_camera;
+		if ((relevant & bcb_mesh) && entity->mesh) mask |= bcb_mesh;
+		if ((relevant & bcb_physics) && entity->physics) mask |= bcb_physics;
+		if ((relevant & bcb_lighting) && entity->lighting) mask |= bcb_lighting;
+		if ((relevant & bcb_animation) && entity->animation) mask |= bcb_animation;
+		return mask;
+	}
+
 	void scripted_sys::queryComponents(v8Args args) {
 		Isolate* isolate = args.GetIsolate();
 		EscapableHandleScope scope(isolate);
-		
-		mvector<scripted_component*> results;
 
-		auto& s = state();
-		s.enable();
-		s->for_each<scripted_component>([&results](scripted_component* comp) {
-			// todo: filters
-			results.push_back(comp);
-			return true;
-		});
-		s.disable();
+		scriptedState.enable();
+		Local<Array> list = scriptedState->components.Get(isolate);
 
-		Local<Array> arr = Array::New(isolate, results.size());
-		for (size_t i = 0;i < results.size();i++) {
-			scripted_component* comp = results[i];
-			arr->Set(i, comp->data->handle.Get(isolate));
+		// without filters the maintained list is returned, scripts should treat it as read only
+		if (args.Length() == 0 || !args[0]->IsObject()) {
+			scriptedState.disable();
+			args.GetReturnValue().Set(scope.Escape(list));
+			return;
 		}
 
-		args.GetReturnValue().Set(scope.Escape(arr));
+		// { with: ['mesh', ...], without: ['physics', ...] }
+		Local<Object> filters = Local<Object>::Cast(args[0]);
+		u32 with = 0, without = 0;
+		if (!parse_component_mask(isolate, filters->Get(v8str("with")), &with) || !parse_component_mask(isolate, filters->Get(v8str("without")), &without)) {
+			scriptedState.disable();
+			return;
+		}
+
+		Local<Context> context = isolate->GetCurrentContext();
+		Local<Array> results = Array::New(isolate);
+		u32 count = 0;
+		auto& entities = scriptedState->componentEntities;
+		for (u32 i = 0;i < entities.size();i++) {
+			u32 mask = component_mask(entities[i], with | without);
+			if ((mask & with) != with || (mask & without) != 0) continue;
+			results->Set(context, count++, list->Get(context, i).ToLocalChecked()).FromJust();
+		}
+		scriptedState.disable();
+
+		args.GetReturnValue().Set(scope.Escape(results));
 	}
 
 	LocalObjectHandle scripted_sys::spawn_state_data() {
@@ -246,23 +365,7 @@ namespace r2 {
 		LocalFunctionHandle constructor = m_compClass.Get(isolate);
 		Local<Value> result;
 		constructor->CallAsConstructor(isolate->GetCurrentContext(), 0, nullptr).ToLocal(&result);
-		LocalObjectHandle object = LocalObjectHandle::Cast(result);
-
-		auto get_entity = v8pp::wrap_function(isolate, nullptr, [this, id](v8Args args) {
-			auto& s = this->state();
-			s.enable();
-			args.GetReturnValue().Set(Local<Value>::Cast(convert<scene_entity*>::to_v8(args.GetIsolate(), s->entity(id)->entity())));
-			s.disable();
-		});
-		auto get_id = v8pp::wrap_function(isolate, nullptr, [this, id](v8Args args) {
-			auto& s = this->state();
-			s.enable();
-			args.GetReturnValue().Set(Local<Value>::Cast(convert<componentId>::to_v8(args.GetIsolate(), s->entity(id)->id())));
-			s.disable();
-		});
-		object->SetAccessorProperty(v8str("entity"), get_entity);
-		object->SetAccessorProperty(v8str("id"), get_id);
-
-		return object;
+		// 'entity' and 'id' are defined when the component is bound
+		return LocalObjectHandle::Cast(result);
 	}
 };
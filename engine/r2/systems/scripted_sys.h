@@ -22,6 +22,12 @@ namespace r2 {
 			~scripted_system_state();
 
 			PersistentObjectHandle data;
+
+			// Component data of every entity that has this system's component in this state. Updated as
+			// components are bound and unbound, and handed to scripts by query_components as-is
+			PersistentArrayHandle components;
+			mvector<scene_entity*> componentEntities;
+			munordered_map<entityId, u32> componentIndices;
 	};
 
 	class scripted_sys;
@@ -55,6 +61,9 @@ namespace r2 {
 
 			void queryComponents(v8Args args);
 
+			void add_to_component_list(scripted_component* component, scene_entity* entity);
+			void remove_from_component_list(scene_entity* entity);
+
 			LocalObjectHandle spawn_state_data();
 			LocalObjectHandle spawn_component_data(entityId id);
 
@@ -71,5 +80,7 @@ namespace r2 {
 			PersistentFunctionHandle m_unbindFunc;
 			PersistentFunctionHandle m_handleFunc;
 			PersistentFunctionHandle m_tickFunc;
+			script_call_site m_tickSite;
+			script_call_site m_handleSite;
 	};
 };
\ No newline at end of file
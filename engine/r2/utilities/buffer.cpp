@@ -1,9 +1,10 @@
 #include <r2/utilities/buffer.h>
 #include <r2/managers/renderman.h>
+#include <memory.h>
 
 namespace r2 {
     static size_t nextBufferId = 0;
-	gpu_buffer::gpu_buffer(size_t max_size) : m_id(nextBufferId++), m_size(max_size), m_used(0) {
+	gpu_buffer::gpu_buffer(size_t max_size, bool dynamic) : m_id(nextBufferId++), m_size(max_size), m_used(0), m_dynamic(dynamic), m_freeSize(0), m_updateGeneration(0) {
     }
 
 	gpu_buffer::~gpu_buffer() {
@@ -11,29 +12,62 @@ namespace r2 {
     }
 
 	void gpu_buffer::appended(size_t begin, size_t end) {
-		m_used = end;
+		if (end > m_used) m_used = end;
 		updated(begin, end);
 	}
 
 	void gpu_buffer::updated(size_t begin, size_t end) {
+		merge_update(m_updates, begin, end);
+	}
+
+	void gpu_buffer::merge_update(mlist<changed_buffer_segment>& updates, size_t begin, size_t end) {
 		/*
 		Find out if this update record can be combined with
-		another to reduce calls to GPU driver code
+		others to reduce calls to GPU driver code. The list is
+		kept sorted by begin offset, so only the ranges that
+		overlap (or nearly overlap) the new one need to be visited
 		*/
 
-		for (auto& seg : m_updates) {
-			if (seg.end == begin) { seg.end = end; return; }
-			if (seg.begin == end) { seg.begin = begin; return; }
+		auto it = updates.begin();
+		while (it != updates.end() && it->end + GPU_BUFFER_UPDATE_MERGE_GAP < begin) it++;
+
+		while (it != updates.end() && it->begin <= end + GPU_BUFFER_UPDATE_MERGE_GAP) {
+			if (it->begin < begin) begin = it->begin;
+			if (it->end > end) end = it->end;
+			it = updates.erase(it);
 		}
 
-		// It can't
-		m_updates.push_back({ begin, end });
+		updates.insert(it, { begin, end });
+
+		if (updates.size() <= GPU_BUFFER_MAX_UPDATE_RANGES) return;
+
+		// Too many ranges, merge the two that are closest together
+		auto closest = updates.begin();
+		size_t closestGap = SIZE_MAX;
+		for (auto seg = updates.begin();seg != updates.end();seg++) {
+			auto next = std::next(seg);
+			if (next == updates.end()) break;
+
+			size_t gap = next->begin - seg->end;
+			if (gap < closestGap) {
+				closestGap = gap;
+				closest = seg;
+			}
+		}
+
+		auto next = std::next(closest);
+		closest->end = next->end;
+		updates.erase(next);
 	}
 
 	size_t gpu_buffer::id() const {
 		return m_id;
 	}
 
+	bool gpu_buffer::is_dynamic() const {
+		return m_dynamic;
+	}
+
 	bool gpu_buffer::has_updates() const { 
 		return m_updates.size() > 0;
 	}
@@ -44,6 +78,7 @@ namespace r2 {
 
 	void gpu_buffer::clear_updates() {
 		m_updates.clear();
+		m_updateGeneration++;
 	}
 
 	size_t gpu_buffer::used_size() const {
@@ -55,6 +90,98 @@ namespace r2 {
 	size_t gpu_buffer::max_size() const {
 		return m_size;
 	}
+	size_t gpu_buffer::free_size() const {
+		return m_freeSize;
+	}
+	const mlist<gpu_buffer::free_buffer_segment>& gpu_buffer::free_segments() const {
+		return m_free;
+	}
+
+	static inline size_t align_offset(size_t offset, size_t alignment) {
+		if (alignment <= 1) return offset;
+		size_t diff = offset % alignment;
+		return diff == 0 ? offset : offset + (alignment - diff);
+	}
+
+	bool gpu_buffer::allocate(size_t size, size_t* outBegin) {
+		size_t alignment = allocation_alignment();
+
+		// first fit from the free list
+		for (auto it = m_free.begin();it != m_free.end();it++) {
+			size_t begin = align_offset(it->begin, alignment);
+			if (begin + size > it->end) continue;
+
+			size_t segBegin = it->begin;
+			size_t segEnd = it->end;
+			it = m_free.erase(it);
+			if (segBegin < begin) m_free.insert(it, { segBegin, begin });
+			if (begin + size < segEnd) m_free.insert(it, { begin + size, segEnd });
+			m_freeSize -= size;
+
+			*outBegin = begin;
+			return true;
+		}
+
+		// then from the end of the buffer
+		size_t begin = align_offset(m_used, alignment);
+		if (begin + size > m_size) return false;
+
+		if (begin > m_used) {
+			m_free.push_back({ m_used, begin });
+			m_freeSize += begin - m_used;
+		}
+		m_used = begin + size;
+
+		*outBegin = begin;
+		return true;
+	}
+
+	bool gpu_buffer::can_allocate(size_t size) const {
+		size_t alignment = allocation_alignment();
+		if (align_offset(m_used, alignment) + size <= m_size) return true;
+
+		for (auto& seg : m_free) {
+			if (align_offset(seg.begin, alignment) + size <= seg.end) return true;
+		}
+
+		return false;
+	}
+
+	void gpu_buffer::release(size_t begin, size_t end) {
+		if (begin >= end) return;
+
+		auto it = m_free.begin();
+		while (it != m_free.end() && it->end < begin) it++;
+
+		// merge with exactly adjacent free ranges
+		while (it != m_free.end() && it->begin <= end) {
+			if (it->begin < begin) begin = it->begin;
+			if (it->end > end) end = it->end;
+			m_freeSize -= it->end - it->begin;
+			it = m_free.erase(it);
+		}
+
+		if (end == m_used) {
+			// give the range back to the unused end of the buffer
+			m_used = begin;
+			return;
+		}
+
+		m_free.insert(it, { begin, end });
+		m_freeSize += end - begin;
+	}
+
+	void gpu_buffer::relocate(size_t from, size_t to, size_t size) {
+		if (from == to || size == 0) return;
+		memmove((u8*)data() + to, (u8*)data() + from, size);
+		updated(to, to + size);
+	}
+
+	void gpu_buffer::compacted(size_t used) {
+		m_free.clear();
+		m_freeSize = 0;
+		m_used = used;
+	}
 
 
 	buffer_pool::buffer_pool() {
@@ -64,7 +191,21 @@ namespace r2 {
 	}
 
 	void buffer_pool::sync_buffers(render_driver* driver) {
-		for (auto buf : m_buffers) driver->sync_buffer(buf);
+		for (auto it = m_buffers.begin();it != m_buffers.end();) {
+			gpu_buffer* buf = *it;
+
+			// Buffers that no longer contain anything are given back to the
+			// driver, as long as there's at least one other buffer in the pool
+			if (buf->used_size() == 0 && m_buffers.size() > 1) {
+				driver->free_buffer(buf);
+				delete buf;
+				it = m_buffers.erase(it);
+				continue;
+			}
+
+			driver->sync_buffer(buf);
+			it++;
+		}
 	}
 	void buffer_pool::free_buffers(render_driver* driver) {
 		for (auto buf : m_buffers) {
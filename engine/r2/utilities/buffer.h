@@ -3,6 +3,18 @@
 #include <r2/managers/memman.h>
 #include <stddef.h>
 
+// Dirty ranges closer together than this many bytes are merged into one,
+// uploading a few unchanged bytes is cheaper than issuing another copy
+#define GPU_BUFFER_UPDATE_MERGE_GAP		256
+
+// Upper bound on the number of dirty ranges a buffer will track at once.
+// Once exceeded, the two ranges with the smallest gap between them are merged
+#define GPU_BUFFER_MAX_UPDATE_RANGES	16
+
+// Fraction of a buffer's used range that must be sitting in its free list
+// before the scene relocates segments to close the gaps
+#define GPU_BUFFER_COMPACTION_THRESHOLD	0.25f
+
 namespace r2 {
     struct gpu_buffer_segment {
 		gpu_buffer_segment() : begin(0), end(0), memBegin(0), memEnd(0) { }
@@ -21,30 +33,61 @@ namespace r2 {
     class gpu_buffer {
         public:
 			typedef struct { size_t begin, end; } changed_buffer_segment;
+			typedef struct { size_t begin, end; } free_buffer_segment;
 
-			gpu_buffer(size_t max_size);
+			gpu_buffer(size_t max_size, bool dynamic = false);
             virtual ~gpu_buffer();
 
 			virtual void* data() const = 0;
 
             size_t id() const;
 
+			// Dynamic buffers are expected to be updated every frame, drivers
+			// may stream them through persistently mapped storage
+			bool is_dynamic() const;
+
 			bool has_updates() const;
 			const mlist<changed_buffer_segment>& updates() const;
 			void clear_updates();
+			// Incremented every time the updates are cleared (once per sync)
+			inline size_t update_generation() const { return m_updateGeneration; }
 
 			size_t used_size() const;
 			size_t unused_size() const;
 			size_t max_size() const;
+			size_t free_size() const;
+			const mlist<free_buffer_segment>& free_segments() const;
+
+			// Reserves a range of the buffer, reusing released ranges before growing
+			// into the unused space at the end of the buffer
+			bool allocate(size_t size, size_t* outBegin);
+			bool can_allocate(size_t size) const;
+			void release(size_t begin, size_t end);
+
+			// Offsets returned by allocate will be a multiple of this
+			virtual size_t allocation_alignment() const { return 1; }
+
+			// Moves a range of the buffer's data to a new offset (used when compacting)
+			void relocate(size_t from, size_t to, size_t size);
+			// Called after all live ranges were relocated to [0, used)
+			void compacted(size_t used);
 
 			void appended(size_t begin, size_t end);
 			void updated(size_t begin, size_t end);
 
+			// Adds [begin, end) to a sorted list of dirty ranges, coalescing it
+			// with nearby ranges and keeping the list bounded in length
+			static void merge_update(mlist<changed_buffer_segment>& updates, size_t begin, size_t end);
+
         protected:
             size_t m_id;
 			size_t m_size;
 			size_t m_used;
+			bool m_dynamic;
 			mlist<changed_buffer_segment> m_updates;
+			size_t m_updateGeneration;
+			mlist<free_buffer_segment> m_free;
+			size_t m_freeSize;
     };
 
 	class render_driver;
@@ -60,7 +103,7 @@ namespace r2 {
 			template<typename T, typename ... construction_args>
 			T* find_buffer(size_t bytesNeeded, construction_args ... args) {
 				for (auto buf : m_buffers) {
-					if (buf->unused_size() >= bytesNeeded) return (T*)buf;
+					if (buf->can_allocate(bytesNeeded)) return (T*)buf;
 				}
 
 				// no buffer available with enough size
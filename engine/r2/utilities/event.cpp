@@ -24,6 +24,7 @@ namespace r2 {
 		m_recurse = o.m_recurse;
 		m_internalOnly = o.m_internalOnly;
 		m_jsonData = o.m_jsonData;
+		m_buffer = o.m_buffer;
 		m_data = o.m_data;
 		const_cast<event&>(o).m_data = nullptr;
 	}
@@ -82,9 +83,24 @@ namespace r2 {
 	}
 
 	v8::Local<v8::Value> event::get_json() {
+		if (m_jsonData.length() == 0) return v8::Undefined(r2engine::isolate());
 		return var(r2engine::isolate(), m_jsonData).value;
 	}
 
+	void event::set_buffer(const void* data, size_t size) {
+		m_buffer.resize(size);
+		if (size > 0) memcpy(m_buffer.data(), data, size);
+	}
+
+	v8::Local<v8::Value> event::get_buffer() {
+		v8::Isolate* isolate = r2engine::isolate();
+		if (m_buffer.size() == 0) return v8::Undefined(isolate);
+
+		v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(isolate, m_buffer.size());
+		memcpy(buffer->GetContents().Data(), m_buffer.data(), m_buffer.size());
+		return buffer;
+	}
+
 
 
     event_receiver::event_receiver(memory_allocator* memory) : m_memory(memory), m_isAtFrameStart(true) {
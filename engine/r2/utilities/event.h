@@ -14,6 +14,7 @@
 #define EVT_NAME_MOUSE_EVENT			"MouseEvent"
 #define EVT_NAME_KEYBOARD_EVENT			"KeyEvent"
 #define EVT_NAME_JOYSTICK_EVENT			"JoystickEvent"
+#define EVT_NAME_COLLISION_EVENTS		"CollisionEvents"
 
 namespace r2 {
     class data_container;
@@ -49,10 +50,16 @@ namespace r2 {
 			void set_json(v8Args args);
 			v8::Local<v8::Value> get_json();
 
+			// Raw bytes handed to scripts as an ArrayBuffer, for payloads too large to send as JSON
+			void set_buffer(const void* data, size_t size);
+			const mvector<u8>& buffer() const { return m_buffer; }
+			v8::Local<v8::Value> get_buffer();
+
         protected:
             caller m_caller;
             data_container* m_data;
 			mstring m_jsonData;
+			mvector<u8> m_buffer;
             mstring m_name;
             bool m_recurse;
 			bool m_internalOnly;
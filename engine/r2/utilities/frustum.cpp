@@ -0,0 +1,131 @@
+#include <r2/utilities/frustum.h>
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+	#define R2_FRUSTUM_SSE
+	#include <emmintrin.h>
+#endif
+
+namespace r2 {
+	bounding_volume::bounding_volume() : min(0.0f), max(0.0f), center(0.0f), radius(0.0f), valid(false) { }
+
+	void bounding_volume::from_points(const void* data, size_t count, size_t stride, u8 components) {
+		valid = false;
+		if (!data || count == 0 || components < 2 || components > 4) return;
+
+		const u8* ptr = (const u8*)data;
+		min = vec3f(FLT_MAX);
+		max = vec3f(-FLT_MAX);
+		for (size_t i = 0;i < count;i++) {
+			const f32* p = (const f32*)(ptr + (i * stride));
+			vec3f pos = vec3f(p[0], p[1], components > 2 ? p[2] : 0.0f);
+			min = glm::min(min, pos);
+			max = glm::max(max, pos);
+		}
+
+		center = (min + max) * 0.5f;
+		radius = 0.0f;
+		for (size_t i = 0;i < count;i++) {
+			const f32* p = (const f32*)(ptr + (i * stride));
+			vec3f pos = vec3f(p[0], p[1], components > 2 ? p[2] : 0.0f);
+			vec3f d = pos - center;
+			radius = glm::max(radius, glm::dot(d, d));
+		}
+		radius = sqrtf(radius);
+		valid = true;
+	}
+
+	vec4f bounding_volume::transformed_sphere(const mat4f& transform) const {
+		vec3f c = transform * vec4f(center, 1.0f);
+
+		// scale the radius by the largest axis scale, so non-uniform scaling stays conservative
+		f32 sx = glm::dot(vec3f(transform[0]), vec3f(transform[0]));
+		f32 sy = glm::dot(vec3f(transform[1]), vec3f(transform[1]));
+		f32 sz = glm::dot(vec3f(transform[2]), vec3f(transform[2]));
+		f32 scale = sqrtf(glm::max(sx, glm::max(sy, sz)));
+
+		return vec4f(c, radius * scale);
+	}
+
+
+
+	frustum::frustum() {
+		memset(m_planes, 0, sizeof(m_planes));
+	}
+
+	frustum::frustum(const mat4f& view_proj) {
+		set(view_proj);
+	}
+
+	frustum::~frustum() {
+	}
+
+	void frustum::set(const mat4f& m) {
+		vec4f row0 = vec4f(m[0][0], m[1][0], m[2][0], m[3][0]);
+		vec4f row1 = vec4f(m[0][1], m[1][1], m[2][1], m[3][1]);
+		vec4f row2 = vec4f(m[0][2], m[1][2], m[2][2], m[3][2]);
+		vec4f row3 = vec4f(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+		vec4f planes[6] = {
+			row3 + row0, // left
+			row3 - row0, // right
+			row3 + row1, // bottom
+			row3 - row1, // top
+			row3 + row2, // near
+			row3 - row2  // far
+		};
+
+		for (u8 p = 0;p < 6;p++) {
+			f32 len = glm::length(vec3f(planes[p]));
+			if (len > 0.0f) planes[p] /= len;
+			for (u8 c = 0;c < 4;c++) m_planes[c][p] = planes[p][c];
+		}
+	}
+
+	bool frustum::test_sphere(const vec4f& s) const {
+		for (u8 p = 0;p < 6;p++) {
+			f32 d = (m_planes[0][p] * s.x) + (m_planes[1][p] * s.y) + (m_planes[2][p] * s.z) + m_planes[3][p];
+			if (d < -s.w) return false;
+		}
+
+		return true;
+	}
+
+	size_t frustum::test_spheres(const vec4f* spheres, size_t count, u8* outVisible) const {
+		size_t visible = 0;
+		size_t i = 0;
+
+		#ifdef R2_FRUSTUM_SSE
+		for (;i + 4 <= count;i += 4) {
+			__m128 x = _mm_set_ps(spheres[i + 3].x, spheres[i + 2].x, spheres[i + 1].x, spheres[i].x);
+			__m128 y = _mm_set_ps(spheres[i + 3].y, spheres[i + 2].y, spheres[i + 1].y, spheres[i].y);
+			__m128 z = _mm_set_ps(spheres[i + 3].z, spheres[i + 2].z, spheres[i + 1].z, spheres[i].z);
+			__m128 nr = _mm_set_ps(-spheres[i + 3].w, -spheres[i + 2].w, -spheres[i + 1].w, -spheres[i].w);
+
+			// a lane stays set while its sphere is on the inner side of every plane
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (u8 p = 0;p < 6;p++) {
+				__m128 d = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m_planes[0][p])), _mm_mul_ps(y, _mm_set1_ps(m_planes[1][p]))),
+					_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m_planes[2][p])), _mm_set1_ps(m_planes[3][p]))
+				);
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(d, nr));
+			}
+
+			int mask = _mm_movemask_ps(inside);
+			for (u8 l = 0;l < 4;l++) {
+				u8 v = (mask >> l) & 1;
+				outVisible[i + l] = v;
+				visible += v;
+			}
+		}
+		#endif
+
+		for (;i < count;i++) {
+			u8 v = test_sphere(spheres[i]) ? 1 : 0;
+			outVisible[i] = v;
+			visible += v;
+		}
+
+		return visible;
+	}
+};
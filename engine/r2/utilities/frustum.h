@@ -0,0 +1,42 @@
+#pragma once
+#include <r2/managers/memman.h>
+#include <r2/config.h>
+
+namespace r2 {
+	// Local space bounds of a mesh, computed from its vertex positions
+	struct bounding_volume {
+		bounding_volume();
+
+		// positions are read as the first 2-4 floats of each element
+		void from_points(const void* data, size_t count, size_t stride, u8 components);
+
+		// world space bounding sphere (xyz = center, w = radius)
+		vec4f transformed_sphere(const mat4f& transform) const;
+
+		vec3f min;
+		vec3f max;
+		vec3f center;
+		f32 radius;
+		bool valid;
+	};
+
+	class frustum {
+		public:
+			frustum();
+			frustum(const mat4f& view_proj);
+			~frustum();
+
+			// extracts the normalized clip planes from a view projection matrix
+			void set(const mat4f& view_proj);
+
+			bool test_sphere(const vec4f& sphere) const;
+
+			// Tests spheres 4 at a time against all planes, outVisible[i] is set to
+			// 1 or 0. Returns the number of visible spheres
+			size_t test_spheres(const vec4f* spheres, size_t count, u8* outVisible) const;
+
+		protected:
+			// plane components stored as structure of arrays, [component][plane]
+			f32 m_planes[4][6];
+	};
+};
@@ -25,8 +25,12 @@ namespace r2 {
 	void* index_buffer::data() const {
 		return m_data;
 	}
+	size_t index_buffer::allocation_alignment() const {
+		return m_type;
+	}
     idx_bo_segment index_buffer::append(const void *data, size_t count) {
-        if(count > m_maxCount - m_indexCount) {
+		size_t memBegin = 0;
+        if(!allocate(count * m_type, &memBegin)) {
             r2Error("Insufficient space in index buffer of type [%s] for %d indices (%d max) (buf: %d)", index_names[m_type], count, m_maxCount, m_id);
             idx_bo_segment seg;
             seg.buffer = nullptr;
@@ -36,8 +40,8 @@ namespace r2 {
 
         idx_bo_segment seg;
         seg.buffer = this;
-        seg.begin = m_indexCount;
-        seg.memBegin = used_size();
+        seg.begin = memBegin / m_type;
+        seg.memBegin = memBegin;
         seg.end = seg.begin + count;
         seg.memEnd = seg.end * m_type;
 
@@ -60,12 +64,12 @@ namespace r2 {
 			return;
 		}
 
-		if (seg.memBegin > m_type * m_indexCount) {
+		if (seg.memBegin > used_size()) {
 			r2Error("Out of range segment.memBegin (%llu) provided to index_buffer::update", seg.memBegin);
 			return;
 		}
 
-		if (seg.memEnd > m_type * m_indexCount) {
+		if (seg.memEnd > used_size()) {
 			r2Error("Out of range segment.memEnd (%llu) provided to index_buffer::update", seg.memEnd);
 			return;
 		}
@@ -73,4 +77,15 @@ namespace r2 {
 		memcpy((u8*)m_data + seg.memBegin, data, seg.memsize());
 		updated(seg.memBegin, seg.memEnd);
 	}
+
+	void index_buffer::release(const idx_bo_segment& seg) {
+		if (!seg.is_valid()) return;
+		if (seg.buffer != this) {
+			r2Error("Segment for another index buffer passed to index_buffer::release");
+			return;
+		}
+
+		gpu_buffer::release(seg.memBegin, seg.memEnd);
+		m_indexCount -= seg.size();
+	}
 }
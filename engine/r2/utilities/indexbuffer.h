@@ -34,9 +34,11 @@ namespace r2 {
 
             index_type type() const;
 			virtual void* data() const;
+			virtual size_t allocation_alignment() const;
 
             idx_bo_segment append(const void* data, size_t count);
 			void update(const idx_bo_segment& segment, const void* data);
+			void release(const idx_bo_segment& segment);
 
         protected:
             index_type m_type;
@@ -30,8 +30,12 @@ namespace r2 {
 		"m4i", "m4f", "m4u",
 	};
 
+	// format registry, hash name -> id
+	static munordered_map<mstring, u16> instance_format_ids;
+
     instance_format::instance_format() {
         m_instanceSize = 0;
+		m_id = 0;
 		m_modelMatrixOffset = SIZE_MAX;
     }
 
@@ -40,6 +44,7 @@ namespace r2 {
         m_instanceSize = o.m_instanceSize;
         m_fmtString = o.m_fmtString;
 		m_hashName = o.m_hashName;
+		m_id = o.m_id;
     }
 
     instance_format::~instance_format() {
@@ -63,6 +68,7 @@ namespace r2 {
         if(m_fmtString.length() > 0) m_fmtString += ", ";
         m_fmtString += instance_attr_names[type];
 		m_hashName += instance_attr_hash_names[type];
+		m_id = 0;
     }
 
     bool instance_format::operator==(const instance_format &rhs) const {
@@ -97,10 +103,21 @@ namespace r2 {
 	mstring instance_format::hash_name() const {
 		return m_hashName;
 	}
+	u16 instance_format::id() const {
+		if (m_id == 0) {
+			auto it = instance_format_ids.find(m_hashName);
+			if (it == instance_format_ids.end()) {
+				m_id = u16(instance_format_ids.size() + 1);
+				instance_format_ids[m_hashName] = m_id;
+			} else m_id = it->second;
+		}
+
+		return m_id;
+	}
 
 
 
-    instance_buffer::instance_buffer(instance_format* fmt, size_t max_count) : gpu_buffer(max_count * fmt->size()) {
+    instance_buffer::instance_buffer(instance_format* fmt, size_t max_count) : gpu_buffer(max_count * fmt->size(), true) {
         m_format = fmt;
         m_maxCount = max_count;
         m_instanceCount = 0;
@@ -122,8 +139,13 @@ namespace r2 {
 		return m_data;
 	}
 
+	size_t instance_buffer::allocation_alignment() const {
+		return m_format->size();
+	}
+
     ins_bo_segment instance_buffer::append(const void *data, size_t count) {
-        if(count > m_maxCount - m_instanceCount) {
+		size_t memBegin = 0;
+        if(!allocate(count * m_format->size(), &memBegin)) {
             r2Error("Insufficient space in instance buffer of format [%s] for %d instances (%d max) (buf: %d)", m_format->to_string().c_str(), count, m_maxCount, m_id);
             ins_bo_segment seg;
             seg.buffer = nullptr;
@@ -132,8 +154,8 @@ namespace r2 {
         }
         ins_bo_segment seg;
         seg.buffer = this;
-        seg.begin = m_instanceCount;
-        seg.memBegin = used_size();
+        seg.begin = memBegin / m_format->size();
+        seg.memBegin = memBegin;
         seg.end = seg.begin + count;
         seg.memEnd = seg.end * m_format->size();
 
@@ -152,12 +174,12 @@ namespace r2 {
 			return;
 		}
 
-		if (segment.memBegin > m_format->size() * m_instanceCount) {
+		if (segment.memBegin > used_size()) {
 			r2Error("Out of range segment.memBegin (%llu) provided to instance_buffer::update", segment.memBegin);
 			return;
 		}
 
-		if (segment.memEnd > m_format->size() * m_instanceCount) {
+		if (segment.memEnd > used_size()) {
 			r2Error("Out of range segment.memEnd (%llu) provided to instance_buffer::update", segment.memEnd);
 			return;
 		}
@@ -165,4 +187,15 @@ namespace r2 {
 		memcpy((u8*)m_data + segment.memBegin, data, m_format->size());
 		updated(segment.memBegin, segment.memEnd);
 	}
+
+	void instance_buffer::release(const ins_bo_segment& segment) {
+		if (!segment.is_valid()) return;
+		if (segment.buffer != this) {
+			r2Error("Segment for another instance buffer passed to instance_buffer::release");
+			return;
+		}
+
+		gpu_buffer::release(segment.memBegin, segment.memEnd);
+		m_instanceCount -= segment.size();
+	}
 }
@@ -46,12 +46,17 @@ namespace r2 {
             mstring to_string() const;
 			mstring hash_name() const;
 
+			// Small integer id shared by every format with the same attributes,
+			// assigned the first time it's requested. 0 is never a valid id
+			u16 id() const;
+
         protected:
             mvector<instance_attribute_type> m_attrs;
 			size_t m_modelMatrixOffset;
             size_t m_instanceSize;
             mstring m_fmtString;
 			mstring m_hashName;
+			mutable u16 m_id;
     };
 
     class instance_buffer;
@@ -78,9 +83,11 @@ namespace r2 {
 
             instance_format* format() const;
 			virtual void* data() const;
+			virtual size_t allocation_alignment() const;
 
             ins_bo_segment append(const void* data, size_t count);
 			void update(const ins_bo_segment& segment, const void* data);
+			void release(const ins_bo_segment& segment);
 
         protected:
             instance_format* m_format;
@@ -0,0 +1,580 @@
+#include <r2/engine.h>
+#include <r2/utilities/script_jobs.h>
+
+#include <marl/scheduler.h>
+#include <algorithm>
+
+using namespace v8;
+
+namespace r2 {
+	// written in place of a transfer index for typed arrays that are copied
+	#define SCRIPT_JOB_VIEW_COPIED UINT32_MAX
+
+	enum job_view_type {
+		jvt_int8 = 0,
+		jvt_uint8,
+		jvt_uint8_clamped,
+		jvt_int16,
+		jvt_uint16,
+		jvt_int32,
+		jvt_uint32,
+		jvt_float32,
+		jvt_float64,
+		jvt_bigint64,
+		jvt_biguint64,
+		jvt_data_view
+	};
+	static const u32 job_view_element_size[] = { 1, 1, 1, 2, 2, 4, 4, 4, 8, 8, 8, 1 };
+
+	static job_view_type view_type(Local<ArrayBufferView> view) {
+		if (view->IsInt8Array()) return jvt_int8;
+		if (view->IsUint8Array()) return jvt_uint8;
+		if (view->IsUint8ClampedArray()) return jvt_uint8_clamped;
+		if (view->IsInt16Array()) return jvt_int16;
+		if (view->IsUint16Array()) return jvt_uint16;
+		if (view->IsInt32Array()) return jvt_int32;
+		if (view->IsUint32Array()) return jvt_uint32;
+		if (view->IsFloat32Array()) return jvt_float32;
+		if (view->IsFloat64Array()) return jvt_float64;
+		if (view->IsBigInt64Array()) return jvt_bigint64;
+		if (view->IsBigUint64Array()) return jvt_biguint64;
+		return jvt_data_view;
+	}
+
+	static Local<Object> new_view(job_view_type type, Local<ArrayBuffer> buffer, size_t offset, size_t length) {
+		size_t count = length / job_view_element_size[type];
+		switch (type) {
+			case jvt_int8: return Int8Array::New(buffer, offset, count);
+			case jvt_uint8: return Uint8Array::New(buffer, offset, count);
+			case jvt_uint8_clamped: return Uint8ClampedArray::New(buffer, offset, count);
+			case jvt_int16: return Int16Array::New(buffer, offset, count);
+			case jvt_uint16: return Uint16Array::New(buffer, offset, count);
+			case jvt_int32: return Int32Array::New(buffer, offset, count);
+			case jvt_uint32: return Uint32Array::New(buffer, offset, count);
+			case jvt_float32: return Float32Array::New(buffer, offset, count);
+			case jvt_float64: return Float64Array::New(buffer, offset, count);
+			case jvt_bigint64: return BigInt64Array::New(buffer, offset, count);
+			case jvt_biguint64: return BigUint64Array::New(buffer, offset, count);
+			default: return DataView::New(buffer, offset, length);
+		}
+	}
+
+	// Typed arrays are written as host objects. Ones over a transferred buffer refer to it, the rest carry only the
+	// bytes they view. V8 would otherwise copy their whole buffer, and math values from scripts are views over a
+	// shared slab (see math_converters.cpp)
+	class job_serializer_delegate : public ValueSerializer::Delegate {
+		public:
+			job_serializer_delegate(Isolate* isolate, const job_vector<Local<ArrayBuffer>>& transfers)
+				: m_isolate(isolate), m_serializer(nullptr), m_transfers(transfers) { }
+
+			void set_serializer(ValueSerializer* serializer) { m_serializer = serializer; }
+
+			virtual void ThrowDataCloneError(Local<String> message) {
+				m_isolate->ThrowException(Exception::Error(message));
+			}
+
+			virtual Maybe<bool> WriteHostObject(Isolate* isolate, Local<Object> object) {
+				if (!object->IsArrayBufferView()) {
+					ThrowDataCloneError(String::NewFromUtf8(isolate, "Objects with internal fields can't be sent to or from jobs"));
+					return Nothing<bool>();
+				}
+
+				Local<ArrayBufferView> view = object.As<ArrayBufferView>();
+				Local<ArrayBuffer> buffer = view->Buffer();
+				u32 transfer = SCRIPT_JOB_VIEW_COPIED;
+				for (u32 i = 0;i < m_transfers.size();i++) {
+					if (m_transfers[i] == buffer) transfer = i;
+				}
+
+				m_serializer->WriteUint32(view_type(view));
+				m_serializer->WriteUint32(transfer);
+				m_serializer->WriteUint64(view->ByteLength());
+				if (transfer != SCRIPT_JOB_VIEW_COPIED) m_serializer->WriteUint64(view->ByteOffset());
+				else m_serializer->WriteRawBytes((const u8*)buffer->GetContents().Data() + view->ByteOffset(), view->ByteLength());
+				return Just(true);
+			}
+
+		protected:
+			Isolate* m_isolate;
+			ValueSerializer* m_serializer;
+			const job_vector<Local<ArrayBuffer>>& m_transfers;
+	};
+
+	class job_deserializer_delegate : public ValueDeserializer::Delegate {
+		public:
+			job_deserializer_delegate(const job_vector<Local<ArrayBuffer>>& transfers) : m_deserializer(nullptr), m_transfers(transfers) { }
+
+			void set_deserializer(ValueDeserializer* deserializer) { m_deserializer = deserializer; }
+
+			virtual MaybeLocal<Object> ReadHostObject(Isolate* isolate) {
+				u32 type = 0, transfer = 0;
+				u64 length = 0, offset = 0;
+				if (
+					!m_deserializer->ReadUint32(&type) || type > jvt_data_view ||
+					!m_deserializer->ReadUint32(&transfer) ||
+					!m_deserializer->ReadUint64(&length) || length % job_view_element_size[type] != 0
+				) return invalid(isolate);
+
+				Local<ArrayBuffer> buffer;
+				if (transfer == SCRIPT_JOB_VIEW_COPIED) {
+					const void* bytes = nullptr;
+					if (!m_deserializer->ReadRawBytes(size_t(length), &bytes)) return invalid(isolate);
+					buffer = ArrayBuffer::New(isolate, size_t(length));
+					memcpy(buffer->GetContents().Data(), bytes, size_t(length));
+				} else {
+					if (transfer >= m_transfers.size() || !m_deserializer->ReadUint64(&offset)) return invalid(isolate);
+					buffer = m_transfers[transfer];
+					if (offset + length > buffer->ByteLength()) return invalid(isolate);
+				}
+
+				return new_view(job_view_type(type), buffer, size_t(offset), size_t(length));
+			}
+
+		protected:
+			MaybeLocal<Object> invalid(Isolate* isolate) {
+				isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Invalid typed array in job data")));
+				return MaybeLocal<Object>();
+			}
+
+			ValueDeserializer* m_deserializer;
+			const job_vector<Local<ArrayBuffer>>& m_transfers;
+	};
+
+	// Worker threads don't log, so unlike get_contents this only reports failure
+	static bool read_job_file(const mstring& file, job_string& contents) {
+		FILE* fp = fopen(file.c_str(), "rb");
+		if (!fp) return false;
+
+		fseek(fp, 0, SEEK_END);
+		size_t fsz = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		contents.resize(fsz);
+
+		bool success = fsz > 0 && fread(&contents[0], fsz, 1, fp) == 1;
+		fclose(fp);
+		return success;
+	}
+
+	// Writes the caught exception to 'out', which holds SCRIPT_JOB_ERROR_LENGTH characters
+	static void exception_string(Isolate* isolate, const TryCatch& tc, char* out) {
+		if (!tc.HasCaught()) {
+			snprintf(out, SCRIPT_JOB_ERROR_LENGTH, "Unknown error");
+			return;
+		}
+
+		String::Utf8Value exception(isolate, tc.Exception());
+		const char* text = *exception ? *exception : "Unknown exception";
+
+		Local<Message> message = tc.Message();
+		if (message.IsEmpty()) {
+			snprintf(out, SCRIPT_JOB_ERROR_LENGTH, "%s", text);
+			return;
+		}
+
+		String::Utf8Value resource(isolate, message->GetScriptResourceName());
+		i32 line = message->GetLineNumber(isolate->GetCurrentContext()).FromMaybe(0);
+		snprintf(out, SCRIPT_JOB_ERROR_LENGTH, "%s (%s:%d)", text, *resource ? *resource : "unknown", line);
+	}
+
+	static script_job_buffer* find_loan(job_vector<script_job_buffer>* lent, void* data) {
+		if (!lent) return nullptr;
+		for (script_job_buffer& buffer : *lent) {
+			if (buffer.data && buffer.data == data) return &buffer;
+		}
+		return nullptr;
+	}
+
+	// Buffers backed by memory the isolate doesn't own (mesh views, for instance) can't change owners,
+	// except for buffers a job was lent, which it can hand back
+	static bool collect_transfers(Isolate* isolate, Local<Value> list, job_vector<Local<ArrayBuffer>>& transfers, job_vector<script_job_buffer>* lent, char* error) {
+		if (list.IsEmpty() || list->IsUndefined() || list->IsNull()) return true;
+		if (!list->IsArray()) {
+			snprintf(error, SCRIPT_JOB_ERROR_LENGTH, "The transfer list must be an array");
+			return false;
+		}
+
+		Local<Context> context = isolate->GetCurrentContext();
+		Local<Array> arr = list.As<Array>();
+		for (u32 i = 0;i < arr->Length();i++) {
+			Local<Value> v;
+			if (!arr->Get(context, i).ToLocal(&v)) return false;
+
+			Local<ArrayBuffer> buffer;
+			if (v->IsArrayBuffer()) buffer = v.As<ArrayBuffer>();
+			else if (v->IsArrayBufferView()) buffer = v.As<ArrayBufferView>()->Buffer();
+			else {
+				snprintf(error, SCRIPT_JOB_ERROR_LENGTH, "The transfer list can only contain ArrayBuffers and typed arrays");
+				return false;
+			}
+
+			bool loan = buffer->IsExternal() && find_loan(lent, buffer->GetContents().Data());
+			if ((buffer->IsExternal() && !loan) || !buffer->IsDetachable()) {
+				snprintf(error, SCRIPT_JOB_ERROR_LENGTH, "Buffers that are owned by the engine can't be transferred");
+				return false;
+			}
+
+			// typed arrays may share a buffer
+			if (std::find(transfers.begin(), transfers.end(), buffer) == transfers.end()) transfers.push_back(buffer);
+		}
+
+		return true;
+	}
+
+	// Transferred buffers are detached from the isolate, their memory is moved to 'buffers'. Lent buffers being
+	// handed back are taken out of 'lent'
+	static bool serialize(Isolate* isolate, Local<Context> context, Local<Value> value, const job_vector<Local<ArrayBuffer>>& transfers, u8** data, size_t* size, job_vector<script_job_buffer>& buffers, job_vector<script_job_buffer>* lent, bool worker) {
+		job_serializer_delegate delegate(isolate, transfers);
+		ValueSerializer serializer(isolate, &delegate);
+		delegate.set_serializer(&serializer);
+		serializer.SetTreatArrayBufferViewsAsHostObjects(true);
+		serializer.WriteHeader();
+		for (u32 i = 0;i < transfers.size();i++) serializer.TransferArrayBuffer(i, transfers[i]);
+		if (!serializer.WriteValue(context, value).FromMaybe(false)) return false;
+
+		std::pair<u8*, size_t> result = serializer.Release();
+		*data = result.first;
+		*size = result.second;
+
+		for (Local<ArrayBuffer> buffer : transfers) {
+			script_job_buffer* loan = buffer->IsExternal() ? find_loan(lent, buffer->GetContents().Data()) : nullptr;
+			if (loan) {
+				buffers.push_back(*loan);
+				loan->data = nullptr;
+				buffer->Detach();
+				continue;
+			}
+
+			ArrayBuffer::Contents contents = buffer->Externalize();
+			buffer->Detach();
+			buffers.push_back({ contents.Data(), contents.ByteLength(), worker });
+		}
+
+		return true;
+	}
+
+	// With 'lend' the isolate only borrows the buffers and they're added to 'lent' so that they can be detached
+	// again, otherwise their ownership is handed to the isolate, even if reading the value fails
+	static MaybeLocal<Value> deserialize(Isolate* isolate, Local<Context> context, const u8* data, size_t size, job_vector<script_job_buffer>& buffers, job_vector<Local<ArrayBuffer>>* lent) {
+		job_vector<Local<ArrayBuffer>> transferred;
+		job_deserializer_delegate delegate(transferred);
+		ValueDeserializer deserializer(isolate, data, size, &delegate);
+		delegate.set_deserializer(&deserializer);
+		for (u32 i = 0;i < buffers.size();i++) {
+			ArrayBufferCreationMode mode = lent ? ArrayBufferCreationMode::kExternalized : ArrayBufferCreationMode::kInternalized;
+			Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, buffers[i].data, buffers[i].size, mode);
+			if (lent) lent->push_back(buffer);
+			transferred.push_back(buffer);
+			deserializer.TransferArrayBuffer(i, buffer);
+		}
+		if (!lent) buffers.clear();
+
+		if (!deserializer.ReadHeader(context).FromMaybe(false)) return MaybeLocal<Value>();
+		return deserializer.ReadValue(context);
+	}
+
+	static void push_job(script_job** head, script_job** tail, script_job* job) {
+		job->next = nullptr;
+		if (*tail) (*tail)->next = job;
+		else *head = job;
+		*tail = job;
+	}
+
+	static script_job* pop_job(script_job** head, script_job** tail) {
+		script_job* job = *head;
+		if (!job) return nullptr;
+		*head = job->next;
+		if (!*head) *tail = nullptr;
+		job->next = nullptr;
+		return job;
+	}
+
+	script_job_pool::script_job_pool(Isolate* mainIsolate, ArrayBuffer::Allocator* allocator)
+		: m_mainIsolate(mainIsolate), m_allocator(allocator), m_nextId(1), m_pending(0),
+		  m_queueHead(nullptr), m_queueTail(nullptr), m_finishedHead(nullptr), m_finishedTail(nullptr)
+	{
+		u32 cpus = marl::Thread::numLogicalCPUs();
+		m_maxWorkers = cpus > 1 ? cpus - 1 : 1;
+		if (SCRIPT_JOB_MAX_WORKERS > 0 && m_maxWorkers > SCRIPT_JOB_MAX_WORKERS) m_maxWorkers = SCRIPT_JOB_MAX_WORKERS;
+
+		m_workerAllocator = new job_buffer_allocator();
+		m_workers = new script_job_worker[m_maxWorkers];
+	}
+
+	script_job_pool::~script_job_pool() {
+		// queued jobs are dropped, running ones have to finish before their isolates can go away
+		script_job* queued = nullptr;
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			queued = m_queueHead;
+			m_queueHead = m_queueTail = nullptr;
+		}
+		m_running.wait();
+
+		for (script_job* job = queued;job;) {
+			script_job* next = job->next;
+			release_job(job);
+			job = next;
+		}
+
+		while (script_job* job = pop_job(&m_finishedHead, &m_finishedTail)) release_job(job);
+
+		for (u32 w = 0;w < m_maxWorkers;w++) {
+			script_job_worker& worker = m_workers[w];
+			if (!worker.isolate) continue;
+			{
+				Locker locker(worker.isolate);
+				Isolate::Scope isolateScope(worker.isolate);
+				worker.jobs.clear();
+				worker.context.Reset();
+			}
+			worker.isolate->Dispose();
+		}
+		delete [] m_workers;
+
+		delete m_workerAllocator;
+		delete m_allocator;
+	}
+
+	script_job_id script_job_pool::submit(const mstring& file, Local<Value> input, Local<Value> transfer, Local<Function> callback) {
+		Isolate* isolate = m_mainIsolate;
+		HandleScope scope(isolate);
+		Local<Context> context = isolate->GetCurrentContext();
+
+		job_vector<Local<ArrayBuffer>> transfers;
+		char error[SCRIPT_JOB_ERROR_LENGTH] = { 0 };
+		if (!collect_transfers(isolate, transfer, transfers, nullptr, error)) {
+			if (error[0]) isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, error)));
+			return 0;
+		}
+
+		script_job* job = new script_job();
+		job->id = m_nextId++;
+		job->file = file;
+		job->error[0] = 0;
+		job->next = nullptr;
+		job->input = job->output = nullptr;
+		job->inputSize = job->outputSize = 0;
+
+		// on failure the delegate has already thrown
+		if (!serialize(isolate, context, input, transfers, &job->input, &job->inputSize, job->inputBuffers, nullptr, false)) {
+			release_job(job);
+			return 0;
+		}
+
+		job->callback.Reset(isolate, callback);
+		script_job_id id = job->id;
+		m_pending++;
+
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			push_job(&m_queueHead, &m_queueTail, job);
+		}
+
+		m_running.add();
+		marl::schedule([this]() {
+			run_jobs();
+			m_running.done();
+		});
+
+		return id;
+	}
+
+	// Every submitted job schedules one of these. A task that can't get a worker leaves its job for the
+	// busy ones, which only go idle once they see an empty queue. Nothing is allocated while m_lock is held
+	void script_job_pool::run_jobs() {
+		script_job_worker* worker = nullptr;
+		script_job* job = nullptr;
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			if (!m_queueHead) return;
+
+			for (u32 w = 0;w < m_maxWorkers;w++) {
+				if (!m_workers[w].busy) {
+					worker = &m_workers[w];
+					break;
+				}
+			}
+
+			if (!worker) return;
+
+			worker->busy = true;
+			job = pop_job(&m_queueHead, &m_queueTail);
+		}
+
+		if (!worker->isolate) init_worker(worker);
+
+		while (job) {
+			run_job(worker, job);
+
+			std::lock_guard<std::mutex> guard(m_lock);
+			push_job(&m_finishedHead, &m_finishedTail, job);
+			job = pop_job(&m_queueHead, &m_queueTail);
+			if (!job) worker->busy = false;
+		}
+	}
+
+	void script_job_pool::init_worker(script_job_worker* worker) {
+		Isolate::CreateParams params;
+		params.array_buffer_allocator = m_workerAllocator;
+		worker->isolate = Isolate::New(params);
+
+		// worker isolates move between marl threads, so they're always entered with a Locker
+		Locker locker(worker->isolate);
+		Isolate::Scope isolateScope(worker->isolate);
+		HandleScope scope(worker->isolate);
+		worker->context.Reset(worker->isolate, Context::New(worker->isolate));
+	}
+
+	void script_job_pool::run_job(script_job_worker* worker, script_job* job) {
+		Isolate* isolate = worker->isolate;
+		Locker locker(isolate);
+		Isolate::Scope isolateScope(isolate);
+		HandleScope scope(isolate);
+		Local<Context> context = worker->context.Get(isolate);
+		Context::Scope contextScope(context);
+		TryCatch tc(isolate);
+
+		Local<Function> run;
+		if (!load_job(worker, job->file, &run, job->error)) return;
+
+		// the job's input buffers are only lent to the worker, whatever isn't handed back is detached after the job
+		job_vector<Local<ArrayBuffer>> lent;
+		Local<Value> input;
+		bool inputRead = deserialize(isolate, context, job->input, job->inputSize, job->inputBuffers, &lent).ToLocal(&input);
+		free(job->input);
+		job->input = nullptr;
+		job->inputSize = 0;
+
+		if (!inputRead) {
+			if (tc.HasCaught()) exception_string(isolate, tc, job->error);
+			else snprintf(job->error, SCRIPT_JOB_ERROR_LENGTH, "Failed to read the job's input");
+		} else {
+			Local<Array> transfer = Array::New(isolate);
+			Local<Value> args[] = { input, transfer };
+			Local<Value> output;
+			job_vector<Local<ArrayBuffer>> transfers;
+			if (!run->Call(context, context->Global(), 2, args).ToLocal(&output)) exception_string(isolate, tc, job->error);
+			else if (!collect_transfers(isolate, transfer, transfers, &job->inputBuffers, job->error)) {
+				if (tc.HasCaught()) exception_string(isolate, tc, job->error);
+			} else if (!serialize(isolate, context, output, transfers, &job->output, &job->outputSize, job->outputBuffers, &job->inputBuffers, true)) {
+				exception_string(isolate, tc, job->error);
+			}
+		}
+
+		for (Local<ArrayBuffer> buffer : lent) {
+			if (buffer->ByteLength() > 0 && buffer->IsDetachable()) buffer->Detach();
+		}
+	}
+
+	// Job files are compiled once per worker isolate
+	bool script_job_pool::load_job(script_job_worker* worker, const mstring& file, Local<Function>* run, char* error) {
+		Isolate* isolate = worker->isolate;
+		for (script_job_worker::compiled_job& compiled : worker->jobs) {
+			if (compiled.file == file.c_str()) {
+				*run = compiled.run.Get(isolate);
+				return true;
+			}
+		}
+
+		job_string source;
+		if (!read_job_file(file, source)) {
+			snprintf(error, SCRIPT_JOB_ERROR_LENGTH, "Failed to read job file %s", file.c_str());
+			return false;
+		}
+
+		// evaluates to the file's run function without leaking its globals into other jobs on the same isolate
+		job_string wrapped = "(function() {\n";
+		wrapped += source;
+		wrapped += "\nreturn typeof run === 'function' ? run : undefined;\n})()";
+
+		Local<Context> context = isolate->GetCurrentContext();
+		TryCatch tc(isolate);
+		ScriptOrigin origin(String::NewFromUtf8(isolate, file.c_str()), Integer::New(isolate, -1));
+		Local<String> code;
+		Local<Script> script;
+		Local<Value> result;
+		if (
+			!String::NewFromUtf8(isolate, wrapped.c_str(), NewStringType::kNormal, (i32)wrapped.length()).ToLocal(&code) ||
+			!Script::Compile(context, code, &origin).ToLocal(&script) ||
+			!script->Run(context).ToLocal(&result)
+		) {
+			exception_string(isolate, tc, error);
+			return false;
+		}
+
+		if (!result->IsFunction()) {
+			snprintf(error, SCRIPT_JOB_ERROR_LENGTH, "%s does not define function run(input, transfer)", file.c_str());
+			return false;
+		}
+
+		*run = result.As<Function>();
+		worker->jobs.emplace_back();
+		worker->jobs.back().file = file.c_str();
+		worker->jobs.back().run.Reset(isolate, *run);
+		return true;
+	}
+
+	void script_job_pool::deliver_results() {
+		script_job* finished = nullptr;
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			finished = m_finishedHead;
+			m_finishedHead = m_finishedTail = nullptr;
+		}
+		if (!finished) return;
+
+		Isolate* isolate = m_mainIsolate;
+		HandleScope scope(isolate);
+		Local<Context> context = isolate->GetCurrentContext();
+
+		while (finished) {
+			script_job* job = finished;
+			finished = job->next;
+
+			Local<Value> result = Undefined(isolate);
+			Local<Value> error = Undefined(isolate);
+
+			if (job->error[0] == 0) {
+				// buffers the job allocated are moved into the main isolate's memory, lent ones already are
+				for (script_job_buffer& buffer : job->outputBuffers) {
+					if (!buffer.worker) continue;
+					void* data = m_allocator->AllocateUninitialized(buffer.size);
+					memcpy(data, buffer.data, buffer.size);
+					m_workerAllocator->Free(buffer.data, buffer.size);
+					buffer = { data, buffer.size, false };
+				}
+
+				TryCatch tc(isolate);
+				Local<Value> output;
+				if (deserialize(isolate, context, job->output, job->outputSize, job->outputBuffers, nullptr).ToLocal(&output)) result = output;
+				else if (tc.HasCaught()) exception_string(isolate, tc, job->error);
+				else snprintf(job->error, SCRIPT_JOB_ERROR_LENGTH, "Failed to read the job's result");
+			}
+
+			if (job->error[0]) error = String::NewFromUtf8(isolate, (job->file + ": " + job->error).c_str());
+
+			Local<Function> callback = job->callback.Get(isolate);
+			release_job(job);
+			m_pending--;
+
+			TryCatch tc(isolate);
+			Local<Value> args[] = { result, error };
+			callback->Call(context, context->Global(), 2, args);
+			check_script_exception(isolate, tc);
+		}
+	}
+
+	void script_job_pool::free_buffer(const script_job_buffer& buffer) {
+		if (!buffer.data) return;
+		if (buffer.worker) m_workerAllocator->Free(buffer.data, buffer.size);
+		else m_allocator->Free(buffer.data, buffer.size);
+	}
+
+	void script_job_pool::release_job(script_job* job) {
+		if (job->input) free(job->input);
+		if (job->output) free(job->output);
+		for (const script_job_buffer& buffer : job->inputBuffers) free_buffer(buffer);
+		for (const script_job_buffer& buffer : job->outputBuffers) free_buffer(buffer);
+		delete job;
+	}
+};
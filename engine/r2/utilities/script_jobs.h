@@ -0,0 +1,138 @@
+#pragma once
+#include <r2/config.h>
+#include <r2/managers/memman.h>
+
+#include <marl/waitgroup.h>
+#include <v8.h>
+
+#include <mutex>
+
+// upper bound for the number of worker isolates, 0 = one per logical CPU minus the main thread
+#define SCRIPT_JOB_MAX_WORKERS 0
+
+// longest error message a job can report, including the terminator
+#define SCRIPT_JOB_ERROR_LENGTH 512
+
+namespace r2 {
+	typedef u32 script_job_id;
+
+	// Worker threads can't use operator new, it waits on the memory manager's lock, which the main thread holds
+	// for as long as a state is active. Everything the workers allocate comes from malloc through this instead
+	template <typename T>
+	struct job_allocator {
+		typedef T value_type;
+
+		job_allocator() { }
+		template <typename U> job_allocator(const job_allocator<U>&) { }
+
+		T* allocate(size_t count) { return (T*)malloc(count * sizeof(T)); }
+		void deallocate(T* ptr, size_t) { free(ptr); }
+
+		template <typename U> bool operator==(const job_allocator<U>&) const { return true; }
+		template <typename U> bool operator!=(const job_allocator<U>&) const { return false; }
+	};
+
+	template <typename T>
+	using job_vector = std::vector<T, job_allocator<T>>;
+	typedef std::basic_string<char, std::char_traits<char>, job_allocator<char>> job_string;
+
+	// ArrayBuffer allocator of the worker isolates
+	class job_buffer_allocator : public v8::ArrayBuffer::Allocator {
+		public:
+			virtual void* Allocate(size_t length) { return calloc(length, 1); }
+			virtual void* AllocateUninitialized(size_t length) { return malloc(length); }
+			virtual void Free(void* data, size_t) { free(data); }
+	};
+
+	// ArrayBuffer contents that were detached from one isolate and not yet handed to another. 'worker' is set
+	// when they were allocated by a worker isolate, otherwise the main isolate's allocator owns them
+	struct script_job_buffer {
+		void* data;
+		size_t size;
+		bool worker;
+	};
+
+	// Jobs are linked through 'next' while queued or finished, so that moving them between threads never allocates
+	struct script_job {
+		script_job_id id;
+		mstring file;
+		char error[SCRIPT_JOB_ERROR_LENGTH];
+		script_job* next;
+
+		// ValueSerializer output, allocated with realloc
+		u8* input;
+		size_t inputSize;
+		job_vector<script_job_buffer> inputBuffers;
+
+		u8* output;
+		size_t outputSize;
+		job_vector<script_job_buffer> outputBuffers;
+
+		// main isolate only
+		v8::Global<v8::Function> callback;
+	};
+
+	struct script_job_worker {
+		struct compiled_job {
+			job_string file;
+			v8::Global<v8::Function> run;
+		};
+
+		script_job_worker() : isolate(nullptr), busy(false) { }
+
+		v8::Isolate* isolate;
+		v8::Global<v8::Context> context;
+		job_vector<compiled_job> jobs;
+		bool busy;
+	};
+
+	// Runs script files on a pool of secondary isolates on the marl worker threads.
+	// A job file must define 'function run(input, transfer)'. Its input and return value are copied
+	// with V8's structured clone, except for ArrayBuffers listed for transfer (pushed onto 'transfer' in the
+	// job), which are detached from the sending isolate and moved to the receiving one. Buffers sent to a job
+	// are lent to it without a copy and come back without one if the job transfers them back, buffers a job
+	// creates are copied into the main isolate's memory when its result is delivered.
+	// Worker isolates have no engine bindings, jobs can only work on the data they were given
+	class script_job_pool {
+		public:
+			// 'allocator' is the main isolate's, buffers it allocated are freed with it
+			script_job_pool(v8::Isolate* mainIsolate, v8::ArrayBuffer::Allocator* allocator);
+			~script_job_pool();
+
+			// Called from the main isolate. Returns 0 and throws a JS exception if 'input' can't be sent
+			script_job_id submit(const mstring& file, v8::Local<v8::Value> input, v8::Local<v8::Value> transfer, v8::Local<v8::Function> callback);
+
+			// Calls callback(result, error) for every job that finished since the last call, at the start of each frame
+			void deliver_results();
+
+			// jobs submitted whose callbacks haven't been called yet
+			u32 pending() const { return m_pending; }
+			u32 max_workers() const { return m_maxWorkers; }
+
+		protected:
+			void run_jobs();
+			void run_job(script_job_worker* worker, script_job* job);
+			bool load_job(script_job_worker* worker, const mstring& file, v8::Local<v8::Function>* run, char* error);
+			void init_worker(script_job_worker* worker);
+			void release_job(script_job* job);
+			void free_buffer(const script_job_buffer& buffer);
+
+			v8::Isolate* m_mainIsolate;
+			v8::ArrayBuffer::Allocator* m_allocator;
+			job_buffer_allocator* m_workerAllocator;
+			script_job_id m_nextId;
+			u32 m_pending;
+			u32 m_maxWorkers;
+			marl::WaitGroup m_running;
+
+			// created up front, so that no worker is allocated while m_lock is held
+			script_job_worker* m_workers;
+
+			// guards everything below, which is only ever relinked under it
+			std::mutex m_lock;
+			script_job* m_queueHead;
+			script_job* m_queueTail;
+			script_job* m_finishedHead;
+			script_job* m_finishedTail;
+	};
+};
@@ -0,0 +1,225 @@
+#include <r2/engine.h>
+#include <r2/utilities/script_profiler.h>
+
+#include <algorithm>
+
+using namespace v8;
+
+namespace r2 {
+	static const char* cpu_profile_title = "r2_script_profile";
+
+	static void append_json_string(mstring& out, const mstring& str) {
+		out += '"';
+		for (size_t i = 0;i < str.length();i++) {
+			char c = str[i];
+			if (c == '"' || c == '\\') {
+				out += '\\';
+				out += c;
+			} else if (c == '\n') out += "\\n";
+			else if ((u8)c < 0x20) out += ' ';
+			else out += c;
+		}
+		out += '"';
+	}
+
+	script_profiler::script_profiler(Isolate* isolate) : m_isolate(isolate), m_cpuProfiler(nullptr), m_enabled(false), m_profileFramesLeft(0) {
+	}
+
+	script_profiler::~script_profiler() {
+		if (m_cpuProfiler) m_cpuProfiler->Dispose();
+	}
+
+	void script_profiler::set_enabled(bool enabled) {
+		m_enabled = enabled;
+	}
+
+	// The profiler outlives the states whose scripts register and call sites, so its storage has to
+	// come from the global allocator rather than whichever one is current
+	script_call_site script_profiler::register_site(const mstring& name) {
+		memory_man::push_current(memory_man::global());
+		script_call_site site;
+		auto existing = m_siteIndices.find(name);
+		if (existing != m_siteIndices.end()) site = existing->second;
+		else {
+			site = script_call_site(m_sites.size());
+			m_sites.push_back({ name, 0, 0.0, 0.0, 0.0, 0.0 });
+			m_siteIndices[name] = site;
+		}
+		memory_man::pop_current();
+		return site;
+	}
+
+	script_call_site script_profiler::site(script_call_site& cached, const char* kind, const mstring& owner, const char* function) {
+		if (!m_enabled) return SCRIPT_CALL_SITE_NONE;
+		if (cached == SCRIPT_CALL_SITE_NONE) cached = register_site(mstring(kind) + ":" + owner + "." + function);
+		return cached;
+	}
+
+	void script_profiler::begin(script_call_site site, tmr::time_point& start) const {
+		start = tmr::now();
+	}
+
+	void script_profiler::end(script_call_site site, const tmr::time_point& start) {
+		f64 duration = std::chrono::duration<f64>(tmr::now() - start).count();
+		script_call_stats& stats = m_sites[site];
+		if (stats.frameTime == 0.0) {
+			memory_man::push_current(memory_man::global());
+			m_frameSites.push_back(site);
+			memory_man::pop_current();
+		}
+		stats.calls++;
+		stats.totalTime += duration;
+		stats.frameTime += duration;
+	}
+
+	void script_profiler::profile_frames(u32 frames) {
+		if (frames == 0) return;
+		if (m_profileFramesLeft > 0) {
+			// extend the current profile
+			m_profileFramesLeft = frames;
+			return;
+		}
+
+		if (!m_cpuProfiler) {
+			m_cpuProfiler = CpuProfiler::New(m_isolate);
+			m_cpuProfiler->SetSamplingInterval(SCRIPT_PROFILER_SAMPLE_INTERVAL_US);
+		}
+
+		HandleScope scope(m_isolate);
+		m_cpuProfiler->StartProfiling(String::NewFromUtf8(m_isolate, cpu_profile_title), false);
+		m_profileFramesLeft = frames;
+	}
+
+	void script_profiler::frame_finished() {
+		// sites that were called last frame but not this one
+		for (script_call_site site : m_lastFrameSites) m_sites[site].lastFrameTime = 0.0;
+
+		for (script_call_site site : m_frameSites) {
+			script_call_stats& stats = m_sites[site];
+			stats.lastFrameTime = stats.frameTime;
+			stats.maxFrameTime = max(stats.maxFrameTime, stats.frameTime);
+			stats.frameTime = 0.0;
+		}
+		m_lastFrameSites.swap(m_frameSites);
+		m_frameSites.clear();
+
+		if (m_profileFramesLeft > 0) {
+			m_profileFramesLeft--;
+			if (m_profileFramesLeft == 0) stop_cpu_profile();
+		}
+	}
+
+	void script_profiler::reset() {
+		for (script_call_stats& stats : m_sites) {
+			stats.calls = 0;
+			stats.totalTime = stats.frameTime = stats.lastFrameTime = stats.maxFrameTime = 0.0;
+		}
+		m_frameSites.clear();
+		m_lastFrameSites.clear();
+		m_functions.clear();
+	}
+
+	void script_profiler::stop_cpu_profile() {
+		HandleScope scope(m_isolate);
+		CpuProfile* profile = m_cpuProfiler->StopProfiling(String::NewFromUtf8(m_isolate, cpu_profile_title));
+		if (!profile) {
+			r2Warn("Script CPU profile was empty");
+			return;
+		}
+
+		memory_man::push_current(memory_man::global());
+		m_functions.clear();
+
+		// timestamps are in microseconds, every sample attributes one interval to the function on top of the stack
+		munordered_map<mstring, size_t> indices;
+		mvector<const CpuProfileNode*> nodes;
+		nodes.push_back(profile->GetTopDownRoot());
+		u32 totalSamples = 0;
+		while (nodes.size() > 0) {
+			const CpuProfileNode* node = nodes.back();
+			nodes.pop_back();
+			for (i32 c = 0;c < node->GetChildrenCount();c++) nodes.push_back(node->GetChild(c));
+
+			u32 hits = node->GetHitCount();
+			if (hits == 0) continue;
+			totalSamples += hits;
+
+			mstring name = node->GetFunctionNameStr();
+			mstring resource = node->GetScriptResourceNameStr();
+			i32 line = node->GetLineNumber();
+
+			// the same function shows up once per distinct call stack
+			char lineStr[16] = { 0 };
+			snprintf(lineStr, 16, ":%d:", line);
+			mstring key = resource + lineStr + name;
+			auto existing = indices.find(key);
+			if (existing != indices.end()) m_functions[existing->second].samples += hits;
+			else {
+				indices[key] = m_functions.size();
+				m_functions.push_back({ name.length() > 0 ? name : "(anonymous)", resource, line, hits, 0.0 });
+			}
+		}
+
+		f64 duration = f64(profile->GetEndTime() - profile->GetStartTime()) / 1000000.0;
+		f64 sampleTime = totalSamples > 0 ? duration / f64(totalSamples) : 0.0;
+		for (script_function_stats& f : m_functions) f.selfTime = f64(f.samples) * sampleTime;
+		std::sort(m_functions.begin(), m_functions.end(), [](const script_function_stats& a, const script_function_stats& b) {
+			return a.samples > b.samples;
+		});
+
+		profile->Delete();
+		memory_man::pop_current();
+		r2Log("Script CPU profile finished: %llu functions, %u samples over %0.2f ms", m_functions.size(), totalSamples, duration * 1000.0);
+	}
+
+	mstring script_profiler::to_json() const {
+		mvector<const script_call_stats*> sites;
+		for (const script_call_stats& s : m_sites) {
+			if (s.calls > 0) sites.push_back(&s);
+		}
+		std::sort(sites.begin(), sites.end(), [](const script_call_stats* a, const script_call_stats* b) {
+			return a->totalTime > b->totalTime;
+		});
+
+		char num[128];
+		mstring out = "{\"call_sites\":[";
+		for (size_t i = 0;i < sites.size();i++) {
+			const script_call_stats* s = sites[i];
+			if (i > 0) out += ',';
+			out += "{\"name\":";
+			append_json_string(out, s->name);
+			snprintf(num, 128, ",\"calls\":%u,\"total_ms\":%f,\"last_frame_ms\":%f,\"max_frame_ms\":%f}", s->calls, s->totalTime * 1000.0, s->lastFrameTime * 1000.0, s->maxFrameTime * 1000.0);
+			out += num;
+		}
+
+		out += "],\"functions\":[";
+		for (size_t i = 0;i < m_functions.size();i++) {
+			const script_function_stats& f = m_functions[i];
+			if (i > 0) out += ',';
+			out += "{\"name\":";
+			append_json_string(out, f.name);
+			out += ",\"resource\":";
+			append_json_string(out, f.resource);
+			snprintf(num, 128, ",\"line\":%d,\"samples\":%u,\"self_ms\":%f}", f.line, f.samples, f.selfTime * 1000.0);
+			out += num;
+		}
+		out += "]}";
+
+		return out;
+	}
+
+	bool script_profiler::export_json(const mstring& file) const {
+		FILE* fp = fopen(file.c_str(), "wb");
+		if (!fp) {
+			r2Error("Failed to open %s for writing", file.c_str());
+			return false;
+		}
+
+		mstring json = to_json();
+		bool success = fwrite(json.c_str(), json.length(), 1, fp) == 1;
+		fclose(fp);
+
+		if (!success) r2Error("Failed to write script profile to %s", file.c_str());
+		return success;
+	}
+};
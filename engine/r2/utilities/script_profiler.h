@@ -0,0 +1,97 @@
+#pragma once
+#include <r2/config.h>
+#include <r2/managers/memman.h>
+
+#include <v8.h>
+#include <v8-profiler.h>
+
+// sampling interval used while the CPU profiler is running
+#define SCRIPT_PROFILER_SAMPLE_INTERVAL_US 500
+
+#define SCRIPT_CALL_SITE_NONE UINT32_MAX
+
+namespace r2 {
+	typedef u32 script_call_site;
+
+	// Time spent in JS when the engine calls into script at one place, like a system's tick
+	// or an entity's update. Times are inclusive of any script called from within that call
+	struct script_call_stats {
+		mstring name;
+		u32 calls;
+		f64 totalTime;
+		f64 frameTime;
+		f64 lastFrameTime;
+		f64 maxFrameTime;
+	};
+
+	// Self time of one JS function, taken from a V8 CPU profile
+	struct script_function_stats {
+		mstring name;
+		mstring resource;
+		i32 line;
+		u32 samples;
+		f64 selfTime;
+	};
+
+	class script_profiler {
+		public:
+			script_profiler(v8::Isolate* isolate);
+			~script_profiler();
+
+			// Call sites are only timed while enabled
+			void set_enabled(bool enabled);
+			bool enabled() const { return m_enabled; }
+
+			// Sites are shared by name, registering one that exists returns it
+			script_call_site register_site(const mstring& name);
+
+			// Returns SCRIPT_CALL_SITE_NONE while disabled, otherwise registers 'cached' on first use
+			script_call_site site(script_call_site& cached, const char* kind, const mstring& owner, const char* function);
+
+			void begin(script_call_site site, tmr::time_point& start) const;
+			void end(script_call_site site, const tmr::time_point& start);
+
+			// Samples all script execution with V8's CPU profiler for the next 'frames' frames
+			void profile_frames(u32 frames);
+			bool profiling() const { return m_profileFramesLeft > 0; }
+
+			void frame_finished();
+			void reset();
+
+			const mvector<script_call_stats>& call_sites() const { return m_sites; }
+			const mvector<script_function_stats>& functions() const { return m_functions; }
+
+			// Call sites sorted by total time, followed by the functions of the last CPU profile
+			mstring to_json() const;
+			bool export_json(const mstring& file) const;
+
+		protected:
+			void stop_cpu_profile();
+
+			v8::Isolate* m_isolate;
+			v8::CpuProfiler* m_cpuProfiler;
+			bool m_enabled;
+			u32 m_profileFramesLeft;
+			mvector<script_call_stats> m_sites;
+			munordered_map<mstring, script_call_site> m_siteIndices;
+			mvector<script_call_site> m_frameSites;
+			mvector<script_call_site> m_lastFrameSites;
+			mvector<script_function_stats> m_functions;
+	};
+
+	// Times the engine->JS call it's scoped to
+	class script_call_scope {
+		public:
+			script_call_scope(script_profiler* profiler, script_call_site site) : m_profiler(profiler), m_site(site) {
+				if (m_site != SCRIPT_CALL_SITE_NONE) m_profiler->begin(m_site, m_start);
+			}
+			~script_call_scope() {
+				if (m_site != SCRIPT_CALL_SITE_NONE) m_profiler->end(m_site, m_start);
+			}
+
+		protected:
+			script_profiler* m_profiler;
+			script_call_site m_site;
+			tmr::time_point m_start;
+	};
+};
@@ -8,6 +8,7 @@ namespace r2 {
 		: gpu_buffer(0), m_data(nullptr), m_width(0), m_height(0),
 		  m_channelCount(0), m_bytesPerChannel(0), m_minFilter(tmnf_nearest),
 		  m_magFilter(tmgf_nearest), m_wrapX(tw_repeat), m_wrapY(tw_repeat),
+		  m_storageChanged(true), m_generateMipmaps(false),
 		  m_minFilterChanged(true), m_magFilterChanged(true), m_wrapXChanged(true),
 		  m_wrapYChanged(true)
 	{
@@ -29,7 +30,9 @@ namespace r2 {
 		m_channelCount = channels;
 		m_bytesPerChannel = type_bpc[type];
 		m_type = type;
-		appended(0, m_size);
+		m_storageChanged = true;
+		m_dirtyRects.clear();
+		mark_dirty(0, 0, width, height);
 	}
 
 	void texture_buffer::create(u32 width, u32 height, u8 channels, texture_type type, bool doZeroData) {
@@ -43,7 +46,9 @@ namespace r2 {
 		m_channelCount = channels;
 		m_bytesPerChannel = type_bpc[type];
 		m_type = type;
-		appended(0, m_size);
+		m_storageChanged = true;
+		m_dirtyRects.clear();
+		mark_dirty(0, 0, width, height);
 	}
 
 	void texture_buffer::set_pixel(u32 x, u32 y, u8 channel, void* data) {
@@ -51,14 +56,89 @@ namespace r2 {
 		size_t pixelOffset = ((x * u32(psz)) + (y * m_width * u32(psz)));
 		size_t channelOffset = channel * m_bytesPerChannel;
 		memcpy(m_data + pixelOffset + channelOffset, data, m_bytesPerChannel);
-		updated(pixelOffset, pixelOffset + channelOffset);
+		mark_dirty(x, y, 1, 1);
 	}
 
 	void texture_buffer::set_pixel(u32 x, u32 y, void* data) {
 		u8 psz = m_channelCount * m_bytesPerChannel;
 		size_t pixelOffset = ((x * u32(psz)) + (y * m_width * u32(psz)));
-		memcpy(m_data + pixelOffset, data, m_bytesPerChannel);
-		updated(pixelOffset, pixelOffset + psz);
+		memcpy(m_data + pixelOffset, data, psz);
+		mark_dirty(x, y, 1, 1);
+	}
+
+	void texture_buffer::set_pixels(u32 x, u32 y, u32 width, u32 height, const void* data) {
+		if (x + width > m_width || y + height > m_height) {
+			r2Error("texture_buffer::set_pixels: Region (%u, %u, %u x %u) is outside of the %u x %u texture. Ignoring", x, y, width, height, m_width, m_height);
+			return;
+		}
+
+		size_t psz = size_t(m_channelCount) * m_bytesPerChannel;
+		size_t rowSize = width * psz;
+		for (u32 row = 0;row < height;row++) {
+			memcpy(m_data + (((y + row) * size_t(m_width)) + x) * psz, (const u8*)data + (row * rowSize), rowSize);
+		}
+		mark_dirty(x, y, width, height);
+	}
+
+	void texture_buffer::mark_dirty(u32 x, u32 y, u32 width, u32 height) {
+		if (width == 0 || height == 0) return;
+		dirty_rect r = { x, y, width, height };
+
+		// absorb every existing rectangle that overlaps (or nearly overlaps) the new one,
+		// growing it each time, until none are left that touch it
+		bool merged = true;
+		while (merged) {
+			merged = false;
+			for (auto it = m_dirtyRects.begin();it != m_dirtyRects.end();it++) {
+				const dirty_rect& o = *it;
+				if (o.x > r.x + r.width + TEXTURE_DIRTY_RECT_MERGE_GAP || r.x > o.x + o.width + TEXTURE_DIRTY_RECT_MERGE_GAP) continue;
+				if (o.y > r.y + r.height + TEXTURE_DIRTY_RECT_MERGE_GAP || r.y > o.y + o.height + TEXTURE_DIRTY_RECT_MERGE_GAP) continue;
+
+				u32 x0 = min(r.x, o.x);
+				u32 y0 = min(r.y, o.y);
+				u32 x1 = max(r.x + r.width, o.x + o.width);
+				u32 y1 = max(r.y + r.height, o.y + o.height);
+				r = { x0, y0, x1 - x0, y1 - y0 };
+				m_dirtyRects.erase(it);
+				merged = true;
+				break;
+			}
+		}
+
+		m_dirtyRects.push_back(r);
+		if (m_dirtyRects.size() <= TEXTURE_MAX_DIRTY_RECTS) return;
+
+		u32 x0 = UINT_MAX, y0 = UINT_MAX, x1 = 0, y1 = 0;
+		for (const dirty_rect& o : m_dirtyRects) {
+			x0 = min(x0, o.x);
+			y0 = min(y0, o.y);
+			x1 = max(x1, o.x + o.width);
+			y1 = max(y1, o.y + o.height);
+		}
+		m_dirtyRects.clear();
+		m_dirtyRects.push_back({ x0, y0, x1 - x0, y1 - y0 });
+	}
+
+	void texture_buffer::clear_dirty_rects() {
+		m_dirtyRects.clear();
+	}
+
+	void texture_buffer::set_generate_mipmaps(bool generate) {
+		// the mip count is part of the texture's storage, the driver uploads all of it again when it's recreated
+		if (generate != m_generateMipmaps) m_storageChanged = true;
+		m_generateMipmaps = generate;
+	}
+
+	u32 texture_buffer::mip_levels() const {
+		if (!m_generateMipmaps) return 1;
+
+		u32 levels = 1;
+		u32 size = max(m_width, m_height);
+		while (size > 1) {
+			size >>= 1;
+			levels++;
+		}
+		return levels;
 	}
 
 	void texture_buffer::set_min_filter(texture_min_filter filter) {
@@ -90,12 +170,12 @@ namespace r2 {
 
 
 
-	render_buffer::render_buffer() : gpu_buffer(0), m_depth(rbdm_no_depth), m_depthModeChanged(true), m_wasSynced(false), m_resized(false) { }
+	render_buffer::render_buffer() : gpu_buffer(0), m_depth(rbdm_no_depth), m_depthModeChanged(true), m_wasSynced(false), m_resized(false), m_dimensions(0, 0) { }
 	
 	render_buffer::~render_buffer() { }
 
 	vec2i render_buffer::dimensions() {
-		if (m_attachments.size() == 0) return vec2i(0, 0);
+		if (m_attachments.size() == 0) return m_dimensions;
 		texture_buffer* first = *m_attachments[0];
 		return vec2i(first->width(), first->height());
 	}
@@ -130,6 +210,7 @@ namespace r2 {
 			attachment->create(size.x, size.y, attachment->channels(), attachment->type(), true);
 		}
 
+		m_dimensions = size;
 		m_resized = true;
 	}
 
@@ -140,4 +221,78 @@ namespace r2 {
 	f32 render_buffer::fetch_depth(u32 x, u32 y) {
 		return r2engine::renderer()->driver()->fetch_render_target_depth(this, x, y);
 	}
+
+	static readback_id nextReadbackId = 1;
+	readback_id render_buffer::request_pixels(u32 x, u32 y, u32 width, u32 height, size_t attachmentIdx) {
+		if (attachmentIdx != RENDER_BUFFER_DEPTH_READBACK && attachmentIdx >= m_attachments.size()) {
+			r2Error("Render buffer %d has no attachment %llu to read back", m_id, attachmentIdx);
+			return 0;
+		}
+
+		vec2i size = dimensions();
+		if (width == 0 || height == 0 || x + width > u32(size.x) || y + height > u32(size.y)) {
+			r2Error("Readback region (%u, %u, %u x %u) is outside of render buffer %d", x, y, width, height, m_id);
+			return 0;
+		}
+
+		readback_request r;
+		r.id = nextReadbackId++;
+		r.x = x;
+		r.y = y;
+		r.width = width;
+		r.height = height;
+		r.attachment = attachmentIdx;
+		if (attachmentIdx == RENDER_BUFFER_DEPTH_READBACK) r.pixel_size = sizeof(f32);
+		else {
+			texture_buffer* tex = *m_attachments[attachmentIdx];
+			r.pixel_size = size_t(tex->channels()) * tex->bytes_per_channel();
+		}
+
+		m_pendingReadbacks.push_back(r);
+		return r.id;
+	}
+
+	readback_id render_buffer::request_depth(u32 x, u32 y, u32 width, u32 height) {
+		if (m_depth == rbdm_no_depth) {
+			r2Error("Render buffer %d has no depth buffer to read back", m_id);
+			return 0;
+		}
+
+		return request_pixels(x, y, width, height, RENDER_BUFFER_DEPTH_READBACK);
+	}
+
+	bool render_buffer::readback_ready(readback_id id) const {
+		return m_completedReadbacks.count(id) > 0;
+	}
+
+	bool render_buffer::take_readback(readback_id id, void* dest, size_t destSize) {
+		auto it = m_completedReadbacks.find(id);
+		if (it == m_completedReadbacks.end()) return false;
+
+		if (destSize < it->second.size()) {
+			r2Error("Readback %llu is %llu bytes, but only %llu bytes were provided", id, it->second.size(), destSize);
+			return false;
+		}
+
+		memcpy(dest, &it->second[0], it->second.size());
+		m_completedReadbacks.erase(it);
+		return true;
+	}
+
+	u8* render_buffer::complete_readback(readback_id id, size_t size) {
+		if (m_completedReadbacks.size() >= RENDER_BUFFER_MAX_COMPLETED_READBACKS) {
+			// ids only grow, the smallest one was requested first
+			auto oldest = m_completedReadbacks.begin();
+			for (auto it = m_completedReadbacks.begin();it != m_completedReadbacks.end();it++) {
+				if (it->first < oldest->first) oldest = it;
+			}
+
+			r2Warn("Readback %llu of render buffer %d was never taken, discarding it", oldest->first, m_id);
+			m_completedReadbacks.erase(oldest);
+		}
+
+		mvector<u8>& data = m_completedReadbacks[id];
+		data.resize(size);
+		return &data[0];
+	}
 };
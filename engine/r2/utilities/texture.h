@@ -2,6 +2,20 @@
 #include <r2/utilities/buffer.h>
 #include <r2/utilities/dynamic_array.hpp>
 
+// Dirty rectangles closer together than this many texels are merged into one
+#define TEXTURE_DIRTY_RECT_MERGE_GAP	16
+
+// Upper bound on the number of dirty rectangles a texture tracks at once. Once
+// exceeded, they're all merged into a single rectangle covering every change
+#define TEXTURE_MAX_DIRTY_RECTS			8
+
+// Passed as the attachment index of a readback request to read depth instead of color
+#define RENDER_BUFFER_DEPTH_READBACK	SIZE_MAX
+
+// Upper bound on the number of finished readbacks a render buffer holds on to.
+// Once exceeded, the oldest ones that were never taken are discarded
+#define RENDER_BUFFER_MAX_COMPLETED_READBACKS	64
+
 namespace r2 {
 	enum texture_type {
 		tt_byte = 0,
@@ -35,6 +49,8 @@ namespace r2 {
 
 	class texture_buffer : public gpu_buffer {
 		public:
+			typedef struct { u32 x, y, width, height; } dirty_rect;
+
 			virtual void* data() const { return m_data; }
 
 			void create(u8* data, u32 width, u32 height, u8 channels, texture_type type);
@@ -42,6 +58,22 @@ namespace r2 {
 
 			void set_pixel(u32 x, u32 y, u8 channel, void* data);
 			void set_pixel(u32 x, u32 y, void* data);
+			// Copies a tightly packed block of pixels into the texture
+			void set_pixels(u32 x, u32 y, u32 width, u32 height, const void* data);
+			void mark_dirty(u32 x, u32 y, u32 width, u32 height);
+
+			inline bool has_dirty_rects() const { return m_dirtyRects.size() > 0; }
+			inline const mlist<dirty_rect>& dirty_rects() const { return m_dirtyRects; }
+			void clear_dirty_rects();
+
+			// Set when the size or format changed, the driver must reallocate the texture's storage
+			inline bool storage_changed() const { return m_storageChanged; }
+			inline void clear_storage_changed() { m_storageChanged = false; }
+
+			// When enabled the driver regenerates the mip chain after uploading changes
+			void set_generate_mipmaps(bool generate);
+			inline bool generates_mipmaps() const { return m_generateMipmaps; }
+			u32 mip_levels() const;
 
 			void set_min_filter(texture_min_filter filter);
 			void set_mag_filter(texture_mag_filter filter);
@@ -89,6 +121,9 @@ namespace r2 {
 			texture_mag_filter m_magFilter;
 			texture_wrap m_wrapX;
 			texture_wrap m_wrapY;
+			mlist<dirty_rect> m_dirtyRects;
+			bool m_storageChanged;
+			bool m_generateMipmaps;
 			bool m_minFilterChanged;
 			bool m_magFilterChanged;
 			bool m_wrapXChanged;
@@ -103,8 +138,17 @@ namespace r2 {
 		rbdm_no_depth
 	};
 
+	typedef u64 readback_id;
+
 	class render_buffer : public gpu_buffer {
 		public:
+			struct readback_request {
+				readback_id id;
+				u32 x, y, width, height;
+				size_t attachment;
+				size_t pixel_size;
+			};
+
 			virtual void* data() const { return nullptr; }
 			inline size_t attachment_count() const { return m_attachments.size(); }
 			inline texture_buffer* attachment(size_t idx) { return *m_attachments[idx]; }
@@ -112,6 +156,7 @@ namespace r2 {
 			inline bool depth_mode_changed() const { return m_depthModeChanged; }
 			inline bool has_mode_updates() const { return m_depthModeChanged; }
 			inline bool has_size_updates() const { return m_resized; }
+			// size of the first attachment, or the size passed to resize() if there are none (depth only)
 			vec2i dimensions();
 			void clear_mode_updates();
 			void clear_size_updates();
@@ -121,6 +166,7 @@ namespace r2 {
 			void set_depth_mode(render_buffer_depth_mode mode);
 			void resize(const vec2i& size);
 
+			// Synchronous, waits for the GPU to finish rendering. Use request_pixels for reads made every frame
 			void fetch_pixel(u32 x, u32 y, size_t attachmentIdx, void* dest, size_t pixelSize);
 			f32 fetch_depth(u32 x, u32 y);
 
@@ -131,6 +177,25 @@ namespace r2 {
 				return pixel;
 			}
 
+			// Asynchronous readback. The region is read after the current frame is
+			// rendered, and becomes available a frame or more later, once the GPU is
+			// done with it. All requests made in a frame are read in one transfer.
+			// Results are tightly packed, top row first. Returns 0 if the request is invalid
+			readback_id request_pixels(u32 x, u32 y, u32 width, u32 height, size_t attachmentIdx);
+			readback_id request_depth(u32 x, u32 y, u32 width = 1, u32 height = 1);
+			bool readback_ready(readback_id id) const;
+			// Copies a finished readback into dest and forgets it
+			bool take_readback(readback_id id, void* dest, size_t destSize);
+
+			template <typename P>
+			bool take_pixel(readback_id id, P& out) {
+				return take_readback(id, &out, sizeof(P));
+			}
+
+			// used by render drivers
+			inline mvector<readback_request>& pending_readbacks() { return m_pendingReadbacks; }
+			u8* complete_readback(readback_id id, size_t size);
+
 		protected:
 			friend class scene;
 			render_buffer();
@@ -140,6 +205,9 @@ namespace r2 {
 			bool m_depthModeChanged;
 			bool m_resized;
 			render_buffer_depth_mode m_depth;
+			vec2i m_dimensions;
 			dynamic_pod_array<texture_buffer*> m_attachments;
+			mvector<readback_request> m_pendingReadbacks;
+			munordered_map<readback_id, mvector<u8>> m_completedReadbacks;
 	};
 };
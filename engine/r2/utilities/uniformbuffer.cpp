@@ -12,6 +12,17 @@ namespace r2 {
 		"mat4i", "mat4ui", "mat4f",
 	};
 
+	// size of each type as passed to uniform_block, before the driver converts its layout
+	static size_t attr_value_sizes[21] = {
+		sizeof(i32)   , sizeof(u32)   , sizeof(f32)   ,
+		sizeof(vec2i) , sizeof(vec2ui), sizeof(vec2f) ,
+		sizeof(vec3i) , sizeof(vec3ui), sizeof(vec3f) ,
+		sizeof(vec4i) , sizeof(vec4ui), sizeof(vec4f) ,
+		sizeof(mat2i) , sizeof(mat2ui), sizeof(mat2f) ,
+		sizeof(mat3i) , sizeof(mat3ui), sizeof(mat3f) ,
+		sizeof(mat4i) , sizeof(mat4ui), sizeof(mat4f)
+	};
+
 	static mstring attr_hash_names[21] = {
 		"i"  , "u"  , "f"  ,
 		"2i" , "2u" , "2f" ,
@@ -125,10 +136,18 @@ namespace r2 {
 
 	// uniform buffer
 
-    uniform_buffer::uniform_buffer(uniform_format* fmt, size_t max_count) : gpu_buffer(max_count * fmt->size()) {
+    uniform_buffer::uniform_buffer(uniform_format* fmt, size_t max_count) : gpu_buffer(max_count * fmt->size(), true) {
         m_format = fmt;
         m_maxCount = max_count;
         m_uniformCount = 0;
+
+		// blocks must begin at offsets that the driver can bind
+		m_blockAlignment = 1;
+		render_driver* driver = r2engine::get()->renderer()->driver();
+		if (driver && driver->get_uniform_buffer_block_offset_alignment() > 0) {
+			m_blockAlignment = driver->get_uniform_buffer_block_offset_alignment();
+		}
+
         r2Log("Allocating %s for a maximum of %d uniform blocks of format [%s] (buf: %d)", format_size(m_format->size() * max_count), max_count, m_format->to_string().c_str(), m_id);
         m_data = new unsigned char[m_format->size() * max_count];
     }
@@ -147,24 +166,20 @@ namespace r2 {
 		return m_data;
 	}
 
+	size_t uniform_buffer::allocation_alignment() const {
+		return m_blockAlignment;
+	}
+
     ufm_bo_segment uniform_buffer::append(const void *data) {
-		render_driver* driver = r2engine::get()->renderer()->driver();
-		if (!driver) {
-			r2Error("A render driver needs to be specified in order to append to a uniform buffer");
+		size_t beginOffset = 0;
+		if (!allocate(m_format->size(), &beginOffset)) {
+			r2Error("Insufficient space in uniform buffer of format [%s] for uniform block (buf: %d)", m_format->to_string().c_str(), m_id);
 			ufm_bo_segment seg;
 			seg.buffer = nullptr;
 			memset(&seg, 0, sizeof(ufm_bo_segment));
 			return seg;
 		}
 
-		size_t beginOffset = used_size();
-		size_t blockAlignment = driver->get_uniform_buffer_block_offset_alignment();
-		size_t alignmentDiff = beginOffset % blockAlignment;
-		if (alignmentDiff != 0) {
-			beginOffset += blockAlignment - alignmentDiff;
-			assert(beginOffset % blockAlignment == 0);
-		}
-
         ufm_bo_segment seg;
         seg.buffer = this;
         seg.begin = m_uniformCount;
@@ -172,14 +187,6 @@ namespace r2 {
         seg.end = m_uniformCount + 1;
         seg.memEnd = seg.memBegin + m_format->size();
 
-		if(seg.memEnd > max_size()) {
-			r2Error("Insufficient space in uniform buffer of format [%s] for uniform block (buf: %d)", m_format->to_string().c_str(), m_id);
-			ufm_bo_segment seg;
-			seg.buffer = nullptr;
-			memset(&seg, 0, sizeof(ufm_bo_segment));
-			return seg;
-		}
-
 		r2Log("Buffering data range: %zu -> %zu (buf: %d)", seg.memBegin, seg.memEnd, m_id);
         memcpy((u8*)m_data + seg.memBegin, data, seg.memsize());
         m_uniformCount += 1;
@@ -213,40 +220,86 @@ namespace r2 {
 		updated(seg.memBegin, seg.memEnd);
 	}
 
+	void uniform_buffer::release(const ufm_bo_segment& seg) {
+		if (!seg.is_valid()) return;
+		if (seg.buffer != this) {
+			r2Error("Segment for another uniform buffer passed to uniform_buffer::release");
+			return;
+		}
+
+		gpu_buffer::release(seg.memBegin, seg.memEnd);
+		m_uniformCount -= 1;
+	}
+
 
 
 	// uniform block
-	uniform_block::uniform_block(const mstring& name, const ufm_bo_segment& buffer_segment) : m_name(name), m_bufferSegment(buffer_segment) {
+	uniform_block::uniform_block(const mstring& name, const ufm_bo_segment& buffer_segment) : m_name(name), m_bufferSegment(buffer_segment), m_uploadGeneration(SIZE_MAX) {
 		uniform_format* fmt = m_bufferSegment.buffer->format();
 		auto attrNames = fmt->attributeNames();
 		auto attrs = fmt->attributes();
 		for (u16 i = 0;i < attrNames.size();i++) {
-			uniform_attribute_type type = attrs[i];
-			m_uniformOffsetMap[attrNames[i]] = fmt->offsetOf(i);
-			m_uniformSizeMap[attrNames[i]] = r2engine::get()->renderer()->driver()->get_uniform_attribute_size(fmt, i, type);
-			m_uniformIndexMap[attrNames[i]] = i;
+			uniform_handle h;
+			h.type = attrs[i];
+			h.index = i;
+			h.offset = fmt->offsetOf(i);
+			h.size = r2engine::get()->renderer()->driver()->get_uniform_attribute_size(fmt, i, h.type);
+			h.valueSize = attr_value_sizes[h.type];
+			h.direct = h.size == h.valueSize;
+			m_handles[attrNames[i]] = h;
 		}
 	}
 
 	uniform_block::~uniform_block() {
-		// TODO: tell the buffer this block's segment is free
+		if (m_bufferSegment.buffer) m_bufferSegment.buffer->release(m_bufferSegment);
 	}
 
 	void uniform_block::uniform(const mstring& name, const void* value) {
-		if (m_uniformOffsetMap.count(name) == 0) {
+		auto h = m_handles.find(name);
+		if (h == m_handles.end()) {
 			r2Error("No uniform with name \"%s\" exists in block \"%s\". Ignoring", name.c_str(), m_name.c_str());
 			return;
 		}
 
-		u16 idx = m_uniformIndexMap[name];
-		uniform_attribute_type type = m_bufferSegment.buffer->format()->attributes()[idx];
-		static u8 castSpace[2048];
-		
-		// cast value to the format that the driver expects to see, if necessary
-		r2engine::get()->renderer()->driver()->serialize_uniform_value(value, castSpace, m_bufferSegment.buffer->format(), idx, type);
+		uniform(h->second, value);
+	}
 
-		// fill the buffer segment with the value in the new format
-		m_bufferSegment.buffer->update(getSegmentForField(name), castSpace);
+	uniform_handle uniform_block::handle(const mstring& name) const {
+		auto h = m_handles.find(name);
+		if (h == m_handles.end()) {
+			r2Error("No uniform with name \"%s\" exists in block \"%s\"", name.c_str(), m_name.c_str());
+			return uniform_handle();
+		}
+
+		return h->second;
+	}
+
+	void uniform_block::uniform(const uniform_handle& field, const void* value) {
+		if (!field.is_valid() || !m_bufferSegment.buffer) return;
+
+		uniform_buffer* buf = m_bufferSegment.buffer;
+		u8* dest = (u8*)buf->data() + m_bufferSegment.memBegin + field.offset;
+
+		// write straight into the buffer, casting value to the format that the driver expects to see if necessary
+		if (field.direct) memcpy(dest, value, field.size);
+		else r2engine::get()->renderer()->driver()->serialize_uniform_value(value, dest, buf->format(), field.index, field.type);
+
+		// the whole block is uploaded once per sync, no matter how many of its fields change
+		if (m_uploadGeneration != buf->update_generation()) {
+			buf->updated(m_bufferSegment.memBegin, m_bufferSegment.memEnd);
+			m_uploadGeneration = buf->update_generation();
+		}
+	}
+
+	bool uniform_block::uniform(const uniform_handle& field, const void* value, size_t valueSize) {
+		if (!field.is_valid()) return false;
+		if (valueSize != field.valueSize) {
+			r2Error("Value of %d bytes can't be assigned to a %s uniform (%d bytes) in block \"%s\"", valueSize, attr_names[field.type].c_str(), field.valueSize, m_name.c_str());
+			return false;
+		}
+
+		uniform(field, value);
+		return true;
 	}
 
 	mstring uniform_block::name() const {
@@ -279,16 +332,6 @@ namespace r2 {
 	void uniform_block::uniform_mat4f (const mstring& name, const mat4f&  value) { uniform(name, &value); }
 	void uniform_block::uniform_mat4ui(const mstring& name, const mat4ui& value) { uniform(name, &value); }
 
-	ufm_bo_segment uniform_block::getSegmentForField(const mstring& name) const {
-		u16 attrIdx = m_uniformIndexMap.at(name);
-
-		ufm_bo_segment seg;
-		seg.memBegin = m_bufferSegment.memBegin + m_uniformOffsetMap.at(name);
-		seg.memEnd = seg.memBegin + m_uniformSizeMap.at(name);
-		seg.buffer = m_bufferSegment.buffer;
-		return seg;
-	}
-
 
 
 	namespace static_uniform_formats {
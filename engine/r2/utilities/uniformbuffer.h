@@ -42,6 +42,26 @@ namespace r2 {
 			mstring m_hashName;
     };
 
+	// A uniform field resolved from its name ahead of time. Offsets are relative
+	// to the start of a block, so a handle is valid for every block of the format
+	// it was resolved from
+	struct uniform_handle {
+		uniform_handle() : offset(0), size(0), valueSize(0), index(u16(-1)), type(uat_int), direct(false) { }
+
+		inline bool is_valid() const { return index != u16(-1); }
+
+		size_t offset;
+		size_t size;
+
+		// size of the value passed in, before the driver converts its layout
+		size_t valueSize;
+		u16 index;
+		uniform_attribute_type type;
+
+		// value can be copied as-is, without the driver converting its layout
+		bool direct;
+	};
+
     class uniform_buffer;
     struct ufm_bo_segment : public gpu_buffer_segment {
 		ufm_bo_segment() : gpu_buffer_segment(), buffer(nullptr) { }
@@ -56,6 +76,15 @@ namespace r2 {
 			void uniform(const mstring& name, const void* value);
 			mstring name() const;
 
+			uniform_handle handle(const mstring& name) const;
+			void uniform(const uniform_handle& field, const void* value);
+
+			// Refuses values whose size doesn't match the field's type, returns false if the value wasn't written
+			template <typename T>
+			bool set(const uniform_handle& field, const T& value) {
+				return uniform(field, (const void*)&value, sizeof(T));
+			}
+
 			const ufm_bo_segment& buffer_info() const;
 
 			void uniform_int   (const mstring& name, const i32&    value);
@@ -81,14 +110,15 @@ namespace r2 {
 			void uniform_mat4f (const mstring& name, const mat4f&  value);
 
 		protected:
-			mstring m_name;
+			bool uniform(const uniform_handle& field, const void* value, size_t valueSize);
 
-			ufm_bo_segment getSegmentForField(const mstring& name) const;
+			mstring m_name;
 
 			ufm_bo_segment m_bufferSegment;
-			munordered_map<mstring, u16> m_uniformOffsetMap;
-			munordered_map<mstring, u16> m_uniformIndexMap;
-			munordered_map<mstring, size_t> m_uniformSizeMap;
+			munordered_map<mstring, uniform_handle> m_handles;
+
+			// update generation of the buffer when this block was last flagged for upload
+			size_t m_uploadGeneration;
 	};
 
     class uniform_buffer : public gpu_buffer {
@@ -98,12 +128,15 @@ namespace r2 {
 
             uniform_format* format() const;
 			virtual void* data() const;
+			virtual size_t allocation_alignment() const;
 
             ufm_bo_segment append(const void* data);
 			void update(const ufm_bo_segment& segment, const void* data);
+			void release(const ufm_bo_segment& segment);
 
         protected:
 			uniform_format* m_format;
+			size_t m_blockAlignment;
             size_t m_uniformCount;
             size_t m_maxCount;
             unsigned char* m_data;
@@ -22,5 +22,13 @@ namespace r2 {
 		}
 		return arr;
 	}
+	u64 hash_bytes(const void* data, size_t size, u64 hash) {
+		const u8* bytes = (const u8*)data;
+		for (size_t i = 0;i < size;i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
 
 };
@@ -4,4 +4,8 @@
 namespace r2 {
 	mstring format_string(const char* fmt, ...);
 	mvector<mstring> split(const mstring& str, const mstring& sep);
+
+	// FNV-1a, pass a previous result as 'hash' to continue hashing from it
+	u64 hash_bytes(const void* data, size_t size, u64 hash = 14695981039346656037ULL);
+	inline u64 hash_string(const mstring& str) { return hash_bytes(str.c_str(), str.length()); }
 };
\ No newline at end of file
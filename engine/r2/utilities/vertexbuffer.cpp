@@ -29,14 +29,19 @@ namespace r2 {
 		"m3i", "m3f", "m3u",
 		"m4i", "m4f", "m4u"
 	};
+	// format registry, hash name -> id
+	static munordered_map<mstring, u16> vertex_format_ids;
+
     vertex_format::vertex_format() {
         m_vertexSize = 0;
+		m_id = 0;
     }
     vertex_format::vertex_format(const vertex_format& o) {
         m_attrs = o.m_attrs;
         m_vertexSize = o.m_vertexSize;
         m_fmtString = o.m_fmtString;
 		m_hashName = o.m_hashName;
+		m_id = o.m_id;
     }
     vertex_format::~vertex_format() {
     }
@@ -47,6 +52,7 @@ namespace r2 {
         if(m_fmtString.length() > 0) m_fmtString += ", ";
         m_fmtString += attr_names[type];
 		m_hashName += attr_hash_names[type];
+		m_id = 0;
     }
     bool vertex_format::operator==(const vertex_format &rhs) const {
         if(rhs.m_attrs.size() != m_attrs.size()) return false;
@@ -79,6 +85,17 @@ namespace r2 {
 	mstring vertex_format::hash_name() const {
 		return m_hashName;
 	}
+	u16 vertex_format::id() const {
+		if (m_id == 0) {
+			auto it = vertex_format_ids.find(m_hashName);
+			if (it == vertex_format_ids.end()) {
+				m_id = u16(vertex_format_ids.size() + 1);
+				vertex_format_ids[m_hashName] = m_id;
+			} else m_id = it->second;
+		}
+
+		return m_id;
+	}
 
     vertex_buffer::vertex_buffer(vertex_format* fmt, size_t max_count) : gpu_buffer(max_count * fmt->size()) {
         m_format = fmt;
@@ -98,8 +115,12 @@ namespace r2 {
 	void* vertex_buffer::data() const {
 		return m_data;
 	}
+	size_t vertex_buffer::allocation_alignment() const {
+		return m_format->size();
+	}
     vtx_bo_segment vertex_buffer::append(const void *data, size_t count) {
-        if(count > m_maxCount - m_vertexCount) {
+		size_t memBegin = 0;
+        if(!allocate(count * m_format->size(), &memBegin)) {
             r2Error("Insufficient space in vertex buffer of format [%s] for %d vertices (%d max) (buf: %d)", m_format->to_string().c_str(), count, m_maxCount, m_id);
             vtx_bo_segment seg;
             seg.buffer = nullptr;
@@ -108,8 +129,8 @@ namespace r2 {
         }
         vtx_bo_segment seg;
         seg.buffer = this;
-        seg.begin = m_vertexCount;
-        seg.memBegin = used_size();
+        seg.begin = memBegin / m_format->size();
+        seg.memBegin = memBegin;
         seg.end = seg.begin + count;
         seg.memEnd = seg.end * m_format->size();
 
@@ -132,12 +153,12 @@ namespace r2 {
 			return;
 		}
 
-		if (seg.memBegin > m_format->size() * m_vertexCount) {
+		if (seg.memBegin > used_size()) {
 			r2Error("Out of range segment.memBegin (%llu) provided to vertex_buffer::update", seg.memBegin);
 			return;
 		}
 
-		if (seg.memEnd > m_format->size() * m_vertexCount) {
+		if (seg.memEnd > used_size()) {
 			r2Error("Out of range segment.memEnd (%llu) provided to vertex_buffer::update", seg.memEnd);
 			return;
 		}
@@ -145,4 +166,15 @@ namespace r2 {
 		memcpy((u8*)m_data + seg.memBegin, data, seg.memsize());
 		updated(seg.memBegin, seg.memEnd);
 	}
+
+	void vertex_buffer::release(const vtx_bo_segment& seg) {
+		if (!seg.is_valid()) return;
+		if (seg.buffer != this) {
+			r2Error("Segment for another vertex buffer passed to vertex_buffer::release");
+			return;
+		}
+
+		gpu_buffer::release(seg.memBegin, seg.memEnd);
+		m_vertexCount -= seg.size();
+	}
 }
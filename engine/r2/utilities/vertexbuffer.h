@@ -45,11 +45,16 @@ namespace r2 {
             mstring to_string() const;
 			mstring hash_name() const;
 
+			// Small integer id shared by every format with the same attributes,
+			// assigned the first time it's requested. 0 is never a valid id
+			u16 id() const;
+
         protected:
             mvector<vertex_attribute_type> m_attrs;
             size_t m_vertexSize;
             mstring m_fmtString;
 			mstring m_hashName;
+			mutable u16 m_id;
     };
 
     class vertex_buffer;
@@ -76,9 +81,11 @@ namespace r2 {
 
             vertex_format* format() const;
 			virtual void* data() const;
+			virtual size_t allocation_alignment() const;
 
             vtx_bo_segment append(const void* data, size_t count);
 			void update(const vtx_bo_segment& segment, const void* data);
+			void release(const vtx_bo_segment& segment);
 
         protected:
             vertex_format* m_format;
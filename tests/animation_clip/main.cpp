@@ -0,0 +1,90 @@
+#include <r2/engine.h>
+using namespace r2;
+
+void set_float(const f32& value, scene_entity* entity, void* user_data) { }
+void set_vec3(const vec3f& value, scene_entity* entity, void* user_data) { }
+void set_mat4(const mat4f& value, scene_entity* entity, void* user_data) { }
+
+animation_track_base* create_float(const mstring& name, void* initial_value) {
+	return new animation_track<f32>(name, *(f32*)initial_value, set_float, default_interpolator<f32>);
+}
+animation_track_base* create_vec3(const mstring& name, void* initial_value) {
+	return new animation_track<vec3f>(name, *(vec3f*)initial_value, set_vec3, default_interpolator<vec3f>);
+}
+animation_track_base* create_mat4(const mstring& name, void* initial_value) {
+	return new animation_track<mat4f>(name, *(mat4f*)initial_value, set_mat4, default_interpolator<mat4f>);
+}
+
+int main(int argc, char** argv) {
+	r2engine::create(argc, argv);
+	r2engine* eng = r2engine::get();
+
+	animation_deserializer deserializer;
+	deserializer.register_track("empty", nullptr, create_float);
+	deserializer.register_track("empty_transform", nullptr, create_mat4);
+	deserializer.register_track("float", nullptr, create_float);
+	deserializer.register_track("position", nullptr, create_vec3);
+	deserializer.register_track("transform", nullptr, create_mat4);
+
+	animation_group source("clip", 2.0f, true);
+	source.add_track<f32>("empty", 7.0f, set_float);
+	source.add_track<mat4f>("empty_transform", mat4f(1.0f), set_mat4);
+	source.add_track<f32>("float", 0.0f, set_float);
+	source.add_track<vec3f>("position", vec3f(0.0f), set_vec3);
+	source.add_track<mat4f>("transform", mat4f(1.0f), set_mat4);
+
+	source.set<f32>("float", 1.0f, 0.5f, interpolate::itm_linear);
+	source.set<f32>("float", 3.0f, 1.0f, interpolate::itm_easeInQuad);
+	source.set<f32>("float", -2.0f, 2.0f, interpolate::itm_linear);
+
+	// the middle keyframe lies on the line between the others and is dropped
+	source.set<vec3f>("position", vec3f(0.0f, 0.0f, 0.0f), 0.0f, interpolate::itm_linear);
+	source.set<vec3f>("position", vec3f(1.0f, 2.0f, 3.0f), 1.0f, interpolate::itm_linear);
+	source.set<vec3f>("position", vec3f(2.0f, 4.0f, 6.0f), 2.0f, interpolate::itm_linear);
+
+	mat4f moved = glm::translate(mat4f(1.0f), vec3f(1.0f, -2.0f, 3.0f)) * glm::scale(mat4f(1.0f), vec3f(2.0f));
+	source.set<mat4f>("transform", mat4f(1.0f), 0.0f, interpolate::itm_linear);
+	source.set<mat4f>("transform", moved, 1.0f, interpolate::itm_easeOutCubic);
+
+	// writing a clip must not touch a track's values, tracks without keyframes included
+	data_container* clip = eng->files()->create(DM_BINARY, "clip");
+	assert(source.serialize_clip(clip));
+	assert(source.track<f32>("empty")->keyframe_count() == 0);
+	assert(source.track<f32>("float")->keyframe_count() == 3);
+	clip->set_position(0);
+
+	animation_group loaded("", 0.0f);
+	assert(loaded.deserialize_clip(clip, deserializer));
+	assert(loaded.name() == "clip");
+	assert(loaded.duration() == 2.0f);
+	assert(loaded.loops());
+
+	auto empty = loaded.track<f32>("empty");
+	assert(empty && empty->keyframe_count() == 0);
+	assert(empty->initial_value == 7.0f);
+	assert(empty->get(1.0f) == 7.0f);
+
+	auto emptyTransform = loaded.track<mat4f>("empty_transform");
+	assert(emptyTransform && emptyTransform->keyframe_count() == 0);
+
+	auto floats = loaded.track<f32>("float");
+	assert(floats->keyframe_count() == 3);
+	for (size_t k = 0;k < 3;k++) {
+		assert(floats->keyframe_times[k] == source.track<f32>("float")->keyframe_times[k]);
+		assert(fabsf(floats->keyframe_values[k] - source.track<f32>("float")->keyframe_values[k]) <= ANIMATION_CLIP_DEFAULT_TOLERANCE);
+	}
+	assert(floats->keyframes[1].interpolation_mode == interpolate::itm_easeInQuad);
+
+	auto position = loaded.track<vec3f>("position");
+	assert(position->keyframe_count() == 2);
+	assert(glm::length(position->get(1.0f) - vec3f(1.0f, 2.0f, 3.0f)) <= ANIMATION_CLIP_DEFAULT_TOLERANCE * 3.0f);
+
+	auto transform = loaded.track<mat4f>("transform");
+	assert(transform->keyframe_count() == 2);
+	mat4f end = transform->get(1.0f);
+	for (u8 c = 0;c < 4;c++) assert(glm::length(end[c] - moved[c]) <= 0.01f);
+
+	eng->files()->destroy(clip);
+	eng->shutdown();
+	return 0;
+}
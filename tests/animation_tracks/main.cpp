@@ -0,0 +1,64 @@
+#include <r2/engine.h>
+using namespace r2;
+
+void set_float(const f32& value, scene_entity* entity, void* user_data) { }
+
+int main(int argc, char** argv) {
+	r2engine::create(argc, argv);
+	r2engine* eng = r2engine::get();
+
+	animation_track<f32> track("value", 0.0f, set_float, default_interpolator<f32>);
+	assert(track.get(1.0f) == 0.0f);
+
+	// keyframes are kept sorted by time, whatever order they're set in
+	assert(track.set(0.0f, 2.0f, interpolate::itm_linear) == 0);
+	assert(track.set(2.0f, 0.5f, interpolate::itm_linear) == 0);
+	assert(track.set(4.0f, 1.0f, interpolate::itm_linear) == 1);
+	assert(track.keyframe_count() == 3);
+	assert(track.keyframe_times[0] == 0.5f && track.keyframe_times[1] == 1.0f && track.keyframe_times[2] == 2.0f);
+	assert(track.keyframe_values[0] == 2.0f && track.keyframe_values[1] == 4.0f && track.keyframe_values[2] == 0.0f);
+
+	// setting a keyframe at an existing time replaces it
+	bool exists = false;
+	assert(track.find_insert(1.00005f, &exists) == 1 && exists);
+	assert(track.find_insert(1.5f, &exists) == 2 && !exists);
+	assert(track.set(5.0f, 1.00005f, interpolate::itm_linear) == 1);
+	assert(track.keyframe_count() == 3);
+	assert(track.keyframe_times[1] == 1.0f && track.keyframe_values[1] == 5.0f);
+	track.set(4.0f, 1.0f, interpolate::itm_linear);
+
+	// segments are found by search, and by stepping forward from the last one during playback
+	assert(track.find_segment(0.5f) == 0);
+	assert(track.find_segment(0.75f) == 0);
+	assert(track.find_segment(1.0f) == 1);
+	assert(track.find_segment(1.99f) == 1);
+	assert(track.find_segment(0.6f) == 0);
+	assert(track.find_segment(1.2f) == 1 && track.last_keyframe == 1);
+	assert(track.find_segment(0.7f) == 0 && track.last_keyframe == 0);
+
+	// keyframes inserted before the last sampled one don't confuse the search
+	track.find_segment(1.5f);
+	assert(track.set(1.0f, 0.25f, interpolate::itm_linear) == 0);
+	assert(track.find_segment(0.3f) == 0);
+	assert(track.find_segment(1.5f) == 2);
+
+	// sampling interpolates from the initial value up to the first keyframe and holds the last one
+	animation_track<f32> sampled("sampled", 0.0f, set_float, default_interpolator<f32>);
+	sampled.set(2.0f, 0.5f, interpolate::itm_linear);
+	sampled.set(4.0f, 1.0f, interpolate::itm_linear);
+	sampled.set(0.0f, 2.0f, interpolate::itm_linear);
+	assert(sampled.get(0.25f) == 1.0f);
+	assert(sampled.get(0.5f) == 2.0f);
+	assert(sampled.get(0.75f) == 3.0f);
+	assert(sampled.get(1.5f) == 2.0f);
+	assert(sampled.get(0.75f) == 3.0f);
+	assert(sampled.get(3.0f) == 0.0f);
+
+	f32 out = -1.0f;
+	sampled.prepare_sample();
+	sampled.sample(1.5f, &out);
+	assert(out == 2.0f);
+
+	eng->shutdown();
+	return 0;
+}
@@ -0,0 +1,64 @@
+#include <r2/engine.h>
+using namespace r2;
+
+typedef mlist<gpu_buffer::changed_buffer_segment> update_list;
+
+bool ranges_are(const update_list& updates, const mvector<std::pair<size_t, size_t>>& expected) {
+	if (updates.size() != expected.size()) return false;
+	size_t i = 0;
+	for (auto& seg : updates) {
+		if (seg.begin != expected[i].first || seg.end != expected[i].second) return false;
+		i++;
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	r2engine::create(argc, argv);
+	r2engine* eng = r2engine::get();
+
+	const size_t gap = GPU_BUFFER_UPDATE_MERGE_GAP;
+	update_list updates;
+
+	// distant ranges stay separate and sorted, whatever order they're added in
+	gpu_buffer::merge_update(updates, 10000, 10100);
+	gpu_buffer::merge_update(updates, 0, 100);
+	gpu_buffer::merge_update(updates, 5000, 5100);
+	assert(ranges_are(updates, { { 0, 100 }, { 5000, 5100 }, { 10000, 10100 } }));
+
+	// overlapping and nearly touching ranges are coalesced
+	gpu_buffer::merge_update(updates, 50, 200);
+	assert(ranges_are(updates, { { 0, 200 }, { 5000, 5100 }, { 10000, 10100 } }));
+	gpu_buffer::merge_update(updates, 200 + gap, 300 + gap);
+	assert(ranges_are(updates, { { 0, 300 + gap }, { 5000, 5100 }, { 10000, 10100 } }));
+	gpu_buffer::merge_update(updates, 5100 + gap + 1, 5200 + gap);
+	assert(ranges_are(updates, { { 0, 300 + gap }, { 5000, 5100 }, { 5100 + gap + 1, 5200 + gap }, { 10000, 10100 } }));
+
+	// a range spanning several others swallows them all
+	gpu_buffer::merge_update(updates, 4000, 9000);
+	assert(ranges_are(updates, { { 0, 300 + gap }, { 4000, 9000 }, { 10000, 10100 } }));
+
+	// ranges contained by another change nothing
+	gpu_buffer::merge_update(updates, 4500, 4600);
+	assert(ranges_are(updates, { { 0, 300 + gap }, { 4000, 9000 }, { 10000, 10100 } }));
+
+	// the list never grows past the limit, the two closest ranges are merged instead
+	updates.clear();
+	size_t stride = gap * 4;
+	for (size_t i = 0;i < GPU_BUFFER_MAX_UPDATE_RANGES;i++) gpu_buffer::merge_update(updates, i * stride, i * stride + 1);
+	assert(updates.size() == GPU_BUFFER_MAX_UPDATE_RANGES);
+
+	size_t far = (GPU_BUFFER_MAX_UPDATE_RANGES - 1) * stride + gap * 2;
+	gpu_buffer::merge_update(updates, far, far + 1);
+	assert(updates.size() == GPU_BUFFER_MAX_UPDATE_RANGES);
+	assert(updates.front().begin == 0 && updates.front().end == 1);
+	assert(updates.back().begin == (GPU_BUFFER_MAX_UPDATE_RANGES - 1) * stride && updates.back().end == far + 1);
+	size_t covered = 0;
+	for (auto& seg : updates) {
+		assert(seg.begin >= covered);
+		covered = seg.end;
+	}
+
+	eng->shutdown();
+	return 0;
+}
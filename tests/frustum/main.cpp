@@ -0,0 +1,55 @@
+#include <r2/engine.h>
+#include <r2/utilities/frustum.h>
+using namespace r2;
+
+int main(int argc, char** argv) {
+	r2engine::create(argc, argv);
+	r2engine* eng = r2engine::get();
+
+	// camera at the origin looking down -z, near 1, far 100
+	mat4f proj = glm::perspective(glm::radians(90.0f), 1.0f, 1.0f, 100.0f);
+	mat4f view = glm::lookAt(vec3f(0.0f), vec3f(0.0f, 0.0f, -1.0f), vec3f(0.0f, 1.0f, 0.0f));
+	frustum f(proj * view);
+
+	// inside, outside each plane, and straddling planes
+	vec4f spheres[] = {
+		vec4f(0.0f, 0.0f, -10.0f, 1.0f),
+		vec4f(0.0f, 0.0f, 10.0f, 1.0f),
+		vec4f(0.0f, 0.0f, -200.0f, 1.0f),
+		vec4f(-50.0f, 0.0f, -10.0f, 1.0f),
+		vec4f(50.0f, 0.0f, -10.0f, 1.0f),
+		vec4f(0.0f, -50.0f, -10.0f, 1.0f),
+		vec4f(0.0f, 50.0f, -10.0f, 1.0f),
+		vec4f(0.0f, 0.0f, -100.5f, 1.0f),
+		vec4f(10.5f, 0.0f, -10.0f, 1.0f),
+		vec4f(0.0f, 0.0f, -0.5f, 1.0f)
+	};
+	bool expected[] = { true, false, false, false, false, false, false, true, true, true };
+	const size_t count = sizeof(spheres) / sizeof(vec4f);
+
+	for (size_t i = 0;i < count;i++) assert(f.test_sphere(spheres[i]) == expected[i]);
+
+	// the batched test agrees with the single sphere test, including the partial group of 4 at the end
+	u8 visible[count];
+	size_t visibleCount = f.test_spheres(spheres, count, visible);
+	size_t expectedCount = 0;
+	for (size_t i = 0;i < count;i++) {
+		assert((visible[i] == 1) == expected[i]);
+		if (expected[i]) expectedCount++;
+	}
+	assert(visibleCount == expectedCount);
+
+	// bounding spheres follow their transform, scaled by the largest axis
+	vec3f points[] = { vec3f(-1.0f, -1.0f, -1.0f), vec3f(1.0f, 1.0f, 1.0f) };
+	bounding_volume bounds;
+	bounds.from_points(points, 2, sizeof(vec3f), 3);
+	assert(bounds.valid && bounds.center == vec3f(0.0f));
+	mat4f transform = glm::scale(glm::translate(mat4f(1.0f), vec3f(0.0f, 0.0f, -300.0f)), vec3f(1.0f, 1.0f, 250.0f));
+	vec4f sphere = bounds.transformed_sphere(transform);
+	assert(vec3f(sphere) == vec3f(0.0f, 0.0f, -300.0f));
+	assert(f.test_sphere(sphere));
+	assert(!f.test_sphere(bounds.transformed_sphere(glm::translate(mat4f(1.0f), vec3f(0.0f, 0.0f, -300.0f)))));
+
+	eng->shutdown();
+	return 0;
+}
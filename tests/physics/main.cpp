@@ -194,7 +194,7 @@ class test_entity : public scene_entity {
 				mesh->set_instance_transform(t);
 			}
 			physics->set_mass(is_floor ? 0 : 10);
-			physics->set_shape(new btBoxShape(btVector3(0.5f, 0.5f, 0.5f)));
+			physics->set_shape(physics_sys::get()->shapes()->box(vec3f(0.5f, 0.5f, 0.5f)));
 			r2engine::get()->remove_child(this);
 		}
 
@@ -0,0 +1,64 @@
+#include <r2/engine.h>
+using namespace r2;
+
+class collision_receiver : public event_receiver {
+	public:
+		collision_receiver() : batches(0) { subscribe(EVT_NAME_COLLISION_EVENTS); }
+		virtual ~collision_receiver() { }
+
+		virtual void handle(event* e) {
+			batches++;
+			const mvector<u8>& buffer = e->buffer();
+			assert(buffer.size() % sizeof(collision_record) == 0);
+			records.resize(buffer.size() / sizeof(collision_record));
+			memcpy(records.data(), buffer.data(), buffer.size());
+		}
+
+		u32 batches;
+		mvector<collision_record> records;
+};
+
+int main(int argc, char** argv) {
+	r2engine::create(argc, argv);
+	r2engine* eng = r2engine::get();
+
+	collision_receiver* rec = new collision_receiver();
+	eng->add_child(rec);
+
+	// scripts read the records as 32-bit words, ids first
+	collision_record sent[3];
+	sent[0] = { cet_begin, 1, 2, vec3f(1.0f, 2.0f, 3.0f), vec3f(0.0f, 1.0f, 0.0f), 4.5f };
+	sent[1] = { cet_persist, 1, 3, vec3f(-1.0f, 0.0f, 0.5f), vec3f(1.0f, 0.0f, 0.0f), 0.25f };
+	sent[2] = { cet_end, 2, 3, vec3f(0.0f), vec3f(0.0f), 0.0f };
+	const u32* words = (const u32*)&sent[1];
+	assert(words[0] == cet_persist && words[1] == 1 && words[2] == 3);
+	assert(((const f32*)words)[3] == -1.0f && ((const f32*)words)[9] == 0.25f);
+
+	// every record of a tick arrives in one event
+	event e = evt(EVT_NAME_COLLISION_EVENTS);
+	e.set_buffer(sent, sizeof(sent));
+	eng->dispatch(&e);
+	assert(rec->batches == 1);
+	assert(rec->records.size() == 3);
+	for (u32 i = 0;i < 3;i++) {
+		const collision_record& r = rec->records[i];
+		assert(r.type == sent[i].type && r.a == sent[i].a && r.b == sent[i].b);
+		assert(r.point == sent[i].point && r.normal == sent[i].normal && r.impulse == sent[i].impulse);
+	}
+
+	// deferred events keep their records
+	event copy(e);
+	assert(copy.buffer().size() == sizeof(sent));
+	assert(memcmp(copy.buffer().data(), sent, sizeof(sent)) == 0);
+
+	// other events carry no buffer
+	event other = evt("not_collisions");
+	assert(other.buffer().size() == 0);
+	eng->dispatch(&other);
+	assert(rec->batches == 1);
+
+	eng->remove_child(rec);
+	delete rec;
+	eng->shutdown();
+	return 0;
+}
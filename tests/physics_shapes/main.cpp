@@ -0,0 +1,58 @@
+#include <r2/engine.h>
+#include <r2/systems/physics_shapes.h>
+using namespace r2;
+
+int main(int argc, char** argv) {
+	r2engine::create(argc, argv);
+	r2engine* eng = r2engine::get();
+
+	physics_shape_cache* cache = new physics_shape_cache();
+
+	// equivalent shapes are shared, different parameters or kinds are not
+	btCollisionShape* box = cache->box(vec3f(1.0f, 2.0f, 3.0f));
+	assert(box == cache->box(vec3f(1.0f, 2.0f, 3.0f)));
+	assert(box != cache->box(vec3f(1.0f, 2.0f, 4.0f)));
+	btCollisionShape* sphere = cache->sphere(1.0f);
+	assert(sphere == cache->sphere(1.0f));
+	assert(sphere != cache->capsule(1.0f, 0.0f));
+	assert(cache->owns(box) && cache->owns(sphere));
+	assert(cache->shape_count() == 4);
+
+	// scales are keyed after quantizing away float noise
+	btCollisionShape* scaled = cache->scaled(box, vec3f(2.0f));
+	assert(scaled != box);
+	assert(scaled == cache->scaled(box, vec3f(2.00001f, 1.99999f, 2.0f)));
+	assert(scaled == cache->scaled(cache->scaled(box, vec3f(3.0f)), vec3f(2.0f)));
+	assert(box == cache->scaled(box, vec3f(1.0f)));
+	assert(scaled->getLocalScaling() == btVector3(2.0f, 2.0f, 2.0f));
+	assert(cache->shape_count() == 6);
+
+	// released scaled variants are deleted, unscaled shapes stay
+	cache->release(cache->scaled(box, vec3f(3.0f)));
+	cache->release(scaled);
+	assert(cache->shape_count() == 4);
+	cache->release(box);
+	assert(cache->shape_count() == 4);
+	assert(box == cache->box(vec3f(1.0f, 2.0f, 3.0f)));
+
+	// a released variant is created again when it's needed again
+	scaled = cache->scaled(box, vec3f(2.0f));
+	assert(cache->owns(scaled));
+	assert(cache->shape_count() == 5);
+
+	// meshes are shared by content, scaled meshes wrap the unscaled one
+	vec3f vertices[] = { vec3f(0.0f, 0.0f, 0.0f), vec3f(1.0f, 0.0f, 0.0f), vec3f(0.0f, 0.0f, 1.0f) };
+	u32 indices[] = { 0, 1, 2 };
+	btCollisionShape* mesh = cache->triangle_mesh(vertices, 3, indices, 3);
+	assert(mesh && mesh == cache->triangle_mesh(vertices, 3, indices, 3));
+	btCollisionShape* scaledMesh = cache->scaled(mesh, vec3f(0.5f));
+	assert(scaledMesh->getShapeType() == SCALED_TRIANGLE_MESH_SHAPE_PROXYTYPE);
+	cache->release(scaledMesh);
+	cache->release(mesh);
+	assert(cache->shape_count() == 6);
+	assert(mesh == cache->triangle_mesh(vertices, 3, indices, 3));
+
+	delete cache;
+	eng->shutdown();
+	return 0;
+}
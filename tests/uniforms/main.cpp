@@ -66,6 +66,35 @@ int main(int argc, char** argv) {
 		assert(in[3] == vec4f(out[3]));
 	}
 
+	// handles refuse values that aren't the size of their field's type
+	{
+		scene* s = eng->scenes()->create("uniform test");
+		uniform_format* fmt = new uniform_format();
+		fmt->add_attr("position", uat_vec3f);
+		fmt->add_attr("transform", uat_mat4f);
+		uniform_block* block = s->allocate_uniform_block("u_test", fmt);
+
+		uniform_handle position = block->handle("position");
+		uniform_handle transform = block->handle("transform");
+		assert(position.is_valid() && transform.is_valid());
+		const u8* data = (const u8*)block->buffer_info().buffer->data() + block->buffer_info().memBegin;
+
+		assert(block->set(position, vec3f(1.0f, 2.0f, 3.0f)));
+		assert(!block->set(position, vec4f(4.0f)));
+		assert(!block->set(position, mat4f(5.0f)));
+		assert(!block->set(position, 6.0f));
+		assert(vec3f(*(const vec4f*)(data + position.offset)) == vec3f(1.0f, 2.0f, 3.0f));
+
+		mat4f m(2.0f);
+		assert(block->set(transform, m));
+		assert(!block->set(transform, vec3f(7.0f)));
+		assert(*(const mat4f*)(data + transform.offset) == m);
+
+		assert(!block->set(block->handle("missing"), vec3f(8.0f)));
+
+		eng->scenes()->destroy(s);
+	}
+
 	eng->shutdown();
 	return 0;
 }
@@ -0,0 +1,12 @@
+#include <r2/engine.h>
+
+// Writes SCRIPT_SNAPSHOT_FILE, which the engine boots from instead of running SCRIPT_PRELUDE_FILE
+int main(int argc, char** argv) {
+	r2::r2engine::create(argc, argv);
+	r2::r2engine* eng = r2::r2engine::get();
+
+	bool success = r2::script_man::create_snapshot(SCRIPT_SNAPSHOT_FILE, SCRIPT_PRELUDE_FILE);
+
+	eng->shutdown();
+	return success ? 0 : 1;
+}